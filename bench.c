@@ -0,0 +1,436 @@
+/*
+ * Benchmark harness for the storage engine. Drives openDatabase() and
+ * prepared statements directly, so numbers exclude the REPL's line reading
+ * and parsing. Select output goes to /dev/null.
+ *
+ * Build: cc -O2 -pthread bench.c db.c -o bench
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "db.h"
+
+#define DEFAULT_ROWS 100000
+#define DEFAULT_SCANS 10
+#define DEFAULT_SEED 42
+#define DEFAULT_BENCH_FILE "bench.db"
+#define MIXED_WRITE_PERCENT 10
+#define BATCH_ROWS 1000 // inserts per transaction in the batch workload
+#define COUNT_RANGE_IDS 1000 // ids each range-count aggregate spans
+
+typedef struct BenchOptions BenchOptions;
+typedef struct Latencies Latencies;
+
+struct BenchOptions
+{
+    PagerOptions pager;
+    uint32_t scanThreads;
+    uint32_t numRows;
+    uint32_t numScans;
+    uint64_t seed;
+    const char *fn;
+};
+
+struct Latencies
+{
+    uint64_t *nanos;
+    uint32_t count;
+};
+
+static uint64_t rngState;
+
+/**
+ * @brief xorshift64*; reproducible for a given seed on every platform
+ */
+static uint64_t nextRandom(void)
+{
+    rngState ^= rngState >> 12;
+    rngState ^= rngState << 25;
+    rngState ^= rngState >> 27;
+    return rngState * 2685821657736338717ull;
+}
+
+static uint64_t nowNanos(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void prepareOrDie(const char *sql, Statement *statement)
+{
+    if (prepareStatement(sql, statement) != PREPARE_SUCCESS)
+    {
+        printf("Could not prepare '%s'.\n", sql);
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * @brief bind a generated row to a prepared "insert ? ? ?"
+ */
+static void bindRow(Statement *statement, uint32_t id)
+{
+    char username[COLUMN_USERNAME_SIZE + 1];
+    char email[COLUMN_EMAIL_SIZE + 1];
+    int usernameLength = snprintf(username, sizeof(username), "user%u", id);
+    int emailLength = snprintf(email, sizeof(email), "user%u@example.com", id);
+    bindId(statement, 0, id);
+    bindText(statement, 1, username, usernameLength);
+    bindText(statement, 2, email, emailLength);
+}
+
+static Table *openBench(BenchOptions *options, bool fresh)
+{
+    if (fresh)
+    {
+        char walFn[4096];
+        snprintf(walFn, sizeof(walFn), "%s-wal", options->fn);
+        unlink(options->fn);
+        unlink(walFn);
+        for (uint32_t i = 1; i < options->pager.numPartitions; i++)
+        {
+            char partitionFn[4096];
+            snprintf(partitionFn, sizeof(partitionFn), "%s-p%u", options->fn, i);
+            snprintf(walFn, sizeof(walFn), "%s-p%u-wal", options->fn, i);
+            unlink(partitionFn);
+            unlink(walFn);
+        }
+    }
+    Table *table = openDatabase(options->fn, &options->pager);
+    setScanThreads(table, options->scanThreads);
+    table->output = fopen("/dev/null", "w");
+    return table;
+}
+
+static void closeBench(Table *table)
+{
+    fclose(table->output);
+    closeDatabase(table);
+}
+
+static void timeStatement(Latencies *latencies, Statement *statement, Table *table)
+{
+    uint64_t start = nowNanos();
+    if (executeStatement(statement, table) != EXECUTE_SUCCESS)
+    {
+        printf("Statement failed during benchmark.\n");
+        exit(EXIT_FAILURE);
+    }
+    latencies->nanos[latencies->count++] = nowNanos() - start;
+}
+
+static int compareNanos(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static void report(const char *name, Latencies *latencies)
+{
+    uint64_t total = 0;
+    for (uint32_t i = 0; i < latencies->count; i++)
+    {
+        total += latencies->nanos[i];
+    }
+    qsort(latencies->nanos, latencies->count, sizeof(uint64_t), compareNanos);
+    uint64_t p50 = latencies->nanos[latencies->count / 2];
+    uint64_t p99 = latencies->nanos[(uint64_t)latencies->count * 99 / 100];
+
+    printf("%-12s %10u %14.0f %12.2f %12.2f\n", name, latencies->count,
+           latencies->count / (total / 1e9), p50 / 1e3, p99 / 1e3);
+    latencies->count = 0;
+}
+
+/**
+ * @brief ids 1..n in random order
+ */
+static uint32_t *shuffledIds(uint32_t n)
+{
+    uint32_t *ids = malloc(sizeof(uint32_t) * n);
+    for (uint32_t i = 0; i < n; i++)
+    {
+        ids[i] = i + 1;
+    }
+    for (uint32_t i = n - 1; i > 0; i--)
+    {
+        uint32_t j = nextRandom() % (i + 1);
+        uint32_t swap = ids[i];
+        ids[i] = ids[j];
+        ids[j] = swap;
+    }
+    return ids;
+}
+
+static void benchSequentialInsert(BenchOptions *options, Latencies *latencies)
+{
+    Table *table = openBench(options, true);
+    Statement statement;
+    prepareOrDie("insert ? ? ?", &statement);
+    for (uint32_t id = 1; id <= options->numRows; id++)
+    {
+        bindRow(&statement, id);
+        timeStatement(latencies, &statement, table);
+    }
+    closeBench(table);
+    report("seq-insert", latencies);
+}
+
+/**
+ * @brief sequential inserts, BATCH_ROWS to a transaction
+ *
+ * Each commit's time, its fsync included, counts towards the insert
+ * before it.
+ */
+static void benchBatchInsert(BenchOptions *options, Latencies *latencies)
+{
+    Table *table = openBench(options, true);
+    Statement statement;
+    Statement begin;
+    Statement commit;
+    prepareOrDie("insert ? ? ?", &statement);
+    prepareOrDie("begin", &begin);
+    prepareOrDie("commit", &commit);
+    for (uint32_t id = 1; id <= options->numRows; id++)
+    {
+        if (id % BATCH_ROWS == 1)
+        {
+            executeStatement(&begin, table);
+        }
+        bindRow(&statement, id);
+        timeStatement(latencies, &statement, table);
+        if (id % BATCH_ROWS == 0 || id == options->numRows)
+        {
+            uint64_t start = nowNanos();
+            executeStatement(&commit, table);
+            latencies->nanos[latencies->count - 1] += nowNanos() - start;
+        }
+    }
+    closeBench(table);
+    report("batch-insert", latencies);
+}
+
+static void benchRandomInsert(BenchOptions *options, Latencies *latencies)
+{
+    uint32_t *ids = shuffledIds(options->numRows);
+    Table *table = openBench(options, true);
+    Statement statement;
+    prepareOrDie("insert ? ? ?", &statement);
+    for (uint32_t i = 0; i < options->numRows; i++)
+    {
+        bindRow(&statement, ids[i]);
+        timeStatement(latencies, &statement, table);
+    }
+    closeBench(table);
+    free(ids);
+    report("rand-insert", latencies);
+}
+
+static void benchPointLookup(BenchOptions *options, Latencies *latencies)
+{
+    Table *table = openBench(options, false);
+    Statement statement;
+    prepareOrDie("select where id = ?", &statement);
+    for (uint32_t i = 0; i < options->numRows; i++)
+    {
+        bindId(&statement, 0, nextRandom() % options->numRows + 1);
+        timeStatement(latencies, &statement, table);
+    }
+    closeBench(table);
+    report("lookup", latencies);
+}
+
+/**
+ * @brief lookups through the email index
+ */
+static void benchEmailLookup(BenchOptions *options, Latencies *latencies)
+{
+    Table *table = openBench(options, false);
+    Statement statement;
+    prepareOrDie("select where email = ?", &statement);
+    for (uint32_t i = 0; i < options->numRows; i++)
+    {
+        char email[COLUMN_EMAIL_SIZE + 1];
+        uint32_t id = nextRandom() % options->numRows + 1;
+        int emailLength = snprintf(email, sizeof(email), "user%u@example.com", id);
+        bindText(&statement, 0, email, emailLength);
+        timeStatement(latencies, &statement, table);
+    }
+    closeBench(table);
+    report("email-lookup", latencies);
+}
+
+static void benchFullScan(BenchOptions *options, Latencies *latencies)
+{
+    Table *table = openBench(options, false);
+    Statement statement;
+    prepareOrDie("select", &statement);
+    for (uint32_t i = 0; i < options->numScans; i++)
+    {
+        timeStatement(latencies, &statement, table);
+    }
+    closeBench(table);
+    report("scan", latencies);
+}
+
+/**
+ * @brief count(*), min(id) and max(id) of random runs of COUNT_RANGE_IDS
+ * ids, then of the whole table
+ */
+static void benchRangeCount(BenchOptions *options, Latencies *latencies)
+{
+    Table *table = openBench(options, false);
+    Statement range;
+    Statement whole;
+    prepareOrDie("select count(*), min(id), max(id) where id between ? and ?", &range);
+    prepareOrDie("select count(*), min(id), max(id)", &whole);
+    for (uint32_t i = 0; i < options->numRows; i++)
+    {
+        uint32_t low = nextRandom() % options->numRows + 1;
+        bindId(&range, 0, low);
+        bindId(&range, 1, low + COUNT_RANGE_IDS - 1);
+        timeStatement(latencies, &range, table);
+    }
+    report("range-count", latencies);
+    for (uint32_t i = 0; i < options->numRows; i++)
+    {
+        timeStatement(latencies, &whole, table);
+    }
+    closeBench(table);
+    report("count", latencies);
+}
+
+/**
+ * @brief point lookups with MIXED_WRITE_PERCENT inserts of new ids
+ *
+ * Leaves numRows plus the inserted rows in the table.
+ */
+static void benchMixed(BenchOptions *options, Latencies *latencies)
+{
+    Table *table = openBench(options, false);
+    Statement insert;
+    Statement lookup;
+    prepareOrDie("insert ? ? ?", &insert);
+    prepareOrDie("select where id = ?", &lookup);
+    uint32_t maxId = options->numRows;
+    for (uint32_t i = 0; i < options->numRows; i++)
+    {
+        if (nextRandom() % 100 < MIXED_WRITE_PERCENT)
+        {
+            bindRow(&insert, ++maxId);
+            timeStatement(latencies, &insert, table);
+        }
+        else
+        {
+            bindId(&lookup, 0, nextRandom() % maxId + 1);
+            timeStatement(latencies, &lookup, table);
+        }
+    }
+    closeBench(table);
+    report("mixed", latencies);
+}
+
+int main(int argc, char *argv[])
+{
+    BenchOptions options = {
+        .pager = {
+            .numFrames = DEFAULT_POOL_FRAMES,
+            .groupCommit = DEFAULT_GROUP_COMMIT,
+            .useMmap = false,
+            .columnar = false,
+            .compress = false,
+            .numPartitions = 1,
+            .partitioning = PARTITION_HASH,
+            .partitionWidth = 0,
+        },
+        .scanThreads = 1,
+        .numRows = DEFAULT_ROWS,
+        .numScans = DEFAULT_SCANS,
+        .seed = DEFAULT_SEED,
+        .fn = DEFAULT_BENCH_FILE,
+    };
+    int opt;
+    while ((opt = getopt(argc, argv, "n:r:s:f:g:j:cmzp:Ro:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'n':
+            options.numRows = strtoul(optarg, NULL, 10);
+            break;
+        case 'r':
+            options.numScans = strtoul(optarg, NULL, 10);
+            break;
+        case 's':
+            options.seed = strtoull(optarg, NULL, 10);
+            break;
+        case 'f':
+            options.pager.numFrames = strtoul(optarg, NULL, 10);
+            break;
+        case 'g':
+            options.pager.groupCommit = strtoul(optarg, NULL, 10);
+            break;
+        case 'j':
+            options.scanThreads = strtoul(optarg, NULL, 10);
+            break;
+        case 'c':
+            options.pager.columnar = true;
+            break;
+        case 'm':
+            options.pager.useMmap = true;
+            break;
+        case 'z':
+            options.pager.compress = true;
+            break;
+        case 'p':
+            options.pager.numPartitions = strtoul(optarg, NULL, 10);
+            break;
+        case 'R':
+            options.pager.partitioning = PARTITION_RANGE;
+            break;
+        case 'o':
+            options.fn = optarg;
+            break;
+        default:
+            printf("Usage: %s [-n rows] [-r scans] [-s seed] [-f frames] "
+                   "[-g group-commit] [-j scan-threads] [-c] [-m] [-z] [-p partitions] [-R] "
+                   "[-o file]\n",
+                   argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (options.numRows < 2 || options.numScans == 0)
+    {
+        printf("Need at least 2 rows and 1 scan.\n");
+        exit(EXIT_FAILURE);
+    }
+    // xorshift must not start at zero
+    rngState = options.seed ? options.seed : DEFAULT_SEED;
+
+    Latencies latencies;
+    uint32_t maxOps = options.numRows > options.numScans ? options.numRows : options.numScans;
+    latencies.nanos = malloc(sizeof(uint64_t) * maxOps);
+    latencies.count = 0;
+
+    printf("%u rows, %u frames, seed %llu\n", options.numRows,
+           options.pager.numFrames, (unsigned long long)options.seed);
+    printf("%-12s %10s %14s %12s %12s\n", "workload", "ops", "ops/sec",
+           "p50 (us)", "p99 (us)");
+    benchSequentialInsert(&options, &latencies);
+    benchBatchInsert(&options, &latencies);
+    // The read workloads run against the table left by the random insert
+    benchRandomInsert(&options, &latencies);
+    benchPointLookup(&options, &latencies);
+    benchEmailLookup(&options, &latencies);
+    benchFullScan(&options, &latencies);
+    benchRangeCount(&options, &latencies);
+    benchMixed(&options, &latencies);
+
+    free(latencies.nanos);
+    return 0;
+}
@@ -0,0 +1,9659 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+#if defined(__linux__) && !defined(DB_NO_IO_URING)
+#define HAVE_IO_URING 1
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#endif
+#if defined(__SSE2__) && !defined(DB_NO_SIMD)
+#define HAVE_SSE2 1
+#include <immintrin.h>
+#if defined(__GNUC__)
+#define HAVE_AVX2 1 // compiled per function, used if the CPU has it
+#endif
+#elif defined(__aarch64__) && defined(__ARM_NEON) && !defined(DB_NO_SIMD)
+#define HAVE_NEON 1
+#include <arm_neon.h>
+#endif
+#if defined(__x86_64__) && defined(__GNUC__)
+#define HAVE_CRC32C_SSE42 1 // compiled per function, used if the CPU has it
+#include <immintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#define HAVE_CRC32C_ARM 1
+#include <arm_acle.h>
+#endif
+
+#include "db.h"
+
+#define MIN_POOL_FRAMES 16
+#define INVALID_PAGE_NUM UINT32_MAX
+#define INVALID_FRAME_NUM UINT32_MAX
+#define DB_MAGIC 0x31424453 // "SDB1"
+#define DB_VERSION 3
+#define WAL_SUFFIX "-wal"
+#define WAL_MAGIC 0x314c4157 // "WAL1"
+#define WAL_VERSION 2
+#define COMMIT_SUFFIX "-commit"
+#define WAL_CHECKPOINT_FRAMES 1000
+#define GROUP_COMMIT_DELAY_MS 10
+#define BULK_MAX_LEVELS 8       // internal levels above the leaves
+#define BULK_WRITE_PAGES 64     // consecutive pages per write
+#define IMPORT_BUFFER_SIZE (1 << 20)
+#define IMPORT_COMMIT_ROWS 10000
+#define MAX_SCAN_THREADS 64
+#define SCAN_LEAVES_PER_CHUNK 16
+#define SCAN_CHUNKS_AHEAD 2 // per worker, chunks filled before the caller prints them
+#define PARTITION_SCAN_MIN_IDS 4096 // narrower hash partitioned selects use one thread
+#define PARTITION_SCAN_BATCH_ROWS 1024 // rows a partition hands the merge at once
+#define PARTITION_SCAN_BATCHES 4 // per partition, batches waiting to be merged
+#define SINK_BUFFER_SIZE (1 << 16) // rows formatted per write to the output
+#define SINK_FIELD_MAX (2 * COLUMN_EMAIL_SIZE + 4) // a CSV field quoted at worst
+#define ERROR_MESSAGE_SIZE 256
+#define IO_RING_ENTRIES 64
+#define IO_WRITE_TAG (1ull << 63) // marks write completions in user data
+#define CHECKPOINT_BATCH_PAGES IO_RING_ENTRIES
+#define READ_AHEAD_TRIGGER 2 // leaves a cursor crosses before reading ahead
+#define READ_AHEAD_LEAVES 32
+#define SNAPSHOT_PAGES 8 // pages one snapshot reader may hold at once
+#define CACHE_LINE_SIZE 64 // stats slots start on their own line
+#define NUM_INDEXES 2
+#define PAX_MAX_CELLS 512 // cells a PAX leaf can hold, plus one being inserted
+#define LEAF_MASK_WORDS (PAX_MAX_CELLS / 64) // a selection bit for every cell
+#define VACUUM_STEP_LEAVES 64 // leaves one vacuum step visits before it commits
+#define STORE_MAGIC 0x315a4453 // "SDZ1"
+#define STORE_VERSION 1
+#define STORE_EXTENT_BITS 3 // an extent's length field: one to eight sectors
+#define LZ4_HASH_BITS 12
+#define LZ4_MIN_MATCH 4
+#define LZ4_SKIP_SHIFT 5 // every 32 misses in a row, step one byte further
+#define LZ4_LAST_LITERALS 5 // a block always ends with this many literals...
+#define LZ4_MATCH_LIMIT 12  // ...and its last match starts this far from the end
+
+typedef struct Frame Frame;
+typedef struct Wal Wal;
+typedef struct WalIndexEntry WalIndexEntry;
+typedef struct IoRing IoRing;
+typedef struct Snapshot Snapshot;
+typedef struct IndexProbe IndexProbe;
+typedef struct IndexEntry IndexEntry;
+typedef struct PaxCell PaxCell;
+typedef struct Cursor Cursor;
+typedef struct BulkLevel BulkLevel;
+typedef struct BulkLoader BulkLoader;
+typedef struct ResultSink ResultSink;
+typedef struct ScanChunk ScanChunk;
+typedef struct ParallelScan ParallelScan;
+typedef struct PartitionRows PartitionRows;
+typedef struct PartitionQueue PartitionQueue;
+typedef struct PartitionScan PartitionScan;
+typedef struct Aggregates Aggregates;
+typedef struct ErrorScope ErrorScope;
+typedef struct OpenRequest OpenRequest;
+typedef struct Vacuum Vacuum;
+typedef struct PageStore PageStore;
+typedef struct StatsSlot StatsSlot;
+
+typedef enum
+{
+    NODE_INTERNAL,
+    NODE_LEAF,
+    NODE_PAX_LEAF // a leaf with one minipage per column
+} NodeType;
+
+typedef enum
+{
+    IO_READ,  // into one buffer
+    IO_WRITEV // from an iovec array
+} IoOp;
+
+// The counters in a StatsSlot, in DbStats order
+typedef enum
+{
+    STAT_PAGE_HITS,
+    STAT_PAGE_MISSES,
+    STAT_EVICTIONS,
+    STAT_BYTES_READ,
+    STAT_BYTES_WRITTEN,
+    STAT_WAL_BYTES_WRITTEN,
+    STAT_ROWS_SCANNED,
+    STAT_ROWS_RETURNED,
+    STAT_PREPARE_NANOS, // the first of STATS_LATENCY_BUCKETS
+    STAT_EXECUTE_NANOS = STAT_PREPARE_NANOS + STATS_LATENCY_BUCKETS,
+    NUM_STATS = STAT_EXECUTE_NANOS + STATS_LATENCY_BUCKETS
+} Stat;
+
+/**
+ * A buffer pool frame. A frame holds at most one page; pinned frames are
+ * never chosen as eviction victims.
+ */
+struct Frame
+{
+    uint32_t pageNum;  // INVALID_PAGE_NUM if the frame is free
+    uint32_t pinCount; // number of outstanding getPage() references
+    bool dirty;        // page differs from its on-disk copy
+    bool referenced;   // CLOCK reference bit
+    int32_t next;      // next frame in the same page table bucket, or -1
+    bool loading;      // a getPage() call is reading the page in
+    bool prefetched;   // ...or a read on the I/O ring is; see prefetchPages()
+    bool verify;       // read from the database file; checksum not yet checked
+    void *data;
+};
+
+struct WalIndexEntry
+{
+    uint32_t pageNum; // INVALID_PAGE_NUM if the slot is empty
+    uint32_t frameNum;
+};
+
+/**
+ * Write-ahead log. Holds full page images appended in commit order; a
+ * frame whose dbSize is non-zero ends a committed transaction.
+ */
+struct Wal
+{
+    int fd;
+    char *fn;
+    uint32_t numFrames;       // frames appended since the last reset
+    uint32_t lastCommitFrame; // frames up to here are committed
+    uint32_t salt;            // bumped on reset to invalidate stale frames
+    uint32_t checksum[2];     // running checksum of the last frame
+    uint32_t commitChecksum[2]; // ...and of the last commit frame
+    WalIndexEntry *index;     // pageNum -> newest frame, open addressing
+    uint32_t indexCapacity;   // power of two
+    uint32_t indexCount;
+    uint32_t groupCommit;     // commits that share one fsync
+    // Guards the group commit state below; fsync runs without it
+    pthread_mutex_t syncLock;
+    pthread_cond_t syncWake;  // a group has begun, or the log is closing
+    pthread_t flusher;        // syncs each group GROUP_COMMIT_DELAY_MS old
+    bool flusherRunning;
+    bool closing;
+    uint64_t commits;         // made since the log was opened
+    uint64_t syncedCommits;   // ...of which these are known to be on disk
+    uint64_t firstUnsyncedMillis;
+    int syncError;            // errno of an fsync the flusher had fail
+    void *frameBuffer;        // one frame header plus page
+    uint32_t *framePrev;      // per frame, the page's previous frame
+    uint32_t framePrevCapacity;
+    uint32_t backfilled;      // frames below this are in the database file
+    // Snapshot readers look frames up while the writer appends them
+    pthread_rwlock_t indexLock;
+    // Guards the snapshot list, and lastCommitFrame as readers see it
+    pthread_mutex_t snapshotLock;
+    Snapshot *snapshots;      // open snapshots, in no particular order
+    uint32_t transaction;     // the commit across partitions that frames
+                              // are written for, or 0; see CommitLog
+    uint32_t recordedTransaction; // the newest the commit record held at open
+};
+
+/**
+ * What makes a commit across partitions atomic, and lets a reader see each
+ * commit in all of its partitions or in none.
+ *
+ * A commit that changes more than one partition tags its commit frames
+ * with a new id and holds them back from readers. Once every log is synced
+ * it writes the id to <fn>-commit, syncs that too, and only then shows the
+ * frames. Recovery drops a tagged commit newer than the record.
+ *
+ * Each such commit counts itself in started before any partition shows
+ * it, and in finished once they all do. A reader opens its snapshots while
+ * the two agree, and tries again if started moved meanwhile; a commit to
+ * one partition is atomic on its own and counts in neither.
+ */
+struct CommitLog
+{
+    int fd;
+    uint32_t lastTransaction; // the id the record holds
+    atomic_uint started;
+    atomic_uint finished;
+};
+
+/**
+ * A reader's view of the database as of one commit. Each page comes from
+ * its newest WAL frame below walFrames, or else from the database file;
+ * never from the writer's buffer pool. Checkpoints leave both alone while
+ * the snapshot is open, so the view cannot change under the reader.
+ */
+struct Snapshot
+{
+    Pager *pager;
+    uint32_t walFrames; // frames committed when the snapshot was taken
+    void *pages;        // SNAPSHOT_PAGES buffers for pages read by pread
+    uint32_t freePages; // bit i set while buffer i is free
+    bool open;
+    Snapshot *prev;
+    Snapshot *next;
+};
+
+/**
+ * An io_uring instance: the submission and completion rings shared with
+ * the kernel. See io_uring(7); the fields point into the mappings.
+ */
+struct IoRing
+{
+    int fd;
+    uint32_t entries;
+    uint32_t inFlight;    // queued and not yet reaped
+    uint32_t unsubmitted; // queued and not yet passed to the kernel
+    void *rings;          // both rings, in one mapping
+    size_t ringsLen;
+    void *sqes;           // submission queue entries
+    size_t sqesLen;
+    uint32_t *sqHead;
+    uint32_t *sqTail;
+    uint32_t sqMask;
+    uint32_t *sqArray;
+    uint32_t *cqHead;
+    uint32_t *cqTail;
+    uint32_t cqMask;
+    void *cqes;
+};
+
+/**
+ * Where each page of a compressed database file lives: an extent of
+ * sectors per page, found through the map. A page is always written to
+ * free sectors, never over the copy the durable map names, so a crash
+ * leaves that map and its pages intact and the WAL replays the rest.
+ */
+struct PageStore
+{
+    uint32_t *extents;     // per page: sector << STORE_EXTENT_BITS | (sectors - 1),
+                           // or 0 if the page was never written
+    uint32_t numPages;     // pages with a slot in extents
+    uint32_t capacity;
+    uint64_t *used;        // a bit per sector in use, or freed since the last sync
+    uint32_t numSectors;   // sectors the bitmap covers
+    uint32_t usedCapacity; // words allocated for used
+    uint32_t hint;         // where the next allocation starts looking
+    uint32_t *pending;     // extents freed since the last sync
+    uint32_t numPending;
+    uint32_t pendingCapacity;
+    uint32_t mapSector;    // first sector of the durable map, or 0 if it is empty
+    uint32_t mapPages;     // pages the durable map covers
+    uint32_t sequence;     // of the current superblock
+    bool dirty;            // extents differ from the durable map
+    void *buffer;          // a batch of pages as written, sector aligned
+    // Readers hold it from looking an extent up until they have read it,
+    // so the writer cannot reuse the sectors under them
+    pthread_rwlock_t lock;
+};
+
+struct Pager
+{
+    int fd;              // file descriptor
+    uint32_t fLen;       // file length
+    uint32_t numPages;   // pages in the file plus pages allocated since open
+    uint32_t numFrames;  // buffer pool capacity
+    Frame *frames;
+    void *arena;         // every frame's page, in one page-aligned mapping
+    size_t arenaLen;
+    void *scratch;       // one page for the writer's temporary copies
+    int32_t *buckets;    // page table: pageNum hash -> first frame in chain
+    uint32_t numBuckets; // power of two
+    uint32_t clockHand;
+    Wal *wal;
+    PageStore *store;    // NULL unless the file is compressed
+    bool useMmap;
+    void *map;     // read-only mapping of the database file, or NULL
+    size_t mapLen; // bytes mapped; always whole pages
+    // Per page of the file, its checksum has been checked since the open.
+    // Pages the checkpointer writes get checksums made from memory, so a
+    // flag stays set; pages past numChecked are checked at every read.
+    atomic_bool *checked;
+    uint32_t numChecked;
+    // Guards the frames and page table so that read-only callers of
+    // getPage(), readPage() and their release functions may run on
+    // several threads at once. Everything else is single-threaded.
+    pthread_mutex_t latch;
+    pthread_cond_t loaded; // signalled when a frame finishes loading
+    // Asynchronous reads and write-back; NULL where io_uring is missing,
+    // in which case all I/O is synchronous
+    IoRing *ring;
+    pthread_mutex_t ioLock;  // guards the ring; taken before the latch
+    uint32_t numPrefetching; // frames waiting on a ring read, under latch
+    uint32_t writesInFlight; // under ioLock
+    int writeError;          // errno of a failed ring write, or 0
+    bool inTransaction;           // commitPager() waits for the commit
+    uint32_t transactionNumPages; // numPages at the begin
+};
+
+struct Cursor
+{
+    Table *table;
+    uint32_t pageNum;
+    uint32_t cellNum;
+    bool EOT;   // Indicates a position one past the last element
+    void *page; // set between cursorLeaf() and cursorRelease()
+    uint32_t leavesCrossed; // by cursorAdvance()
+    uint32_t readAheadMark; // leaf whose arrival starts the next read-ahead
+};
+
+/**
+ * A secondary index on a text column: a B-tree on the table's pager whose
+ * cells are rows holding the indexed row's id and the column value. The
+ * key is a hash of the value and the id breaks ties, so every entry for a
+ * value sits among the entries with its hash, in id order.
+ */
+struct Index
+{
+    Table tree; // rootPageNum and pager; the tree has no indexes itself
+    Column column;
+};
+
+/**
+ * Walks the entries keyed by a value's hash, yielding the ids of the rows
+ * whose indexed column equals the value.
+ */
+struct IndexProbe
+{
+    Index *index;
+    Cursor cursor;
+    uint32_t key; // the value's hash
+    const char *value;
+    uint32_t length;
+};
+
+/**
+ * One row's entry while an index is being built in bulk.
+ */
+struct IndexEntry
+{
+    uint32_t hash;
+    uint32_t id;
+    uint32_t valueOffset; // into the builder's value buffer
+    uint32_t valueLength;
+};
+
+/**
+ * One row on its way into a PAX leaf. The strings point into the page or
+ * Row the row came from, which must outlive the repack.
+ */
+struct PaxCell
+{
+    uint32_t key;
+    const char *username;
+    const char *email;
+    uint8_t usernameLength;
+    uint8_t emailLength;
+};
+
+/**
+ * The open (rightmost) node on one internal level of a bulk-built tree.
+ */
+struct BulkLevel
+{
+    uint32_t pageNum; // reserved page the node will be written to
+    uint32_t numChildren;
+    uint32_t *children;
+    uint64_t *keys; // max key under each child
+};
+
+/**
+ * Builds a B-tree bottom-up from rows in ascending key order. Full pages
+ * are written straight to new pages at the end of the database file; only
+ * the root goes through the buffer pool and WAL, so the tree becomes
+ * visible in a single commit.
+ */
+struct BulkLoader
+{
+    Table *table;
+    void *leaf;           // leaf being filled, always in the row layout
+    bool columnar;        // ...and converted to PAX as it is written
+    uint32_t leafPageNum; // page reserved for it
+    uint32_t numLeaves;   // leaves written so far
+    uint32_t numRows;
+    uint32_t lastKey;
+    BulkLevel levels[BULK_MAX_LEVELS];
+    uint32_t numLevels;
+    void *scratch;        // internal node being written
+    void *batch;          // run of consecutive pages not yet written
+    uint32_t batchStart;
+    uint32_t batchCount;
+};
+
+/**
+ * Where a select formats its rows. A file sink writes its buffer out with
+ * one system call whenever it fills; a memory sink (out is NULL) grows
+ * instead, and keeps everything until it is handed to a file sink.
+ */
+struct ResultSink
+{
+    FILE *out;
+    int fd;      // out's descriptor, or -1 to go through stdio
+    bool direct; // out's own buffer has been flushed ahead of writing to fd
+    OutputFormat format;
+    char *buffer;
+    size_t used;
+    size_t capacity;
+};
+
+/**
+ * Output of one run of leaves in a parallel scan.
+ */
+struct ScanChunk
+{
+    ResultSink sink; // a memory sink, filled by one worker
+    bool done;
+};
+
+/**
+ * Workers claim runs of SCAN_LEAVES_PER_CHUNK leaves in order from a
+ * shared counter; the calling thread prints finished chunks in order.
+ * No worker fills a chunk more than SCAN_CHUNKS_AHEAD per worker past the
+ * one being printed, so the chunks held in memory stay few.
+ */
+struct ParallelScan
+{
+    Table *table;
+    Statement *statement;
+    ResultSink *sink; // where the rows end up, or NULL to only count them
+    uint32_t *leaves; // leaf page numbers in key order
+    uint32_t numLeaves;
+    ScanChunk *chunks;
+    uint32_t numChunks;
+    uint32_t numThreads;
+    atomic_uint nextChunk;
+    pthread_mutex_t lock;
+    pthread_cond_t chunkDone; // a chunk was filled, or printed
+    uint32_t numPrinted;      // chunks the calling thread has written out
+    atomic_bool failed; // a worker raised an error; the rest stop claiming
+    DbResult errorCode;
+    char errorMessage[ERROR_MESSAGE_SIZE];
+};
+
+/**
+ * A batch of one partition's matching rows in a parallel scan of a hash
+ * partitioned table, with where each row's output ends so that batches
+ * can be merged by id.
+ */
+struct PartitionRows
+{
+    ResultSink sink; // a memory sink
+    uint32_t *ids;
+    size_t *ends;    // sink offset just past each row
+    uint32_t numRows;
+    uint32_t capacity;
+};
+
+/**
+ * One partition in a parallel scan: a ring of batches filled in id order
+ * by whichever worker holds the partition, and emptied by the merge.
+ */
+struct PartitionQueue
+{
+    PartitionRows batches[PARTITION_SCAN_BATCHES];
+    uint32_t head;     // the batch being merged
+    uint32_t numReady; // filled batches from head on
+    uint32_t resumeId; // where the scan of the partition goes on from
+    bool claimed;      // a worker is scanning it
+    bool finished;     // scanned to the end of the range
+};
+
+/**
+ * Workers claim any partition with room for another batch, fill batches
+ * until it has no more room or is finished, then let it go; the calling
+ * thread merges batches by id as they come. So no partition gets more than
+ * PARTITION_SCAN_BATCHES batches ahead of the merge, and no worker waits
+ * on a full partition while another one needs scanning.
+ */
+struct PartitionScan
+{
+    Table *table; // the partitioned table
+    Statement *statement;
+    OutputFormat format;
+    PartitionQueue *parts; // for partitions first on
+    uint32_t first;
+    uint32_t numParts;
+    uint32_t numFinished;
+    pthread_mutex_t lock;   // guards the queues' fields, not their batches
+    pthread_cond_t changed; // a batch was filled or merged, or a partition let go
+    atomic_bool failed;
+    DbResult errorCode;
+    char errorMessage[ERROR_MESSAGE_SIZE];
+};
+
+/**
+ * What an aggregate select has found so far, summed over partitions.
+ */
+struct Aggregates
+{
+    bool empty;     // no row matched yet
+    uint32_t count; // kept only when the projection has count(*)
+    uint32_t minId;
+    uint32_t maxId;
+};
+
+/**
+ * Where fatalError() lands. API calls install one around the engine; with
+ * none installed, as in the shell, an error ends the process.
+ */
+struct ErrorScope
+{
+    jmp_buf jump;
+    DbResult code;
+    char message[ERROR_MESSAGE_SIZE];
+};
+
+struct Database
+{
+    Table *table;         // NULL if the open failed
+    bool failed;          // an engine error left the table in an unknown state
+    DbResult errorCode;   // of the last failed call
+    char errorMessage[ERROR_MESSAGE_SIZE];
+    uint32_t numStatements; // prepared and not yet finalized
+    pthread_mutex_t lock;   // guards the fields above, except table
+    // Held by the one thread changing a partition, or the table when it
+    // has none; a writer takes the ones it needs in order
+    pthread_mutex_t writeLocks[MAX_PARTITIONS];
+};
+
+struct DbStatement
+{
+    Database *db;
+    Table *table;      // what it reads: db's table, or one partition of it
+    Statement statement;
+    Cursor cursor;
+    bool active;       // a select is part way through its rows
+    void *leaf;        // holds the current row at cursor.cellNum; valid
+                       // until the next step
+    Snapshot snapshot; // what an active select reads
+    IndexProbe probe;  // for a select on an indexed column
+    // A select on a partitioned table reads each partition through its
+    // own part, a statement with its own snapshot; NULL otherwise
+    DbStatement *parts;
+    uint32_t current;  // the part holding the current row
+    Aggregates aggregates; // the row of an aggregate select, while active
+};
+
+/**
+ * One thread's counters. Only the owning thread writes them, so counting
+ * is a plain load and store; dbStats() reads every slot at once.
+ */
+struct StatsSlot
+{
+    _Atomic uint64_t counts[NUM_STATS];
+    StatsSlot *next;
+};
+
+struct OpenRequest
+{
+    Database *db;
+    const char *fn;
+    const PagerOptions *options;
+};
+
+/**
+ * Where a vacuum has got to. Each step starts from a key rather than a
+ * page, so other writes may change the tree between steps.
+ */
+struct Vacuum
+{
+    Table *table;
+    uint32_t tree; // 0 for the table, i + 1 for index i
+    uint64_t key;  // the next step starts at the leaf holding this treeKey()
+    bool done;
+    uint32_t pagesFreed;
+};
+
+static _Thread_local ErrorScope *errorScope = NULL;
+// Set while this thread reads through a snapshot; see readPage()
+static _Thread_local Snapshot *readSnapshot = NULL;
+static _Thread_local StatsSlot *threadStats = NULL;
+// The database whose writeLocks this thread holds for an open transaction
+static _Thread_local Database *transactionDb = NULL;
+// Every live thread's slot; an exiting thread's counts move to retiredStats
+static pthread_mutex_t statsLock = PTHREAD_MUTEX_INITIALIZER;
+static StatsSlot *statsSlots = NULL;
+static uint64_t retiredStats[NUM_STATS];
+static pthread_key_t statsKey;
+static pthread_once_t statsKeyOnce = PTHREAD_ONCE_INIT;
+
+
+/*
+ * Row Encoding: the INT columns at fixed offsets, 4 bytes each, then each
+ * TEXT column as a one-byte length and its bytes, in schema order.
+ * Strings are not NUL-terminated on disk.
+ *
+ * DEFINE_ROW_CODEC(fn, CONST, Type, SCHEMA) writes the codec for a schema
+ * given as TABLE_SCHEMA is, and a struct Type with a field per column:
+ *   CONST_FIXED_SIZE, CONST_MIN_SIZE, CONST_MAX_SIZE   encoded sizes
+ *   fnSize(row)               bytes fnSerialize() writes for row
+ *   fnSerialize(row, dest)
+ *   fnDeserialize(src, row)   NUL-terminates text
+ *   fnInt(src, column)        one INT column, read in place
+ *   fnText(src, column, &len) one TEXT column, read in place
+ * Columns are numbered in schema order, as Column numbers the table's.
+ * Each column is unrolled into its own code, so INT columns, and the
+ * first TEXT, are read at constant offsets; the functions are inline so
+ * that a call with a constant column reduces to that column's code.
+ */
+#define ROW_INT_SIZE sizeof(uint32_t)
+#define ROW_LENGTH_SIZE sizeof(uint8_t)
+
+#define ROW_CODEC_INTS_INT(C, name, NAME, maxLength) C##_INT_##NAME,
+#define ROW_CODEC_INTS_TEXT(C, name, NAME, maxLength)
+#define ROW_CODEC_TEXTS_INT(C, name, NAME, maxLength)
+#define ROW_CODEC_TEXTS_TEXT(C, name, NAME, maxLength) C##_TEXT_##NAME,
+#define ROW_CODEC_CHECK_INT(C, name, NAME, maxLength)
+#define ROW_CODEC_CHECK_TEXT(C, name, NAME, maxLength) \
+    _Static_assert((maxLength) <= UINT8_MAX, "TEXT column " #name " is too long for its length byte");
+#define ROW_CODEC_MAX_INT(C, name, NAME, maxLength)
+#define ROW_CODEC_MAX_TEXT(C, name, NAME, maxLength) +(maxLength)
+#define ROW_CODEC_SIZE_INT(C, name, NAME, maxLength)
+#define ROW_CODEC_SIZE_TEXT(C, name, NAME, maxLength) size += strlen(row->name);
+#define ROW_CODEC_PUT_INT(C, name, NAME, maxLength) \
+    memcpy((uint8_t *)dest + C##_INT_##NAME * ROW_INT_SIZE, &(row->name), ROW_INT_SIZE);
+#define ROW_CODEC_PUT_TEXT(C, name, NAME, maxLength) \
+    {                                                \
+        uint8_t length = strlen(row->name);          \
+        *text = length;                              \
+        memcpy(text + ROW_LENGTH_SIZE, row->name, length); \
+        text += ROW_LENGTH_SIZE + length;            \
+    }
+#define ROW_CODEC_GET_INT(C, name, NAME, maxLength) \
+    memcpy(&(row->name), (const uint8_t *)src + C##_INT_##NAME * ROW_INT_SIZE, ROW_INT_SIZE);
+#define ROW_CODEC_GET_TEXT(C, name, NAME, maxLength) \
+    {                                                \
+        uint8_t length = *text;                      \
+        memcpy(row->name, text + ROW_LENGTH_SIZE, length); \
+        row->name[length] = '\0';                    \
+        text += ROW_LENGTH_SIZE + length;            \
+    }
+#define ROW_CODEC_INT_INT(C, name, NAME, maxLength)                                   \
+    if (column == C##_COLUMN_##NAME)                                                  \
+    {                                                                                 \
+        uint32_t value;                                                               \
+        memcpy(&value, (const uint8_t *)src + C##_INT_##NAME * ROW_INT_SIZE, ROW_INT_SIZE); \
+        return value;                                                                 \
+    }
+#define ROW_CODEC_INT_TEXT(C, name, NAME, maxLength)
+#define ROW_CODEC_TEXT_INT(C, name, NAME, maxLength)
+#define ROW_CODEC_TEXT_TEXT(C, name, NAME, maxLength) \
+    if (column == C##_COLUMN_##NAME)                  \
+    {                                                 \
+        *length = *text;                              \
+        return (const char *)(text + ROW_LENGTH_SIZE); \
+    }                                                 \
+    text += ROW_LENGTH_SIZE + *text;
+// Each of these picks the TYPE-specific macro above for one column
+#define ROW_CODEC_COLUMN(C, name, NAME, TYPE, maxLength) C##_COLUMN_##NAME,
+#define ROW_CODEC_INTS(C, name, NAME, TYPE, maxLength) ROW_CODEC_INTS_##TYPE(C, name, NAME, maxLength)
+#define ROW_CODEC_TEXTS(C, name, NAME, TYPE, maxLength) ROW_CODEC_TEXTS_##TYPE(C, name, NAME, maxLength)
+#define ROW_CODEC_CHECK(C, name, NAME, TYPE, maxLength) \
+    ROW_CODEC_CHECK_##TYPE(C, name, NAME, maxLength)
+#define ROW_CODEC_MAX(C, name, NAME, TYPE, maxLength) ROW_CODEC_MAX_##TYPE(C, name, NAME, maxLength)
+#define ROW_CODEC_SIZE(C, name, NAME, TYPE, maxLength) ROW_CODEC_SIZE_##TYPE(C, name, NAME, maxLength)
+#define ROW_CODEC_PUT(C, name, NAME, TYPE, maxLength) ROW_CODEC_PUT_##TYPE(C, name, NAME, maxLength)
+#define ROW_CODEC_GET(C, name, NAME, TYPE, maxLength) ROW_CODEC_GET_##TYPE(C, name, NAME, maxLength)
+#define ROW_CODEC_INT(C, name, NAME, TYPE, maxLength) ROW_CODEC_INT_##TYPE(C, name, NAME, maxLength)
+#define ROW_CODEC_TEXT(C, name, NAME, TYPE, maxLength) ROW_CODEC_TEXT_##TYPE(C, name, NAME, maxLength)
+
+#define DEFINE_ROW_CODEC(fn, C, Type, SCHEMA)                                         \
+    SCHEMA(ROW_CODEC_CHECK, C)                                                        \
+    enum                                                                              \
+    {                                                                                 \
+        SCHEMA(ROW_CODEC_COLUMN, C) C##_NUM_COLUMNS                                   \
+    };                                                                                \
+    enum                                                                              \
+    {                                                                                 \
+        SCHEMA(ROW_CODEC_INTS, C) C##_NUM_INTS                                        \
+    };                                                                                \
+    enum                                                                              \
+    {                                                                                 \
+        SCHEMA(ROW_CODEC_TEXTS, C) C##_NUM_TEXTS                                      \
+    };                                                                                \
+    enum                                                                              \
+    {                                                                                 \
+        C##_FIXED_SIZE = C##_NUM_INTS * ROW_INT_SIZE,                                 \
+        C##_MIN_SIZE = C##_FIXED_SIZE + C##_NUM_TEXTS * ROW_LENGTH_SIZE,              \
+        C##_MAX_SIZE = C##_MIN_SIZE SCHEMA(ROW_CODEC_MAX, C)                          \
+    };                                                                                \
+    static inline uint32_t fn##Size(const Type *row)                                  \
+    {                                                                                 \
+        uint32_t size = C##_MIN_SIZE;                                                 \
+        SCHEMA(ROW_CODEC_SIZE, C)                                                     \
+        return size;                                                                  \
+    }                                                                                 \
+    static inline void fn##Serialize(const Type *row, void *dest)                     \
+    {                                                                                 \
+        uint8_t *text = (uint8_t *)dest + C##_FIXED_SIZE;                             \
+        SCHEMA(ROW_CODEC_PUT, C)                                                      \
+        (void)text;                                                                   \
+    }                                                                                 \
+    static inline void fn##Deserialize(const void *src, Type *row)                    \
+    {                                                                                 \
+        const uint8_t *text = (const uint8_t *)src + C##_FIXED_SIZE;                  \
+        SCHEMA(ROW_CODEC_GET, C)                                                      \
+        (void)text;                                                                   \
+    }                                                                                 \
+    static inline uint32_t fn##Int(const void *src, uint32_t column)                  \
+    {                                                                                 \
+        SCHEMA(ROW_CODEC_INT, C)                                                      \
+        return 0;                                                                     \
+    }                                                                                 \
+    static inline const char *fn##Text(const void *src, uint32_t column,              \
+                                       uint32_t *length)                              \
+    {                                                                                 \
+        const uint8_t *text = (const uint8_t *)src + C##_FIXED_SIZE;                  \
+        SCHEMA(ROW_CODEC_TEXT, C)                                                     \
+        *length = 0;                                                                  \
+        return NULL;                                                                  \
+    }
+
+DEFINE_ROW_CODEC(tableRow, TABLE_ROW, Row, TABLE_SCHEMA)
+
+#define SCHEMA_NAME(arg, name, NAME, TYPE, maxLength) #name,
+#define SCHEMA_MAX_LENGTH(arg, name, NAME, TYPE, maxLength) maxLength,
+// What statements call each Column, and the longest text it holds
+const char *const COLUMN_NAMES[] = {TABLE_SCHEMA(SCHEMA_NAME, )};
+const uint32_t COLUMN_MAX_LENGTHS[] = {TABLE_SCHEMA(SCHEMA_MAX_LENGTH, )};
+_Static_assert(TABLE_ROW_NUM_COLUMNS <= PROJECTION_MAX_COLUMNS, "select * must fit a projection");
+
+const uint32_t ROW_MIN_SIZE = TABLE_ROW_MIN_SIZE;
+const uint32_t ROW_MAX_SIZE = TABLE_ROW_MAX_SIZE;
+
+const uint32_t PAGE_SIZE = 4096;
+
+/*
+ * Page Trailer Layout: every page ends with the CRC32C of the rest of it,
+ * set as the page is logged or bulk written
+ */
+const uint32_t PAGE_CHECKSUM_SIZE = sizeof(uint32_t);
+const uint32_t PAGE_CHECKSUM_OFFSET = PAGE_SIZE - PAGE_CHECKSUM_SIZE;
+const uint32_t PAGE_USABLE_SIZE = PAGE_SIZE - PAGE_CHECKSUM_SIZE;
+
+/*
+ * File Header Layout: page 0 holds magic, version, page size, row count,
+ * free-list head, then the root page of the table and of each index, then
+ * which partition the file is and how the table is partitioned. Files from
+ * before partitioning have zeros there: one partition.
+ */
+const uint32_t HEADER_PAGE_NUM = 0;
+const uint32_t HEADER_MAGIC_OFFSET = 0;
+const uint32_t HEADER_VERSION_OFFSET = 4;
+const uint32_t HEADER_PAGE_SIZE_OFFSET = 8;
+const uint32_t HEADER_ROW_COUNT_OFFSET = 12;
+const uint32_t HEADER_FREE_LIST_OFFSET = 16;
+const uint32_t HEADER_ROOTS_OFFSET = 20;
+const uint32_t HEADER_PARTITION_OFFSET = HEADER_ROOTS_OFFSET + (NUM_INDEXES + 1) * sizeof(uint32_t);
+const uint32_t HEADER_NUM_PARTITIONS_OFFSET = HEADER_PARTITION_OFFSET + 4;
+const uint32_t HEADER_PARTITIONING_OFFSET = HEADER_PARTITION_OFFSET + 8;
+const uint32_t HEADER_PARTITION_WIDTH_OFFSET = HEADER_PARTITION_OFFSET + 12;
+
+/*
+ * Compressed File Layout: 512-byte sectors. Sectors 0 and 1 hold
+ * superblocks, rewritten in turn so that one is always whole; the valid
+ * one with the higher sequence is current. Its map is one extent per page,
+ * in as many sectors as that takes.
+ */
+const uint32_t STORE_SECTOR_SIZE = 512;
+const uint32_t STORE_SUPERBLOCKS = 2;
+const uint32_t STORE_MAGIC_OFFSET = 0;
+const uint32_t STORE_VERSION_OFFSET = 4;
+const uint32_t STORE_SEQUENCE_OFFSET = 8;
+const uint32_t STORE_NUM_PAGES_OFFSET = 12;
+const uint32_t STORE_MAP_SECTOR_OFFSET = 16;
+const uint32_t STORE_MAP_CHECKSUM_OFFSET = 20;
+const uint32_t STORE_CHECKSUM_OFFSET = 24;
+
+/*
+ * Compressed Page Layout: a page in fewer sectors than a whole page is
+ * the length of an LZ4 block, then the block; otherwise it is stored as it
+ * is
+ */
+const uint32_t STORE_BLOCK_LENGTH_SIZE = sizeof(uint16_t);
+
+/*
+ * Free Page Layout: the next page on the free list, or 0 at its end
+ */
+const uint32_t FREE_PAGE_NEXT_OFFSET = 0;
+
+/*
+ * WAL Header Layout: magic, version, page size, salt, checksum
+ */
+const uint32_t WAL_HEADER_CHECKSUM_OFFSET = 16;
+const uint32_t WAL_HEADER_SIZE = 24;
+
+/*
+ * WAL Frame Layout: page number, db size, transaction (a commit across
+ * partitions, or 0), salt, checksum, page image
+ */
+const uint32_t WAL_FRAME_PAGE_NUM_OFFSET = 0;
+const uint32_t WAL_FRAME_DB_SIZE_OFFSET = 4;
+const uint32_t WAL_FRAME_TRANSACTION_OFFSET = 8;
+const uint32_t WAL_FRAME_SALT_OFFSET = 12;
+const uint32_t WAL_FRAME_CHECKSUM_OFFSET = 16;
+const uint32_t WAL_FRAME_HEADER_SIZE = 24;
+const uint32_t WAL_FRAME_SIZE = WAL_FRAME_HEADER_SIZE + PAGE_SIZE;
+
+/*
+ * Common Node Header Layout
+ *
+ * Node headers are padded so that every uint32_t in them, and in the
+ * slots and cells after them, is 4-byte aligned and can be read in place.
+ */
+const uint32_t NODE_TYPE_SIZE = sizeof(uint8_t);
+const uint32_t NODE_TYPE_OFFSET = 0;
+const uint32_t IS_ROOT_SIZE = sizeof(uint8_t);
+const uint32_t IS_ROOT_OFFSET = NODE_TYPE_SIZE;
+const uint32_t NODE_PADDING_SIZE = sizeof(uint16_t);
+const uint32_t PARENT_POINTER_SIZE = sizeof(uint32_t);
+const uint32_t PARENT_POINTER_OFFSET = IS_ROOT_OFFSET + IS_ROOT_SIZE + NODE_PADDING_SIZE;
+const uint8_t COMMON_NODE_HEADER_SIZE =
+    NODE_TYPE_SIZE + IS_ROOT_SIZE + NODE_PADDING_SIZE + PARENT_POINTER_SIZE;
+
+/*
+ * Internal Node Header Layout
+ */
+const uint32_t INTERNAL_NODE_NUM_KEYS_SIZE = sizeof(uint32_t);
+const uint32_t INTERNAL_NODE_NUM_KEYS_OFFSET = COMMON_NODE_HEADER_SIZE;
+const uint32_t INTERNAL_NODE_RIGHT_CHILD_SIZE = sizeof(uint32_t);
+const uint32_t INTERNAL_NODE_RIGHT_CHILD_OFFSET =
+    INTERNAL_NODE_NUM_KEYS_OFFSET + INTERNAL_NODE_NUM_KEYS_SIZE;
+const uint32_t INTERNAL_NODE_HEADER_SIZE = COMMON_NODE_HEADER_SIZE +
+                                           INTERNAL_NODE_NUM_KEYS_SIZE +
+                                           INTERNAL_NODE_RIGHT_CHILD_SIZE;
+
+/*
+ * Internal Node Body Layout
+ */
+const uint32_t INTERNAL_NODE_KEY_SIZE = sizeof(uint32_t);
+const uint32_t INTERNAL_NODE_KEY_ID_SIZE = sizeof(uint32_t); // breaks ties between keys
+const uint32_t INTERNAL_NODE_CHILD_SIZE = sizeof(uint32_t);
+const uint32_t INTERNAL_NODE_CELL_SIZE =
+    INTERNAL_NODE_CHILD_SIZE + INTERNAL_NODE_KEY_SIZE + INTERNAL_NODE_KEY_ID_SIZE;
+const uint32_t INTERNAL_NODE_MAX_KEYS =
+    (PAGE_USABLE_SIZE - INTERNAL_NODE_HEADER_SIZE) / INTERNAL_NODE_CELL_SIZE;
+
+/*
+ * Leaf Node Header Layout
+ */
+const uint32_t LEAF_NODE_NUM_CELLS_SIZE = sizeof(uint32_t);
+const uint32_t LEAF_NODE_NUM_CELLS_OFFSET = COMMON_NODE_HEADER_SIZE;
+const uint32_t LEAF_NODE_NEXT_LEAF_SIZE = sizeof(uint32_t);
+const uint32_t LEAF_NODE_NEXT_LEAF_OFFSET =
+    LEAF_NODE_NUM_CELLS_OFFSET + LEAF_NODE_NUM_CELLS_SIZE;
+const uint32_t LEAF_NODE_CONTENT_START_SIZE = sizeof(uint16_t);
+const uint32_t LEAF_NODE_CONTENT_START_OFFSET =
+    LEAF_NODE_NEXT_LEAF_OFFSET + LEAF_NODE_NEXT_LEAF_SIZE;
+const uint32_t LEAF_NODE_PADDING_SIZE = sizeof(uint16_t);
+const uint32_t LEAF_NODE_HEADER_SIZE = COMMON_NODE_HEADER_SIZE +
+                                       LEAF_NODE_NUM_CELLS_SIZE +
+                                       LEAF_NODE_NEXT_LEAF_SIZE +
+                                       LEAF_NODE_CONTENT_START_SIZE +
+                                       LEAF_NODE_PADDING_SIZE;
+
+/*
+ * Leaf Node Body Layout
+ *
+ * A slot array grows up from the header and holds keys in sorted order.
+ * Encoded rows grow down from the end of the page; each slot records
+ * where its row lives and how long it is.
+ */
+const uint32_t LEAF_NODE_KEY_SIZE = sizeof(uint32_t);
+const uint32_t LEAF_NODE_KEY_OFFSET = 0;
+const uint32_t LEAF_NODE_CELL_OFFSET_SIZE = sizeof(uint16_t);
+const uint32_t LEAF_NODE_CELL_OFFSET_OFFSET =
+    LEAF_NODE_KEY_OFFSET + LEAF_NODE_KEY_SIZE;
+const uint32_t LEAF_NODE_CELL_SIZE_SIZE = sizeof(uint16_t);
+const uint32_t LEAF_NODE_CELL_SIZE_OFFSET =
+    LEAF_NODE_CELL_OFFSET_OFFSET + LEAF_NODE_CELL_OFFSET_SIZE;
+const uint32_t LEAF_NODE_SLOT_SIZE = LEAF_NODE_KEY_SIZE +
+                                     LEAF_NODE_CELL_OFFSET_SIZE +
+                                     LEAF_NODE_CELL_SIZE_SIZE;
+const uint32_t LEAF_NODE_SPACE_FOR_CELLS = PAGE_USABLE_SIZE - LEAF_NODE_HEADER_SIZE;
+
+/*
+ * PAX Leaf Node Body Layout
+ *
+ * The same header, then one minipage per column so that a scan of one
+ * column reads a dense array: the ids (which are the keys), the end
+ * offset of each username and of each email within its byte area, then
+ * the username bytes and the email bytes, all in key order. The node is
+ * repacked whenever it changes; the content start field is unused.
+ */
+const uint32_t PAX_ID_SIZE = sizeof(uint32_t);
+const uint32_t PAX_END_SIZE = sizeof(uint16_t);
+const uint32_t PAX_CELL_OVERHEAD = PAX_ID_SIZE + 2 * PAX_END_SIZE;
+
+/*
+ * Root pages of a new file: the table's, then one per secondary index.
+ * The header records where each one is.
+ */
+const uint32_t TABLE_ROOT_PAGE_NUM = 1;
+const uint32_t INDEX_ROOT_PAGE_NUM = 2;
+const Column INDEXED_COLUMNS[NUM_INDEXES] = {COLUMN_USERNAME, COLUMN_EMAIL};
+
+_Noreturn static void fatalError(DbResult code, const char *format, ...);
+static uint32_t leafNodeRowId(void *node, uint32_t cellNum);
+static const char *leafNodeText(void *node, uint32_t cellNum, Column column,
+                                uint32_t *length);
+static void *cursorLeaf(Cursor *cursor);
+static void cursorRelease(Cursor *cursor);
+static Pager *openPager(const char *fn, const PagerOptions *options,
+                        uint32_t recordedTransaction);
+static bool releasePager(Pager *pager, bool checkpointed);
+static void *mappedPage(Pager *pager, uint32_t pageNum);
+static void remapPager(Pager *pager);
+static void writePages(Pager *pager, const uint32_t *pageNums, void **pages,
+                       uint32_t count);
+static void syncDbFile(Pager *pager);
+static uint32_t dbFileLength(Pager *pager);
+static void *getPage(Pager *pager, uint32_t pageNum);
+static void unpinPage(Pager *pager, uint32_t pageNum, bool dirty);
+static void *readPage(Pager *pager, uint32_t pageNum);
+static void releasePage(Pager *pager, uint32_t pageNum, void *page);
+static void pagerReap(Pager *pager, bool wait);
+static void prefetchPages(Pager *pager, const uint32_t *pageNums, uint32_t count);
+static void commitPager(Pager *pager);
+static void checkpointPager(Pager *pager);
+static void treeFind(Table *tree, uint64_t key, Cursor *cursor);
+static void tableFind(Table *table, uint32_t key, Cursor *cursor);
+static void treeSeek(Table *tree, uint64_t key, Cursor *cursor);
+static void tableSeek(Table *table, uint32_t key, Cursor *cursor);
+static void cursorAdvance(Cursor *cursor);
+static void printRow(ResultSink *sink, void *node, uint32_t cellNum,
+                     Projection *projection);
+static uint64_t getNodeMaxKey(Pager *pager, void *node);
+static void leafNodeInsert(Cursor *cursor, uint32_t key, Row *value);
+static void internalNodeInsert(Table *table, uint32_t parentPageNum,
+                               uint32_t childPageNum);
+static bool tableInsert(Table *table, Row *row);
+static bool parallelScan(Statement *statement, Table *table, ResultSink *sink);
+static Table *tableParts(Table *table, uint32_t *numParts);
+
+/**
+ * @brief report an error the engine cannot recover from
+ *
+ * Jumps back to the innermost ErrorScope on this thread, or prints the
+ * message and exits if there is none. Nothing is unwound on the way, so a
+ * caught error leaves the database usable only for closing.
+ */
+_Noreturn static void fatalError(DbResult code, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    if (errorScope == NULL)
+    {
+        vprintf(format, args);
+        printf("\n");
+        exit(EXIT_FAILURE);
+    }
+    vsnprintf(errorScope->message, ERROR_MESSAGE_SIZE, format, args);
+    va_end(args);
+    errorScope->code = code;
+    longjmp(errorScope->jump, 1);
+}
+
+/**
+ * @brief fold an exiting thread's counts into retiredStats
+ */
+static void statsSlotRetire(void *arg)
+{
+    StatsSlot *slot = arg;
+    pthread_mutex_lock(&statsLock);
+    for (uint32_t i = 0; i < NUM_STATS; i++)
+    {
+        retiredStats[i] += atomic_load_explicit(&slot->counts[i], memory_order_relaxed);
+    }
+    StatsSlot **link = &statsSlots;
+    while (*link != slot)
+    {
+        link = &(*link)->next;
+    }
+    *link = slot->next;
+    pthread_mutex_unlock(&statsLock);
+    free(slot);
+}
+
+static void statsKeyCreate(void)
+{
+    pthread_key_create(&statsKey, statsSlotRetire);
+}
+
+static StatsSlot *statsSlotCreate(void)
+{
+    pthread_once(&statsKeyOnce, statsKeyCreate);
+    // A whole number of lines, so no two threads' counters share one
+    size_t size = (sizeof(StatsSlot) + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE * CACHE_LINE_SIZE;
+    StatsSlot *slot = aligned_alloc(CACHE_LINE_SIZE, size);
+    for (uint32_t i = 0; i < NUM_STATS; i++)
+    {
+        atomic_init(&slot->counts[i], 0);
+    }
+    pthread_mutex_lock(&statsLock);
+    slot->next = statsSlots;
+    statsSlots = slot;
+    pthread_mutex_unlock(&statsLock);
+    pthread_setspecific(statsKey, slot);
+    threadStats = slot;
+    return slot;
+}
+
+static void countStat(Stat stat, uint64_t n)
+{
+    StatsSlot *slot = threadStats != NULL ? threadStats : statsSlotCreate();
+    uint64_t count = atomic_load_explicit(&slot->counts[stat], memory_order_relaxed);
+    atomic_store_explicit(&slot->counts[stat], count + n, memory_order_relaxed);
+}
+
+static uint64_t monotonicNanos(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/**
+ * @brief count an operation that started at start in a latency histogram
+ */
+static void countLatency(Stat histogram, uint64_t start)
+{
+    uint64_t nanos = monotonicNanos() - start;
+    uint32_t bucket = nanos > 0 ? 63 - __builtin_clzll(nanos) : 0;
+    if (bucket >= STATS_LATENCY_BUCKETS)
+    {
+        bucket = STATS_LATENCY_BUCKETS - 1;
+    }
+    countStat(histogram + bucket, 1);
+}
+
+static uint32_t crc32cTable[256];
+static pthread_once_t crc32cTableOnce = PTHREAD_ONCE_INIT;
+
+static void crc32cTableInit(void)
+{
+    for (uint32_t i = 0; i < 256; i++)
+    {
+        uint32_t crc = i;
+        for (uint32_t bit = 0; bit < 8; bit++)
+        {
+            crc = (crc >> 1) ^ (0x82f63b78u & -(crc & 1));
+        }
+        crc32cTable[i] = crc;
+    }
+}
+
+static uint32_t crc32cSoftware(uint32_t crc, const uint8_t *data, size_t len)
+{
+    pthread_once(&crc32cTableOnce, crc32cTableInit);
+    for (size_t i = 0; i < len; i++)
+    {
+        crc = crc32cTable[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+#if defined(HAVE_CRC32C_SSE42)
+__attribute__((target("sse4.2"))) static uint32_t
+crc32cSse42(uint32_t crc, const uint8_t *data, size_t len)
+{
+    uint64_t crc64 = crc;
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= len; i += sizeof(uint64_t))
+    {
+        uint64_t word;
+        memcpy(&word, data + i, sizeof(word));
+        crc64 = _mm_crc32_u64(crc64, word);
+    }
+    crc = (uint32_t)crc64;
+    for (; i < len; i++)
+    {
+        crc = _mm_crc32_u8(crc, data[i]);
+    }
+    return crc;
+}
+#endif
+
+#if defined(HAVE_CRC32C_ARM)
+static uint32_t crc32cArm(uint32_t crc, const uint8_t *data, size_t len)
+{
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= len; i += sizeof(uint64_t))
+    {
+        uint64_t word;
+        memcpy(&word, data + i, sizeof(word));
+        crc = __crc32cd(crc, word);
+    }
+    for (; i < len; i++)
+    {
+        crc = __crc32cb(crc, data[i]);
+    }
+    return crc;
+}
+#endif
+
+/**
+ * @brief CRC32C (Castagnoli), with the CPU's instruction where it has one
+ */
+static uint32_t crc32c(const void *data, size_t len)
+{
+#if defined(HAVE_CRC32C_SSE42)
+    if (__builtin_cpu_supports("sse4.2"))
+    {
+        return ~crc32cSse42(~0u, data, len);
+    }
+#elif defined(HAVE_CRC32C_ARM)
+    return ~crc32cArm(~0u, data, len);
+#endif
+    return ~crc32cSoftware(~0u, data, len);
+}
+
+static uint32_t *pageChecksum(void *page)
+{
+    return page + PAGE_CHECKSUM_OFFSET;
+}
+
+static void pageSetChecksum(void *page)
+{
+    *pageChecksum(page) = crc32c(page, PAGE_CHECKSUM_OFFSET);
+}
+
+/**
+ * @brief whether a page read from the database file is intact
+ *
+ * An all-zero page passes too: the file was extended past it and it was
+ * never written, like the page a bulk load reserves for its top node.
+ */
+static bool pageChecksumOk(void *page)
+{
+    if (*pageChecksum(page) == crc32c(page, PAGE_CHECKSUM_OFFSET))
+    {
+        return true;
+    }
+    const uint8_t *bytes = page;
+    for (uint32_t i = 0; i < PAGE_SIZE; i++)
+    {
+        if (bytes[i] != 0)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool pageChecked(Pager *pager, uint32_t pageNum)
+{
+    return pageNum < pager->numChecked &&
+           atomic_load_explicit(&pager->checked[pageNum], memory_order_acquire);
+}
+
+static void setPageChecked(Pager *pager, uint32_t pageNum)
+{
+    if (pageNum < pager->numChecked)
+    {
+        atomic_store_explicit(&pager->checked[pageNum], true, memory_order_release);
+    }
+}
+
+/**
+ * @brief check a page just read from the database file, unless it has
+ * been already
+ */
+static void checkPage(Pager *pager, uint32_t pageNum, void *page)
+{
+    if (pageChecked(pager, pageNum))
+    {
+        return;
+    }
+    if (!pageChecksumOk(page))
+    {
+        fatalError(DB_ERROR_CORRUPT, "Checksum mismatch on page %u. Corrupt file.", pageNum);
+    }
+    setPageChecked(pager, pageNum);
+}
+
+static uint32_t *headerField(void *header, uint32_t offset)
+{
+    return header + offset;
+}
+
+/**
+ * @brief root page of the table (0) or of index i (i + 1)
+ */
+static uint32_t *headerRoot(void *header, uint32_t tree)
+{
+    return header + HEADER_ROOTS_OFFSET + tree * sizeof(uint32_t);
+}
+
+static uint32_t *freePageNext(void *page)
+{
+    return page + FREE_PAGE_NEXT_OFFSET;
+}
+
+static NodeType getNodeType(void *node)
+{
+    uint8_t value = *((uint8_t *)(node + NODE_TYPE_OFFSET));
+    return (NodeType)value;
+}
+
+static void setNodeType(void *node, NodeType type)
+{
+    uint8_t value = type;
+    *((uint8_t *)(node + NODE_TYPE_OFFSET)) = value;
+}
+
+static bool isLeafNode(void *node)
+{
+    return getNodeType(node) != NODE_INTERNAL;
+}
+
+static bool isPaxLeaf(void *node)
+{
+    return getNodeType(node) == NODE_PAX_LEAF;
+}
+
+static bool isNodeRoot(void *node)
+{
+    uint8_t value = *((uint8_t *)(node + IS_ROOT_OFFSET));
+    return (bool)value;
+}
+
+static void setNodeRoot(void *node, bool isRoot)
+{
+    uint8_t value = isRoot;
+    *((uint8_t *)(node + IS_ROOT_OFFSET)) = value;
+}
+
+static uint32_t *nodeParent(void *node)
+{
+    return node + PARENT_POINTER_OFFSET;
+}
+
+static uint32_t *internalNodeNumKeys(void *node)
+{
+    return node + INTERNAL_NODE_NUM_KEYS_OFFSET;
+}
+
+static uint32_t *internalNodeRightChild(void *node)
+{
+    return node + INTERNAL_NODE_RIGHT_CHILD_OFFSET;
+}
+
+static uint32_t *internalNodeCell(void *node, uint32_t cellNum)
+{
+    return node + INTERNAL_NODE_HEADER_SIZE + cellNum * INTERNAL_NODE_CELL_SIZE;
+}
+
+static uint32_t *internalNodeChild(void *node, uint32_t childNum)
+{
+    uint32_t numKeys = *internalNodeNumKeys(node);
+    if (childNum > numKeys)
+    {
+        fatalError(DB_ERROR_CORRUPT, "Tried to access childNum %u > numKeys %u", childNum, numKeys);
+    }
+    else if (childNum == numKeys)
+    {
+        return internalNodeRightChild(node);
+    }
+    else
+    {
+        return internalNodeCell(node, childNum);
+    }
+}
+
+static uint32_t *internalNodeKey(void *node, uint32_t keyNum)
+{
+    return (void *)internalNodeCell(node, keyNum) + INTERNAL_NODE_CHILD_SIZE;
+}
+
+static uint32_t *internalNodeKeyId(void *node, uint32_t keyNum)
+{
+    return internalNodeKey(node, keyNum) + 1;
+}
+
+/**
+ * @brief the order of cells in a tree: by key, then by the id of the row
+ * in the cell
+ *
+ * A table's keys are its ids and never tie. Index entries share the key
+ * of every row with the same hash, and the id keeps each one distinct.
+ */
+static uint64_t treeKey(uint32_t key, uint32_t id)
+{
+    return (uint64_t)key << 32 | id;
+}
+
+static uint64_t internalNodeTreeKey(void *node, uint32_t keyNum)
+{
+    return treeKey(*internalNodeKey(node, keyNum), *internalNodeKeyId(node, keyNum));
+}
+
+static void setInternalNodeKey(void *node, uint32_t keyNum, uint64_t key)
+{
+    *internalNodeKey(node, keyNum) = key >> 32;
+    *internalNodeKeyId(node, keyNum) = (uint32_t)key;
+}
+
+static uint32_t *leafNodeNumCells(void *node)
+{
+    return node + LEAF_NODE_NUM_CELLS_OFFSET;
+}
+
+static uint32_t *leafNodeNextLeaf(void *node)
+{
+    return node + LEAF_NODE_NEXT_LEAF_OFFSET;
+}
+
+static uint16_t *leafNodeContentStart(void *node)
+{
+    return node + LEAF_NODE_CONTENT_START_OFFSET;
+}
+
+static void *leafNodeSlot(void *node, uint32_t cellNum)
+{
+    return node + LEAF_NODE_HEADER_SIZE + cellNum * LEAF_NODE_SLOT_SIZE;
+}
+
+static uint32_t *paxLeafIds(void *node)
+{
+    return node + LEAF_NODE_HEADER_SIZE;
+}
+
+/**
+ * @brief end offset of each value of a text column in a PAX leaf
+ */
+static uint16_t *paxLeafEnds(void *node, Column column)
+{
+    uint32_t numCells = *leafNodeNumCells(node);
+    uint16_t *usernameEnds = node + LEAF_NODE_HEADER_SIZE + numCells * PAX_ID_SIZE;
+    return column == COLUMN_USERNAME ? usernameEnds : usernameEnds + numCells;
+}
+
+static const char *paxLeafText(void *node, uint32_t cellNum, Column column,
+                               uint32_t *length)
+{
+    uint32_t numCells = *leafNodeNumCells(node);
+    uint16_t *usernameEnds = paxLeafEnds(node, COLUMN_USERNAME);
+    const char *values = (const char *)(usernameEnds + 2 * numCells);
+    uint16_t *ends = usernameEnds;
+    if (column == COLUMN_EMAIL)
+    {
+        values += usernameEnds[numCells - 1];
+        ends += numCells;
+    }
+    uint32_t start = cellNum == 0 ? 0 : ends[cellNum - 1];
+    *length = ends[cellNum] - start;
+    return values + start;
+}
+
+static uint32_t *leafNodeKey(void *node, uint32_t cellNum)
+{
+    if (isPaxLeaf(node))
+    {
+        return paxLeafIds(node) + cellNum;
+    }
+    return leafNodeSlot(node, cellNum) + LEAF_NODE_KEY_OFFSET;
+}
+
+static uint16_t *leafNodeCellOffset(void *node, uint32_t cellNum)
+{
+    return leafNodeSlot(node, cellNum) + LEAF_NODE_CELL_OFFSET_OFFSET;
+}
+
+static uint16_t *leafNodeCellSize(void *node, uint32_t cellNum)
+{
+    return leafNodeSlot(node, cellNum) + LEAF_NODE_CELL_SIZE_OFFSET;
+}
+
+static void *leafNodeValue(void *node, uint32_t cellNum)
+{
+    return node + *leafNodeCellOffset(node, cellNum);
+}
+
+/**
+ * @brief bytes left between the slot array and the cell content area
+ */
+static uint32_t leafNodeFreeSpace(void *node)
+{
+    uint32_t numCells = *leafNodeNumCells(node);
+    if (isPaxLeaf(node))
+    {
+        uint32_t used = LEAF_NODE_HEADER_SIZE + numCells * PAX_CELL_OVERHEAD;
+        if (numCells > 0)
+        {
+            used += paxLeafEnds(node, COLUMN_USERNAME)[numCells - 1] +
+                    paxLeafEnds(node, COLUMN_EMAIL)[numCells - 1];
+        }
+        return PAGE_USABLE_SIZE - used;
+    }
+    uint32_t slotsEnd = LEAF_NODE_HEADER_SIZE + numCells * LEAF_NODE_SLOT_SIZE;
+    return *leafNodeContentStart(node) - slotsEnd;
+}
+
+/**
+ * @brief bytes free once the leaf is repacked: leafNodeFreeSpace() plus
+ * the holes deletes left in the cell content area
+ */
+static uint32_t leafNodeReusableSpace(void *node)
+{
+    if (isPaxLeaf(node))
+    {
+        // Repacked on every change, so there are no holes
+        return leafNodeFreeSpace(node);
+    }
+    uint32_t numCells = *leafNodeNumCells(node);
+    uint32_t used = numCells * LEAF_NODE_SLOT_SIZE;
+    for (uint32_t i = 0; i < numCells; i++)
+    {
+        used += *leafNodeCellSize(node, i);
+    }
+    return LEAF_NODE_SPACE_FOR_CELLS - used;
+}
+
+/**
+ * @brief space cell cellNum takes in node, counting its slot or ends
+ */
+static uint32_t leafNodeCellBytes(void *node, uint32_t cellNum)
+{
+    if (isPaxLeaf(node))
+    {
+        uint32_t usernameLength, emailLength;
+        paxLeafText(node, cellNum, COLUMN_USERNAME, &usernameLength);
+        paxLeafText(node, cellNum, COLUMN_EMAIL, &emailLength);
+        return PAX_CELL_OVERHEAD + usernameLength + emailLength;
+    }
+    return *leafNodeCellSize(node, cellNum) + LEAF_NODE_SLOT_SIZE;
+}
+
+/**
+ * @brief space row would take in node, counting its slot or ends
+ */
+static uint32_t leafNodeRowBytes(void *node, Row *row)
+{
+    uint32_t size = tableRowSize(row);
+    if (isPaxLeaf(node))
+    {
+        return size - ROW_MIN_SIZE + PAX_CELL_OVERHEAD;
+    }
+    return size + LEAF_NODE_SLOT_SIZE;
+}
+
+/**
+ * @brief reserve content space for a cell and fill in slot cellNum
+ *
+ * The caller must have checked leafNodeFreeSpace() and opened slot
+ * cellNum. Returns where the encoded row should be written.
+ */
+static void *leafNodeAllocateCell(void *node, uint32_t cellNum, uint32_t key,
+                                  uint32_t size)
+{
+    *leafNodeContentStart(node) -= size;
+    *leafNodeKey(node, cellNum) = key;
+    *leafNodeCellOffset(node, cellNum) = *leafNodeContentStart(node);
+    *leafNodeCellSize(node, cellNum) = size;
+    return node + *leafNodeContentStart(node);
+}
+
+static void initializeLeafNode(void *node)
+{
+    setNodeType(node, NODE_LEAF);
+    setNodeRoot(node, false);
+    *leafNodeNumCells(node) = 0;
+    *leafNodeNextLeaf(node) = 0; // 0 represents no sibling
+    *leafNodeContentStart(node) = PAGE_USABLE_SIZE;
+}
+
+/**
+ * @brief repack a PAX leaf to hold exactly cells
+ *
+ * The header apart from the cell count is left alone. No cell may point
+ * into node itself.
+ */
+static void paxLeafFill(void *node, PaxCell *cells, uint32_t count)
+{
+    *leafNodeNumCells(node) = count;
+    uint32_t *ids = paxLeafIds(node);
+    uint16_t *usernameEnds = paxLeafEnds(node, COLUMN_USERNAME);
+    uint16_t *emailEnds = paxLeafEnds(node, COLUMN_EMAIL);
+    char *usernames = (char *)(emailEnds + count);
+    uint32_t usernameBytes = 0;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        ids[i] = cells[i].key;
+        memcpy(usernames + usernameBytes, cells[i].username, cells[i].usernameLength);
+        usernameBytes += cells[i].usernameLength;
+        usernameEnds[i] = usernameBytes;
+    }
+    char *emails = usernames + usernameBytes;
+    uint32_t emailBytes = 0;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        memcpy(emails + emailBytes, cells[i].email, cells[i].emailLength);
+        emailBytes += cells[i].emailLength;
+        emailEnds[i] = emailBytes;
+    }
+}
+
+/**
+ * @brief describe cell cellNum of a leaf of either layout
+ */
+static void paxCellFromLeaf(PaxCell *cell, void *node, uint32_t cellNum)
+{
+    uint32_t length;
+    cell->key = *leafNodeKey(node, cellNum);
+    cell->username = leafNodeText(node, cellNum, COLUMN_USERNAME, &length);
+    cell->usernameLength = length;
+    cell->email = leafNodeText(node, cellNum, COLUMN_EMAIL, &length);
+    cell->emailLength = length;
+}
+
+/**
+ * @brief describe the cells of node, with value inserted at cellNum
+ *
+ * Fills *leafNodeNumCells(node) + 1 entries.
+ */
+static void paxGatherCells(void *node, uint32_t cellNum, uint32_t key, Row *value,
+                           PaxCell *cells)
+{
+    uint32_t numCells = *leafNodeNumCells(node);
+    for (uint32_t i = 0; i < numCells; i++)
+    {
+        paxCellFromLeaf(&cells[i < cellNum ? i : i + 1], node, i);
+    }
+    PaxCell *cell = &cells[cellNum];
+    cell->key = key;
+    cell->username = value->username;
+    cell->usernameLength = strlen(value->username);
+    cell->email = value->email;
+    cell->emailLength = strlen(value->email);
+}
+
+/**
+ * @brief write leaf, a row layout leaf, to dest in the PAX layout
+ */
+static void paxLeafConvert(void *dest, void *leaf)
+{
+    PaxCell cells[PAX_MAX_CELLS];
+    uint32_t numCells = *leafNodeNumCells(leaf);
+    for (uint32_t i = 0; i < numCells; i++)
+    {
+        paxCellFromLeaf(&cells[i], leaf, i);
+    }
+    memset(dest, 0, PAGE_SIZE);
+    memcpy(dest, leaf, LEAF_NODE_HEADER_SIZE);
+    setNodeType(dest, NODE_PAX_LEAF);
+    paxLeafFill(dest, cells, numCells);
+}
+
+/**
+ * @brief repack node with no holes, followed by the cells of right
+ *
+ * right may be NULL. Both leaves must have the same layout, and the cells
+ * of both must fit in one node. scratch is a page of working space.
+ */
+static void leafNodeRepack(void *node, void *right, void *scratch)
+{
+    memcpy(scratch, node, PAGE_SIZE);
+    uint32_t numCells = *leafNodeNumCells(scratch);
+    uint32_t numRight = right == NULL ? 0 : *leafNodeNumCells(right);
+    if (isPaxLeaf(node))
+    {
+        PaxCell cells[PAX_MAX_CELLS];
+        for (uint32_t i = 0; i < numCells; i++)
+        {
+            paxCellFromLeaf(&cells[i], scratch, i);
+        }
+        for (uint32_t i = 0; i < numRight; i++)
+        {
+            paxCellFromLeaf(&cells[numCells + i], right, i);
+        }
+        paxLeafFill(node, cells, numCells + numRight);
+        return;
+    }
+
+    *leafNodeNumCells(node) = 0;
+    *leafNodeContentStart(node) = PAGE_USABLE_SIZE;
+    for (uint32_t i = 0; i < numCells + numRight; i++)
+    {
+        void *source = i < numCells ? scratch : right;
+        uint32_t sourceCell = i < numCells ? i : i - numCells;
+        uint32_t size = *leafNodeCellSize(source, sourceCell);
+        void *cell = leafNodeAllocateCell(node, i, *leafNodeKey(source, sourceCell), size);
+        memcpy(cell, leafNodeValue(source, sourceCell), size);
+        *leafNodeNumCells(node) += 1;
+    }
+}
+
+/**
+ * @brief remove cell cellNum from a leaf
+ *
+ * A row leaf only loses the slot; the row's bytes become a hole that
+ * leafNodeRepack() reclaims, unless they sit at the start of the content
+ * area. scratch is a page of working space.
+ */
+static void leafNodeRemoveCell(void *node, uint32_t cellNum, void *scratch)
+{
+    uint32_t numCells = *leafNodeNumCells(node);
+    if (isPaxLeaf(node))
+    {
+        PaxCell cells[PAX_MAX_CELLS];
+        memcpy(scratch, node, PAGE_SIZE);
+        for (uint32_t i = 0; i + 1 < numCells; i++)
+        {
+            paxCellFromLeaf(&cells[i], scratch, i < cellNum ? i : i + 1);
+        }
+        paxLeafFill(node, cells, numCells - 1);
+        return;
+    }
+
+    if (*leafNodeCellOffset(node, cellNum) == *leafNodeContentStart(node))
+    {
+        *leafNodeContentStart(node) += *leafNodeCellSize(node, cellNum);
+    }
+    memmove(leafNodeSlot(node, cellNum), leafNodeSlot(node, cellNum + 1),
+            (numCells - cellNum - 1) * LEAF_NODE_SLOT_SIZE);
+    *leafNodeNumCells(node) -= 1;
+    if (numCells == 1)
+    {
+        *leafNodeContentStart(node) = PAGE_USABLE_SIZE;
+    }
+}
+
+/**
+ * @brief copy the row in cell cellNum of a leaf of either layout
+ *
+ * For an index entry, the column the index is not on comes back empty.
+ */
+static void leafNodeReadRow(void *node, uint32_t cellNum, Row *row)
+{
+    if (!isPaxLeaf(node))
+    {
+        tableRowDeserialize(leafNodeValue(node, cellNum), row);
+        return;
+    }
+    uint32_t length;
+    row->id = leafNodeRowId(node, cellNum);
+    const char *username = leafNodeText(node, cellNum, COLUMN_USERNAME, &length);
+    memcpy(row->username, username, length);
+    row->username[length] = '\0';
+    const char *email = leafNodeText(node, cellNum, COLUMN_EMAIL, &length);
+    memcpy(row->email, email, length);
+    row->email[length] = '\0';
+}
+
+static void initializeInternalNode(void *node)
+{
+    setNodeType(node, NODE_INTERNAL);
+    setNodeRoot(node, false);
+    *internalNodeNumKeys(node) = 0;
+    *internalNodeRightChild(node) = INVALID_PAGE_NUM;
+}
+
+static uint64_t leafNodeTreeKey(void *node, uint32_t cellNum)
+{
+    return treeKey(*leafNodeKey(node, cellNum), leafNodeRowId(node, cellNum));
+}
+
+/**
+ * @brief largest key stored in the subtree rooted at node
+ */
+static uint64_t getNodeMaxKey(Pager *pager, void *node)
+{
+    if (isLeafNode(node))
+    {
+        return leafNodeTreeKey(node, *leafNodeNumCells(node) - 1);
+    }
+
+    uint32_t rightChildPageNum = *internalNodeRightChild(node);
+    void *rightChild = readPage(pager, rightChildPageNum);
+    uint64_t maxKey = getNodeMaxKey(pager, rightChild);
+    releasePage(pager, rightChildPageNum, rightChild);
+    return maxKey;
+}
+
+/**
+ * @brief a page for a new node: the head of the free list, zeroed, or else
+ * the page past the end of the file
+ */
+static uint32_t getUnusedPageNum(Pager *pager)
+{
+    void *header = getPage(pager, HEADER_PAGE_NUM);
+    uint32_t pageNum = *headerField(header, HEADER_FREE_LIST_OFFSET);
+    if (pageNum == 0)
+    {
+        unpinPage(pager, HEADER_PAGE_NUM, false);
+        return pager->numPages;
+    }
+    void *page = getPage(pager, pageNum);
+    *headerField(header, HEADER_FREE_LIST_OFFSET) = *freePageNext(page);
+    memset(page, 0, PAGE_SIZE);
+    unpinPage(pager, pageNum, true);
+    unpinPage(pager, HEADER_PAGE_NUM, true);
+    return pageNum;
+}
+
+/**
+ * @brief put a page no node uses any more at the head of the free list
+ */
+static void freePage(Pager *pager, uint32_t pageNum)
+{
+    void *header = getPage(pager, HEADER_PAGE_NUM);
+    void *page = getPage(pager, pageNum);
+    memset(page, 0, PAGE_SIZE);
+    *freePageNext(page) = *headerField(header, HEADER_FREE_LIST_OFFSET);
+    *headerField(header, HEADER_FREE_LIST_OFFSET) = pageNum;
+    unpinPage(pager, pageNum, true);
+    unpinPage(pager, HEADER_PAGE_NUM, true);
+}
+
+/**
+ * @brief index of the child which should contain the given key
+ */
+static uint32_t internalNodeFindChild(void *node, uint64_t key)
+{
+    uint32_t numKeys = *internalNodeNumKeys(node);
+
+    // Binary search
+    uint32_t minIndex = 0;
+    uint32_t maxIndex = numKeys; // there is one more child than key
+    while (minIndex != maxIndex)
+    {
+        uint32_t index = (minIndex + maxIndex) / 2;
+        uint64_t keyToRight = internalNodeTreeKey(node, index);
+        if (keyToRight >= key)
+        {
+            maxIndex = index;
+        }
+        else
+        {
+            minIndex = index + 1;
+        }
+    }
+    return minIndex;
+}
+
+static void updateInternalNodeKey(void *node, uint64_t oldKey, uint64_t newKey)
+{
+    uint32_t oldChildIndex = internalNodeFindChild(node, oldKey);
+    // The right child has no key of its own
+    if (oldChildIndex < *internalNodeNumKeys(node))
+    {
+        setInternalNodeKey(node, oldChildIndex, newKey);
+    }
+}
+
+static void leafNodeFind(Table *table, uint32_t pageNum, uint64_t key, Cursor *cursor)
+{
+    void *node = readPage(table->pager, pageNum);
+    uint32_t numCells = *leafNodeNumCells(node);
+
+    cursor->table = table;
+    cursor->pageNum = pageNum;
+    cursor->EOT = false;
+    cursor->page = NULL;
+    cursor->leavesCrossed = 0;
+    cursor->readAheadMark = INVALID_PAGE_NUM;
+
+    // Binary search
+    uint32_t minIndex = 0;
+    uint32_t onePastMaxIndex = numCells;
+    while (onePastMaxIndex != minIndex)
+    {
+        uint32_t index = (minIndex + onePastMaxIndex) / 2;
+        uint64_t keyAtIndex = leafNodeTreeKey(node, index);
+        if (key == keyAtIndex)
+        {
+            minIndex = index;
+            break;
+        }
+        if (key < keyAtIndex)
+        {
+            onePastMaxIndex = index;
+        }
+        else
+        {
+            minIndex = index + 1;
+        }
+    }
+    cursor->cellNum = minIndex;
+
+    releasePage(table->pager, pageNum, node);
+}
+
+/**
+ * @brief position cursor at the given treeKey()
+ *
+ * If the key is not present, this is the position where it should be
+ * inserted. Cursors live with the caller, usually on its stack.
+ */
+static void treeFind(Table *tree, uint64_t key, Cursor *cursor)
+{
+    Pager *pager = tree->pager;
+    uint32_t pageNum = tree->rootPageNum;
+    void *node = readPage(pager, pageNum);
+
+    while (getNodeType(node) == NODE_INTERNAL)
+    {
+        uint32_t childIndex = internalNodeFindChild(node, key);
+        uint32_t childPageNum = *internalNodeChild(node, childIndex);
+        releasePage(pager, pageNum, node);
+        pageNum = childPageNum;
+        node = readPage(pager, pageNum);
+    }
+    releasePage(pager, pageNum, node);
+
+    leafNodeFind(tree, pageNum, key, cursor);
+}
+
+/**
+ * @brief position cursor at the row with id key, or where it would go
+ */
+static void tableFind(Table *table, uint32_t key, Cursor *cursor)
+{
+    treeFind(table, treeKey(key, 0), cursor);
+}
+
+/**
+ * @brief turn the root into an internal node with two children
+ *
+ * The root page number never changes, so the caller provides the two
+ * children that will hang off it.
+ */
+static void initializeRootNode(Pager *pager, void *root, uint32_t rootPageNum,
+                               uint32_t leftChildPageNum, uint32_t rightChildPageNum)
+{
+    void *leftChild = getPage(pager, leftChildPageNum);
+    void *rightChild = getPage(pager, rightChildPageNum);
+
+    initializeInternalNode(root);
+    setNodeRoot(root, true);
+    *internalNodeNumKeys(root) = 1;
+    *internalNodeCell(root, 0) = leftChildPageNum;
+    setInternalNodeKey(root, 0, getNodeMaxKey(pager, leftChild));
+    *internalNodeRightChild(root) = rightChildPageNum;
+    *nodeParent(leftChild) = rootPageNum;
+    *nodeParent(rightChild) = rootPageNum;
+
+    unpinPage(pager, leftChildPageNum, true);
+    unpinPage(pager, rightChildPageNum, true);
+}
+
+/*
+Handle splitting the root leaf.
+Old root copied to new page, becomes left child.
+Address of right child passed in.
+Re-initialize root page to contain the new root node.
+New root node points to two children.
+*/
+static void createNewRoot(Table *table, uint32_t rightChildPageNum)
+{
+    Pager *pager = table->pager;
+    void *root = getPage(pager, table->rootPageNum);
+    uint32_t leftChildPageNum = getUnusedPageNum(pager);
+    void *leftChild = getPage(pager, leftChildPageNum);
+
+    // Left child has data copied from old root
+    memcpy(leftChild, root, PAGE_SIZE);
+    setNodeRoot(leftChild, false);
+    unpinPage(pager, leftChildPageNum, true);
+
+    initializeRootNode(pager, root, table->rootPageNum, leftChildPageNum,
+                       rightChildPageNum);
+    unpinPage(pager, table->rootPageNum, true);
+}
+
+/*
+Create a new node and move half the bytes over.
+Insert the new value in one of the two nodes.
+Update parent or create a new parent.
+*/
+static void leafNodeSplitAndInsert(Cursor *cursor, uint32_t key, Row *value)
+{
+    Pager *pager = cursor->table->pager;
+    uint32_t oldPageNum = cursor->pageNum;
+    void *oldNode = getPage(pager, oldPageNum);
+    uint64_t oldMax = getNodeMaxKey(pager, oldNode);
+    uint32_t newPageNum = getUnusedPageNum(pager);
+    void *newNode = getPage(pager, newPageNum);
+    initializeLeafNode(newNode);
+    *nodeParent(newNode) = *nodeParent(oldNode);
+    *leafNodeNextLeaf(newNode) = *leafNodeNextLeaf(oldNode);
+
+    // Both halves are repacked, so work from a copy of the old node
+    uint8_t *copy = pager->scratch;
+    memcpy(copy, oldNode, PAGE_SIZE);
+    uint32_t numCells = *leafNodeNumCells(copy);
+    uint32_t newSize = tableRowSize(value);
+
+    /*
+    All existing cells plus the new one should be divided between old
+    (left) and new (right) nodes so each gets about half the bytes.
+    Rows vary in size, so the split point is found by walking the cells.
+    */
+    uint32_t newBytes = leafNodeRowBytes(copy, value);
+    uint32_t totalBytes = newBytes;
+    for (uint32_t i = 0; i < numCells; i++)
+    {
+        totalBytes += leafNodeCellBytes(copy, i);
+    }
+    uint32_t leftCount = 0;
+    uint32_t leftBytes = 0;
+    while (leftCount < numCells && leftBytes < totalBytes / 2)
+    {
+        uint32_t bytes = newBytes;
+        if (leftCount != cursor->cellNum)
+        {
+            uint32_t source = leftCount < cursor->cellNum ? leftCount : leftCount - 1;
+            bytes = leafNodeCellBytes(copy, source);
+        }
+        leftBytes += bytes;
+        leftCount++;
+    }
+
+    bool isRoot = isNodeRoot(copy);
+    initializeLeafNode(oldNode);
+    setNodeRoot(oldNode, isRoot);
+    *nodeParent(oldNode) = *nodeParent(copy);
+    *leafNodeNextLeaf(oldNode) = newPageNum;
+
+    if (isPaxLeaf(copy))
+    {
+        // Both halves keep the layout
+        PaxCell cells[PAX_MAX_CELLS];
+        paxGatherCells(copy, cursor->cellNum, key, value, cells);
+        setNodeType(oldNode, NODE_PAX_LEAF);
+        setNodeType(newNode, NODE_PAX_LEAF);
+        paxLeafFill(oldNode, cells, leftCount);
+        paxLeafFill(newNode, cells + leftCount, numCells + 1 - leftCount);
+    }
+    else
+    {
+        for (uint32_t i = 0; i <= numCells; i++)
+        {
+            void *destinationNode = i < leftCount ? oldNode : newNode;
+            uint32_t indexWithinNode = *leafNodeNumCells(destinationNode);
+
+            if (i == cursor->cellNum)
+            {
+                void *cell = leafNodeAllocateCell(destinationNode, indexWithinNode,
+                                                  key, newSize);
+                tableRowSerialize(value, cell);
+            }
+            else
+            {
+                uint32_t source = i < cursor->cellNum ? i : i - 1;
+                uint32_t size = *leafNodeCellSize(copy, source);
+                void *cell = leafNodeAllocateCell(destinationNode, indexWithinNode,
+                                                  *leafNodeKey(copy, source), size);
+                memcpy(cell, leafNodeValue(copy, source), size);
+            }
+            *leafNodeNumCells(destinationNode) += 1;
+        }
+    }
+
+    if (isRoot)
+    {
+        unpinPage(pager, oldPageNum, true);
+        unpinPage(pager, newPageNum, true);
+        createNewRoot(cursor->table, newPageNum);
+        return;
+    }
+
+    uint32_t parentPageNum = *nodeParent(oldNode);
+    uint64_t newMax = getNodeMaxKey(pager, oldNode);
+    unpinPage(pager, oldPageNum, true);
+    unpinPage(pager, newPageNum, true);
+
+    void *parent = getPage(pager, parentPageNum);
+    updateInternalNodeKey(parent, oldMax, newMax);
+    unpinPage(pager, parentPageNum, true);
+    internalNodeInsert(cursor->table, parentPageNum, newPageNum);
+}
+
+static void leafNodeInsert(Cursor *cursor, uint32_t key, Row *value)
+{
+    Pager *pager = cursor->table->pager;
+    void *node = getPage(pager, cursor->pageNum);
+
+    uint32_t numCells = *leafNodeNumCells(node);
+    uint32_t bytes = leafNodeRowBytes(node, value);
+    if (leafNodeFreeSpace(node) < bytes)
+    {
+        if (leafNodeReusableSpace(node) < bytes)
+        {
+            // Node full
+            unpinPage(pager, cursor->pageNum, false);
+            leafNodeSplitAndInsert(cursor, key, value);
+            return;
+        }
+        // Deleted rows left enough room; close up their holes first
+        leafNodeRepack(node, NULL, pager->scratch);
+    }
+
+    if (isPaxLeaf(node))
+    {
+        // Every minipage after the ids shifts, so repack from a copy
+        PaxCell cells[PAX_MAX_CELLS];
+        memcpy(pager->scratch, node, PAGE_SIZE);
+        paxGatherCells(pager->scratch, cursor->cellNum, key, value, cells);
+        paxLeafFill(node, cells, numCells + 1);
+        unpinPage(pager, cursor->pageNum, true);
+        return;
+    }
+
+    uint32_t size = tableRowSize(value);
+    if (cursor->cellNum < numCells)
+    {
+        // Make room for new slot; cell contents stay where they are
+        memmove(leafNodeSlot(node, cursor->cellNum + 1),
+                leafNodeSlot(node, cursor->cellNum),
+                (numCells - cursor->cellNum) * LEAF_NODE_SLOT_SIZE);
+    }
+
+    void *cell = leafNodeAllocateCell(node, cursor->cellNum, key, size);
+    tableRowSerialize(value, cell);
+    *(leafNodeNumCells(node)) += 1;
+    unpinPage(pager, cursor->pageNum, true);
+}
+
+/**
+ * @brief key of the cell under the cursor, which must not be at EOT
+ */
+static uint32_t cursorKey(Cursor *cursor)
+{
+    Pager *pager = cursor->table->pager;
+    void *node = readPage(pager, cursor->pageNum);
+    uint32_t key = *leafNodeKey(node, cursor->cellNum);
+    releasePage(pager, cursor->pageNum, node);
+    return key;
+}
+
+/**
+ * @brief FNV-1a, the key of a value's index entries
+ */
+static uint32_t indexHash(const char *value, uint32_t length)
+{
+    uint32_t hash = 2166136261u;
+    for (uint32_t i = 0; i < length; i++)
+    {
+        hash = (hash ^ (uint8_t)value[i]) * 16777619u;
+    }
+    return hash;
+}
+
+/**
+ * @brief the index entry for row: its id and the indexed column
+ */
+static void indexEntryRow(Index *index, Row *row, Row *entry)
+{
+    entry->id = row->id;
+    entry->username[0] = '\0';
+    entry->email[0] = '\0';
+    if (index->column == COLUMN_USERNAME)
+    {
+        strcpy(entry->username, row->username);
+    }
+    else
+    {
+        strcpy(entry->email, row->email);
+    }
+}
+
+/**
+ * @brief add row's entry under its value's hash, among the entries with
+ * that hash in id order
+ */
+static void indexInsert(Index *index, Row *row)
+{
+    Row entry;
+    indexEntryRow(index, row, &entry);
+    const char *value = index->column == COLUMN_USERNAME ? entry.username : entry.email;
+
+    uint32_t key = indexHash(value, strlen(value));
+    Cursor cursor;
+    treeFind(&(index->tree), treeKey(key, row->id), &cursor);
+    leafNodeInsert(&cursor, key, &entry);
+}
+
+static void indexProbeBegin(IndexProbe *probe, Index *index, const char *value,
+                            uint32_t length)
+{
+    probe->index = index;
+    probe->value = value;
+    probe->length = length;
+    probe->key = indexHash(value, length);
+    treeSeek(&(index->tree), treeKey(probe->key, 0), &(probe->cursor));
+}
+
+/**
+ * @brief move to the next entry matching the probe's value
+ * @return false once the entries with the value's hash end
+ */
+static bool indexProbeNext(IndexProbe *probe, uint32_t *id)
+{
+    Cursor *cursor = &(probe->cursor);
+    Pager *pager = cursor->table->pager;
+    while (!cursor->EOT)
+    {
+        void *node = readPage(pager, cursor->pageNum);
+        bool sameHash = *leafNodeKey(node, cursor->cellNum) == probe->key;
+        bool match = false;
+        if (sameHash)
+        {
+            uint32_t length;
+            const char *value = leafNodeText(node, cursor->cellNum,
+                                             probe->index->column, &length);
+            match = length == probe->length && memcmp(value, probe->value, length) == 0;
+            *id = leafNodeRowId(node, cursor->cellNum);
+        }
+        releasePage(pager, cursor->pageNum, node);
+        if (!sameHash)
+        {
+            cursor->EOT = true;
+            break;
+        }
+        cursorAdvance(cursor);
+        if (match)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief index on column, or NULL if it has none
+ */
+static Index *tableIndex(Table *table, Column column)
+{
+    for (uint32_t i = 0; i < table->numIndexes; i++)
+    {
+        if (table->indexes[i].column == column)
+        {
+            return &table->indexes[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief fetch the leaf holding the row an index entry points at
+ *
+ * The row is cell cursor->cellNum; it stays valid until cursorRelease().
+ */
+static void *indexedRow(Table *table, uint32_t id, Cursor *cursor)
+{
+    tableFind(table, id, cursor);
+    void *node = readPage(table->pager, cursor->pageNum);
+    bool found = cursor->cellNum < *leafNodeNumCells(node) &&
+                 *leafNodeKey(node, cursor->cellNum) == id;
+    releasePage(table->pager, cursor->pageNum, node);
+    if (!found)
+    {
+        fatalError(DB_ERROR_CORRUPT, "Index entry for missing row %u.", id);
+    }
+    return cursorLeaf(cursor);
+}
+
+/**
+ * @brief change the row count in the file header; left uncommitted
+ */
+static void headerAddRows(Pager *pager, int32_t delta)
+{
+    void *header = getPage(pager, HEADER_PAGE_NUM);
+    *headerField(header, HEADER_ROW_COUNT_OFFSET) += delta;
+    unpinPage(pager, HEADER_PAGE_NUM, true);
+}
+
+/**
+ * @brief insert a row unless its key is already present, and index it
+ *
+ * The change is left uncommitted.
+ */
+static bool tableInsert(Table *table, Row *row)
+{
+    uint32_t keyToInsert = row->id;
+    Cursor cursor;
+    tableFind(table, keyToInsert, &cursor);
+
+    void *node = readPage(table->pager, cursor.pageNum);
+    uint32_t numCells = *leafNodeNumCells(node);
+    bool duplicate = cursor.cellNum < numCells &&
+                     *leafNodeKey(node, cursor.cellNum) == keyToInsert;
+    releasePage(table->pager, cursor.pageNum, node);
+
+    if (duplicate)
+    {
+        return false;
+    }
+    leafNodeInsert(&cursor, keyToInsert, row);
+    for (uint32_t i = 0; i < table->numIndexes; i++)
+    {
+        indexInsert(&table->indexes[i], row);
+    }
+    headerAddRows(table->pager, 1);
+    return true;
+}
+
+/**
+ * @brief rebuild an internal node from an ordered run of children
+ *
+ * The last child becomes the right child. Children are re-parented only
+ * when the node is not the page they already point at.
+ */
+static void internalNodeFill(Pager *pager, void *node, uint32_t pageNum,
+                             uint32_t *children, uint64_t *keys, uint32_t count,
+                             uint32_t previousParent)
+{
+    uint32_t parent = *nodeParent(node);
+    initializeInternalNode(node);
+    *nodeParent(node) = parent;
+
+    *internalNodeNumKeys(node) = count - 1;
+    for (uint32_t i = 0; i < count - 1; i++)
+    {
+        *internalNodeCell(node, i) = children[i];
+        setInternalNodeKey(node, i, keys[i]);
+    }
+    *internalNodeRightChild(node) = children[count - 1];
+
+    if (pageNum == previousParent)
+    {
+        return;
+    }
+    for (uint32_t i = 0; i < count; i++)
+    {
+        void *child = getPage(pager, children[i]);
+        *nodeParent(child) = pageNum;
+        unpinPage(pager, children[i], true);
+    }
+}
+
+/*
+Split a full internal node while adding one more child to it.
+The old node keeps the lower half of the children and a new node takes the
+upper half. Splitting the root instead moves both halves into new pages so
+the root page number stays fixed.
+*/
+static void internalNodeSplitAndInsert(Table *table, uint32_t parentPageNum,
+                                       uint32_t childPageNum)
+{
+    Pager *pager = table->pager;
+    void *oldNode = getPage(pager, parentPageNum);
+    uint64_t oldMax = getNodeMaxKey(pager, oldNode);
+
+    void *child = readPage(pager, childPageNum);
+    uint64_t childMax = getNodeMaxKey(pager, child);
+    releasePage(pager, childPageNum, child);
+
+    // Collect every child, including the new one, in key order
+    uint32_t numKeys = *internalNodeNumKeys(oldNode);
+    uint32_t numChildren = 0;
+    uint32_t children[INTERNAL_NODE_MAX_KEYS + 2];
+    uint64_t keys[INTERNAL_NODE_MAX_KEYS + 2];
+    bool inserted = false;
+    for (uint32_t i = 0; i <= numKeys; i++)
+    {
+        uint64_t key = (i < numKeys) ? internalNodeTreeKey(oldNode, i) : oldMax;
+        if (!inserted && childMax < key)
+        {
+            children[numChildren] = childPageNum;
+            keys[numChildren] = childMax;
+            numChildren++;
+            inserted = true;
+        }
+        children[numChildren] = *internalNodeChild(oldNode, i);
+        keys[numChildren] = key;
+        numChildren++;
+    }
+    if (!inserted)
+    {
+        children[numChildren] = childPageNum;
+        keys[numChildren] = childMax;
+        numChildren++;
+    }
+
+    uint32_t leftCount = numChildren / 2;
+    uint32_t rightCount = numChildren - leftCount;
+    uint64_t leftMax = keys[leftCount - 1];
+
+    if (isNodeRoot(oldNode))
+    {
+        uint32_t leftPageNum = getUnusedPageNum(pager);
+        void *left = getPage(pager, leftPageNum);
+        uint32_t rightPageNum = getUnusedPageNum(pager);
+        void *right = getPage(pager, rightPageNum);
+
+        internalNodeFill(pager, left, leftPageNum, children, keys, leftCount,
+                         parentPageNum);
+        internalNodeFill(pager, right, rightPageNum, children + leftCount,
+                         keys + leftCount, rightCount, parentPageNum);
+        unpinPage(pager, leftPageNum, true);
+        unpinPage(pager, rightPageNum, true);
+
+        initializeRootNode(pager, oldNode, parentPageNum, leftPageNum,
+                           rightPageNum);
+        unpinPage(pager, parentPageNum, true);
+        return;
+    }
+
+    uint32_t grandparentPageNum = *nodeParent(oldNode);
+    uint32_t newPageNum = getUnusedPageNum(pager);
+    void *newNode = getPage(pager, newPageNum);
+    *nodeParent(newNode) = grandparentPageNum;
+
+    internalNodeFill(pager, oldNode, parentPageNum, children, keys, leftCount,
+                     parentPageNum);
+    internalNodeFill(pager, newNode, newPageNum, children + leftCount,
+                     keys + leftCount, rightCount, parentPageNum);
+    unpinPage(pager, parentPageNum, true);
+    unpinPage(pager, newPageNum, true);
+
+    void *grandparent = getPage(pager, grandparentPageNum);
+    updateInternalNodeKey(grandparent, oldMax, leftMax);
+    unpinPage(pager, grandparentPageNum, true);
+    internalNodeInsert(table, grandparentPageNum, newPageNum);
+}
+
+/*
+Add a new child/key pair to parent that corresponds to child
+*/
+static void internalNodeInsert(Table *table, uint32_t parentPageNum,
+                               uint32_t childPageNum)
+{
+    Pager *pager = table->pager;
+    void *parent = getPage(pager, parentPageNum);
+    void *child = readPage(pager, childPageNum);
+    uint64_t childMaxKey = getNodeMaxKey(pager, child);
+    releasePage(pager, childPageNum, child);
+
+    uint32_t index = internalNodeFindChild(parent, childMaxKey);
+    uint32_t originalNumKeys = *internalNodeNumKeys(parent);
+
+    if (originalNumKeys >= INTERNAL_NODE_MAX_KEYS)
+    {
+        unpinPage(pager, parentPageNum, false);
+        internalNodeSplitAndInsert(table, parentPageNum, childPageNum);
+        return;
+    }
+
+    uint32_t rightChildPageNum = *internalNodeRightChild(parent);
+    void *rightChild = readPage(pager, rightChildPageNum);
+    uint64_t rightChildMaxKey = getNodeMaxKey(pager, rightChild);
+    releasePage(pager, rightChildPageNum, rightChild);
+
+    if (childMaxKey > rightChildMaxKey)
+    {
+        // Replace right child
+        *internalNodeCell(parent, originalNumKeys) = rightChildPageNum;
+        setInternalNodeKey(parent, originalNumKeys, rightChildMaxKey);
+        *internalNodeRightChild(parent) = childPageNum;
+    }
+    else
+    {
+        // Make room for the new cell
+        for (uint32_t i = originalNumKeys; i > index; i--)
+        {
+            memcpy(internalNodeCell(parent, i), internalNodeCell(parent, i - 1),
+                   INTERNAL_NODE_CELL_SIZE);
+        }
+        *internalNodeCell(parent, index) = childPageNum;
+        setInternalNodeKey(parent, index, childMaxKey);
+    }
+    *internalNodeNumKeys(parent) += 1;
+    unpinPage(pager, parentPageNum, true);
+}
+
+/**
+ * @brief position of the pointer to childPageNum among a node's children
+ */
+static uint32_t internalNodeChildIndex(void *node, uint32_t childPageNum)
+{
+    uint32_t numKeys = *internalNodeNumKeys(node);
+    for (uint32_t i = 0; i < numKeys; i++)
+    {
+        if (*internalNodeCell(node, i) == childPageNum)
+        {
+            return i;
+        }
+    }
+    if (*internalNodeRightChild(node) != childPageNum)
+    {
+        fatalError(DB_ERROR_CORRUPT, "Page %u is missing from its parent. Corrupt file.",
+                   childPageNum);
+    }
+    return numKeys;
+}
+
+/**
+ * @brief drop cell cellNum, its child and key, from an internal node
+ */
+static void internalNodeRemoveCell(void *node, uint32_t cellNum)
+{
+    uint32_t numKeys = *internalNodeNumKeys(node);
+    memmove(internalNodeCell(node, cellNum), internalNodeCell(node, cellNum + 1),
+            (numKeys - cellNum - 1) * INTERNAL_NODE_CELL_SIZE);
+    *internalNodeNumKeys(node) -= 1;
+}
+
+/**
+ * @brief the leaf before a leaf in key order, or 0 if it is the first
+ *
+ * Climbs to the nearest ancestor where the path has a left sibling, then
+ * takes that sibling's rightmost leaf.
+ */
+static uint32_t leafNodePrevious(Pager *pager, uint32_t pageNum)
+{
+    uint32_t childPageNum = pageNum;
+    while (true)
+    {
+        void *child = readPage(pager, childPageNum);
+        bool isRoot = isNodeRoot(child);
+        uint32_t parentPageNum = *nodeParent(child);
+        releasePage(pager, childPageNum, child);
+        if (isRoot)
+        {
+            return 0;
+        }
+
+        void *parent = readPage(pager, parentPageNum);
+        uint32_t childNum = internalNodeChildIndex(parent, childPageNum);
+        if (childNum > 0)
+        {
+            pageNum = *internalNodeChild(parent, childNum - 1);
+            releasePage(pager, parentPageNum, parent);
+            break;
+        }
+        releasePage(pager, parentPageNum, parent);
+        childPageNum = parentPageNum;
+    }
+
+    void *node = readPage(pager, pageNum);
+    while (!isLeafNode(node))
+    {
+        uint32_t rightChildPageNum = *internalNodeRightChild(node);
+        releasePage(pager, pageNum, node);
+        pageNum = rightChildPageNum;
+        node = readPage(pager, pageNum);
+    }
+    releasePage(pager, pageNum, node);
+    return pageNum;
+}
+
+/**
+ * @brief take an empty node out of its parent and free its page
+ *
+ * A parent left with no children goes the same way, except the root,
+ * which becomes an empty leaf of layout leafType.
+ */
+static void treeRemoveNode(Table *table, uint32_t pageNum, NodeType leafType)
+{
+    Pager *pager = table->pager;
+    void *node = readPage(pager, pageNum);
+    uint32_t parentPageNum = *nodeParent(node);
+    releasePage(pager, pageNum, node);
+
+    void *parent = getPage(pager, parentPageNum);
+    uint32_t numKeys = *internalNodeNumKeys(parent);
+    uint32_t childNum = internalNodeChildIndex(parent, pageNum);
+    if (numKeys == 0 && isNodeRoot(parent))
+    {
+        initializeLeafNode(parent);
+        setNodeType(parent, leafType);
+        setNodeRoot(parent, true);
+        unpinPage(pager, parentPageNum, true);
+    }
+    else if (numKeys == 0)
+    {
+        unpinPage(pager, parentPageNum, false);
+        treeRemoveNode(table, parentPageNum, leafType);
+    }
+    else
+    {
+        if (childNum == numKeys)
+        {
+            // The last cell's child takes over as the right child
+            *internalNodeRightChild(parent) = *internalNodeCell(parent, numKeys - 1);
+            childNum = numKeys - 1;
+        }
+        // Keys are upper bounds, so the neighbours' keys stay valid
+        internalNodeRemoveCell(parent, childNum);
+        unpinPage(pager, parentPageNum, true);
+    }
+    freePage(pager, pageNum);
+}
+
+/**
+ * @brief delete the cell under the cursor
+ *
+ * A leaf left empty is unlinked and freed, unless it is the root; other
+ * underfull leaves wait for vacuumStep(). The cursor is invalid afterwards.
+ */
+static void treeDelete(Table *table, Cursor *cursor)
+{
+    Pager *pager = table->pager;
+    void *node = getPage(pager, cursor->pageNum);
+    leafNodeRemoveCell(node, cursor->cellNum, pager->scratch);
+    bool unlink = *leafNodeNumCells(node) == 0 && !isNodeRoot(node);
+    NodeType type = getNodeType(node);
+    uint32_t nextPageNum = *leafNodeNextLeaf(node);
+    unpinPage(pager, cursor->pageNum, true);
+    if (!unlink)
+    {
+        return;
+    }
+
+    uint32_t previousPageNum = leafNodePrevious(pager, cursor->pageNum);
+    if (previousPageNum != 0)
+    {
+        void *previous = getPage(pager, previousPageNum);
+        *leafNodeNextLeaf(previous) = nextPageNum;
+        unpinPage(pager, previousPageNum, true);
+    }
+    treeRemoveNode(table, cursor->pageNum, type);
+}
+
+/**
+ * @brief remove row's entry from an index
+ */
+static void indexDelete(Index *index, Row *row)
+{
+    const char *value = index->column == COLUMN_USERNAME ? row->username : row->email;
+    uint64_t key = treeKey(indexHash(value, strlen(value)), row->id);
+    Cursor cursor;
+    treeFind(&(index->tree), key, &cursor);
+    void *node = cursorLeaf(&cursor);
+    bool found = cursor.cellNum < *leafNodeNumCells(node) &&
+                 leafNodeTreeKey(node, cursor.cellNum) == key;
+    cursorRelease(&cursor);
+    if (!found)
+    {
+        fatalError(DB_ERROR_CORRUPT, "Index entry for row %u is missing.", row->id);
+    }
+    treeDelete(&(index->tree), &cursor);
+}
+
+/**
+ * @brief delete the row with key id and its index entries, if it exists
+ *
+ * The change is left uncommitted.
+ */
+static bool tableDelete(Table *table, uint32_t id)
+{
+    Cursor cursor;
+    tableFind(table, id, &cursor);
+    void *node = cursorLeaf(&cursor);
+    bool found = cursor.cellNum < *leafNodeNumCells(node) &&
+                 *leafNodeKey(node, cursor.cellNum) == id;
+    Row row;
+    if (found)
+    {
+        leafNodeReadRow(node, cursor.cellNum, &row);
+    }
+    cursorRelease(&cursor);
+
+    if (!found)
+    {
+        return false;
+    }
+    treeDelete(table, &cursor);
+    for (uint32_t i = 0; i < table->numIndexes; i++)
+    {
+        indexDelete(&table->indexes[i], &row);
+    }
+    headerAddRows(table->pager, -1);
+    return true;
+}
+
+/**
+ * @brief bytes the cells of a leaf take up, with their slots or ends but
+ * not counting holes
+ */
+static uint32_t leafNodeUsedSpace(void *node)
+{
+    return LEAF_NODE_SPACE_FOR_CELLS - leafNodeReusableSpace(node);
+}
+
+/**
+ * @brief move the leaf after node into node, if they share a parent and
+ * fit in one page
+ * @return whether the leaves were merged
+ */
+static bool vacuumMerge(Table *tree, uint32_t pageNum, void *node)
+{
+    Pager *pager = tree->pager;
+    uint32_t rightPageNum = *leafNodeNextLeaf(node);
+    if (rightPageNum == 0)
+    {
+        return false;
+    }
+    void *right = getPage(pager, rightPageNum);
+    uint32_t parentPageNum = *nodeParent(right);
+    bool fits = parentPageNum == *nodeParent(node) &&
+                leafNodeUsedSpace(node) + leafNodeUsedSpace(right) <= LEAF_NODE_SPACE_FOR_CELLS;
+    if (fits)
+    {
+        leafNodeRepack(node, right, pager->scratch);
+        *leafNodeNextLeaf(node) = *leafNodeNextLeaf(right);
+    }
+    unpinPage(pager, rightPageNum, false);
+    if (!fits)
+    {
+        return false;
+    }
+
+    // Node takes over the right leaf's place, and key, in the parent
+    void *parent = getPage(pager, parentPageNum);
+    uint32_t childNum = internalNodeChildIndex(parent, rightPageNum);
+    *internalNodeChild(parent, childNum) = pageNum;
+    internalNodeRemoveCell(parent, childNum - 1);
+    unpinPage(pager, parentPageNum, true);
+    freePage(pager, rightPageNum);
+    return true;
+}
+
+/**
+ * @brief while the root has a single child, move the child into the root
+ */
+static void vacuumCollapseRoot(Table *tree, Vacuum *vacuum)
+{
+    Pager *pager = tree->pager;
+    while (true)
+    {
+        void *root = getPage(pager, tree->rootPageNum);
+        if (isLeafNode(root) || *internalNodeNumKeys(root) > 0)
+        {
+            unpinPage(pager, tree->rootPageNum, false);
+            return;
+        }
+        uint32_t childPageNum = *internalNodeRightChild(root);
+        void *child = readPage(pager, childPageNum);
+        memcpy(root, child, PAGE_SIZE);
+        releasePage(pager, childPageNum, child);
+        setNodeRoot(root, true);
+        *nodeParent(root) = 0;
+        if (!isLeafNode(root))
+        {
+            uint32_t numKeys = *internalNodeNumKeys(root);
+            for (uint32_t i = 0; i <= numKeys; i++)
+            {
+                uint32_t grandchildPageNum = *internalNodeChild(root, i);
+                void *grandchild = getPage(pager, grandchildPageNum);
+                *nodeParent(grandchild) = tree->rootPageNum;
+                unpinPage(pager, grandchildPageNum, true);
+            }
+        }
+        unpinPage(pager, tree->rootPageNum, true);
+        freePage(pager, childPageNum);
+        vacuum->pagesFreed++;
+    }
+}
+
+static void vacuumBegin(Vacuum *vacuum, Table *table)
+{
+    vacuum->table = table;
+    vacuum->tree = 0;
+    vacuum->key = 0;
+    vacuum->done = false;
+    vacuum->pagesFreed = 0;
+}
+
+/**
+ * @brief compact up to VACUUM_STEP_LEAVES leaves of one tree, then commit
+ *
+ * Each leaf absorbs the leaves after it for as long as they fit, and a
+ * row leaf with holes is repacked. Once a tree's last leaf is done, its
+ * root loses any levels with a single child and the next tree starts.
+ */
+static void vacuumStep(Vacuum *vacuum)
+{
+    Table *table = vacuum->table;
+    Table *tree = vacuum->tree == 0 ? table : &(table->indexes[vacuum->tree - 1].tree);
+    Pager *pager = table->pager;
+    Cursor cursor;
+    treeFind(tree, vacuum->key, &cursor);
+    uint32_t pageNum = cursor.pageNum;
+    for (uint32_t visited = 0; visited < VACUUM_STEP_LEAVES && pageNum != 0; visited++)
+    {
+        void *node = getPage(pager, pageNum);
+        if (vacuumMerge(tree, pageNum, node))
+        {
+            // The new next leaf may fit as well
+            vacuum->pagesFreed++;
+            unpinPage(pager, pageNum, true);
+            continue;
+        }
+        bool holes = leafNodeReusableSpace(node) != leafNodeFreeSpace(node);
+        if (holes)
+        {
+            leafNodeRepack(node, NULL, pager->scratch);
+        }
+        uint32_t nextPageNum = *leafNodeNextLeaf(node);
+        unpinPage(pager, pageNum, holes);
+        pageNum = nextPageNum;
+    }
+
+    if (pageNum == 0)
+    {
+        vacuumCollapseRoot(tree, vacuum);
+        vacuum->tree++;
+        vacuum->key = 0;
+        vacuum->done = vacuum->tree > table->numIndexes;
+    }
+    else
+    {
+        // Leaves other than the root are never empty
+        void *node = readPage(pager, pageNum);
+        vacuum->key = leafNodeTreeKey(node, 0);
+        releasePage(pager, pageNum, node);
+    }
+    commitPager(pager);
+}
+
+uint32_t vacuumTable(Table *table)
+{
+    uint32_t numParts;
+    Table *parts = tableParts(table, &numParts);
+    uint32_t pagesFreed = 0;
+    for (uint32_t i = 0; i < numParts; i++)
+    {
+        Vacuum vacuum;
+        vacuumBegin(&vacuum, &parts[i]);
+        while (!vacuum.done)
+        {
+            vacuumStep(&vacuum);
+        }
+        pagesFreed += vacuum.pagesFreed;
+    }
+    return pagesFreed;
+}
+
+static uint32_t bulkReservePage(BulkLoader *loader)
+{
+    return loader->table->pager->numPages++;
+}
+
+static void bulkFlush(BulkLoader *loader)
+{
+    if (loader->batchCount == 0)
+    {
+        return;
+    }
+    Pager *pager = loader->table->pager;
+    if (pager->store != NULL)
+    {
+        uint32_t pageNums[BULK_WRITE_PAGES];
+        void *pages[BULK_WRITE_PAGES];
+        for (uint32_t i = 0; i < loader->batchCount; i++)
+        {
+            pageNums[i] = loader->batchStart + i;
+            pages[i] = loader->batch + (size_t)i * PAGE_SIZE;
+        }
+        writePages(pager, pageNums, pages, loader->batchCount);
+        loader->batchCount = 0;
+        return;
+    }
+    size_t len = (size_t)loader->batchCount * PAGE_SIZE;
+    off_t offset = (off_t)loader->batchStart * PAGE_SIZE;
+    if (pwrite(pager->fd, loader->batch, len, offset) != (ssize_t)len)
+    {
+        fatalError(DB_ERROR_IO, "Error writing: %d", errno);
+    }
+    countStat(STAT_BYTES_WRITTEN, len);
+    loader->batchCount = 0;
+}
+
+/**
+ * @brief queue a finished page, writing the queue out once it stops being
+ * one consecutive run
+ */
+static void bulkWritePage(BulkLoader *loader, uint32_t pageNum, void *page)
+{
+    if (loader->batchCount == BULK_WRITE_PAGES ||
+        (loader->batchCount > 0 &&
+         pageNum != loader->batchStart + loader->batchCount))
+    {
+        bulkFlush(loader);
+    }
+    if (loader->batchCount == 0)
+    {
+        loader->batchStart = pageNum;
+    }
+    void *copy = loader->batch + (size_t)loader->batchCount * PAGE_SIZE;
+    memcpy(copy, page, PAGE_SIZE);
+    pageSetChecksum(copy);
+    loader->batchCount++;
+}
+
+static uint32_t bulkAddChild(BulkLoader *loader, uint32_t levelNum,
+                             uint32_t childPageNum, uint64_t maxKey);
+
+/**
+ * @brief write out the open node on a level and hand it to the level above
+ */
+static void bulkCloseNode(BulkLoader *loader, uint32_t levelNum)
+{
+    BulkLevel *level = &loader->levels[levelNum];
+    uint64_t maxKey = level->keys[level->numChildren - 1];
+    // May close nodes further up, so it has to run before scratch is used
+    uint32_t parentPageNum = bulkAddChild(loader, levelNum + 1, level->pageNum, maxKey);
+
+    void *node = loader->scratch;
+    initializeInternalNode(node);
+    *nodeParent(node) = parentPageNum;
+    internalNodeFill(loader->table->pager, node, level->pageNum, level->children,
+                     level->keys, level->numChildren, level->pageNum);
+    bulkWritePage(loader, level->pageNum, node);
+    level->numChildren = 0;
+}
+
+/**
+ * @brief add a finished node to the open node on a level
+ * @return page number of the child's parent
+ */
+static uint32_t bulkAddChild(BulkLoader *loader, uint32_t levelNum,
+                             uint32_t childPageNum, uint64_t maxKey)
+{
+    if (levelNum == BULK_MAX_LEVELS)
+    {
+        fatalError(DB_ERROR_FULL, "Bulk load needs more than %u internal levels.", BULK_MAX_LEVELS);
+    }
+    BulkLevel *level = &loader->levels[levelNum];
+    if (levelNum == loader->numLevels)
+    {
+        level->children = malloc(sizeof(uint32_t) * (INTERNAL_NODE_MAX_KEYS + 1));
+        level->keys = malloc(sizeof(uint64_t) * (INTERNAL_NODE_MAX_KEYS + 1));
+        level->numChildren = 0;
+        level->pageNum = bulkReservePage(loader);
+        loader->numLevels++;
+    }
+    else if (level->numChildren == INTERNAL_NODE_MAX_KEYS + 1)
+    {
+        bulkCloseNode(loader, levelNum);
+        level->pageNum = bulkReservePage(loader);
+    }
+
+    level->children[level->numChildren] = childPageNum;
+    level->keys[level->numChildren] = maxKey;
+    level->numChildren++;
+    return level->pageNum;
+}
+
+static void bulkCloseLeaf(BulkLoader *loader, uint32_t nextLeafPageNum)
+{
+    void *leaf = loader->leaf;
+    uint64_t maxKey = leafNodeTreeKey(leaf, *leafNodeNumCells(leaf) - 1);
+    *leafNodeNextLeaf(leaf) = nextLeafPageNum;
+    *nodeParent(leaf) = bulkAddChild(loader, 0, loader->leafPageNum, maxKey);
+    if (loader->columnar)
+    {
+        // Internal nodes are done with the scratch page by now
+        paxLeafConvert(loader->scratch, leaf);
+        leaf = loader->scratch;
+    }
+    bulkWritePage(loader, loader->leafPageNum, leaf);
+    loader->numLeaves++;
+}
+
+/**
+ * @brief start a bulk load; the table must be empty
+ *
+ * Leaves get the layout of the empty root. PAX leaves are filled only as
+ * far as the row layout would fit, so they start out a little short of
+ * full.
+ */
+static void bulkBegin(BulkLoader *loader, Table *table)
+{
+    void *root = readPage(table->pager, table->rootPageNum);
+    loader->columnar = isPaxLeaf(root);
+    releasePage(table->pager, table->rootPageNum, root);
+    loader->table = table;
+    loader->leaf = malloc(PAGE_SIZE);
+    initializeLeafNode(loader->leaf);
+    loader->leafPageNum = bulkReservePage(loader);
+    loader->numLeaves = 0;
+    loader->numRows = 0;
+    loader->lastKey = 0;
+    loader->numLevels = 0;
+    loader->scratch = malloc(PAGE_SIZE);
+    loader->batch = malloc((size_t)BULK_WRITE_PAGES * PAGE_SIZE);
+    loader->batchCount = 0;
+}
+
+/**
+ * @brief append a row under key; rows must arrive in strictly ascending
+ * treeKey() order
+ */
+static void bulkAppendRow(BulkLoader *loader, uint32_t key, Row *row)
+{
+    void *leaf = loader->leaf;
+    uint32_t size = tableRowSize(row);
+    if (leafNodeFreeSpace(leaf) < size + LEAF_NODE_SLOT_SIZE)
+    {
+        uint32_t nextLeafPageNum = bulkReservePage(loader);
+        bulkCloseLeaf(loader, nextLeafPageNum);
+        initializeLeafNode(leaf);
+        loader->leafPageNum = nextLeafPageNum;
+    }
+
+    uint32_t cellNum = *leafNodeNumCells(leaf);
+    tableRowSerialize(row, leafNodeAllocateCell(leaf, cellNum, key, size));
+    *leafNodeNumCells(leaf) += 1;
+    loader->numRows++;
+    loader->lastKey = key;
+}
+
+/**
+ * @brief write the remaining nodes, install the root and commit
+ */
+static void bulkFinish(BulkLoader *loader)
+{
+    Table *table = loader->table;
+    Pager *pager = table->pager;
+
+    if (loader->numLeaves == 0)
+    {
+        // Everything fits in the root leaf; give back its reserved page
+        pager->numPages--;
+        if (loader->numRows > 0)
+        {
+            void *root = getPage(pager, table->rootPageNum);
+            if (loader->columnar)
+            {
+                paxLeafConvert(root, loader->leaf);
+            }
+            else
+            {
+                memcpy(root, loader->leaf, PAGE_SIZE);
+            }
+            setNodeRoot(root, true);
+            unpinPage(pager, table->rootPageNum, true);
+        }
+    }
+    else
+    {
+        bulkCloseLeaf(loader, 0);
+        uint32_t levelNum = 0;
+        while (levelNum < loader->numLevels - 1)
+        {
+            bulkCloseNode(loader, levelNum);
+            levelNum++;
+        }
+        bulkFlush(loader);
+        // New pages must be durable before the commit that links them in
+        syncDbFile(pager);
+
+        // The top node becomes the root; its reserved page stays unused
+        BulkLevel *top = &loader->levels[levelNum];
+        void *root = getPage(pager, table->rootPageNum);
+        *nodeParent(root) = 0;
+        internalNodeFill(pager, root, table->rootPageNum, top->children,
+                         top->keys, top->numChildren, top->pageNum);
+        setNodeRoot(root, true);
+        unpinPage(pager, table->rootPageNum, true);
+
+        pager->fLen = dbFileLength(pager);
+        remapPager(pager);
+    }
+    commitPager(pager);
+
+    for (uint32_t i = 0; i < loader->numLevels; i++)
+    {
+        free(loader->levels[i].children);
+        free(loader->levels[i].keys);
+    }
+    free(loader->leaf);
+    free(loader->scratch);
+    free(loader->batch);
+}
+
+static int compareIndexEntryHashes(const void *a, const void *b)
+{
+    const IndexEntry *x = a;
+    const IndexEntry *y = b;
+    if (x->hash != y->hash)
+    {
+        return (x->hash > y->hash) - (x->hash < y->hash);
+    }
+    return (x->id > y->id) - (x->id < y->id);
+}
+
+/**
+ * @brief fill one empty index from every row in the table
+ *
+ * Entries are sorted by hash and then id, the order the tree keeps them
+ * in, and bulk loaded.
+ */
+static void indexBuildOne(Table *table, Index *index)
+{
+    uint32_t numEntries = 0;
+    uint32_t capacity = 1024;
+    IndexEntry *entries = malloc(sizeof(IndexEntry) * capacity);
+    size_t valuesLen = 0;
+    size_t valuesCapacity = 1 << 16;
+    char *values = malloc(valuesCapacity);
+
+    Cursor cursor;
+    tableSeek(table, 0, &cursor);
+    while (!(cursor.EOT))
+    {
+        void *node = cursorLeaf(&cursor);
+        uint32_t length;
+        const char *value = leafNodeText(node, cursor.cellNum, index->column, &length);
+        if (numEntries == capacity)
+        {
+            capacity *= 2;
+            entries = realloc(entries, sizeof(IndexEntry) * capacity);
+        }
+        while (valuesLen + length > valuesCapacity)
+        {
+            valuesCapacity *= 2;
+            values = realloc(values, valuesCapacity);
+        }
+        IndexEntry *entry = &entries[numEntries++];
+        entry->hash = indexHash(value, length);
+        entry->id = leafNodeRowId(node, cursor.cellNum);
+        entry->valueOffset = valuesLen;
+        entry->valueLength = length;
+        memcpy(values + valuesLen, value, length);
+        valuesLen += length;
+        cursorRelease(&cursor);
+        cursorAdvance(&cursor);
+    }
+    qsort(entries, numEntries, sizeof(IndexEntry), compareIndexEntryHashes);
+
+    BulkLoader loader;
+    bulkBegin(&loader, &(index->tree));
+    for (uint32_t i = 0; i < numEntries; i++)
+    {
+        Row row;
+        row.id = entries[i].id;
+        row.username[0] = '\0';
+        row.email[0] = '\0';
+        char *dest = index->column == COLUMN_USERNAME ? row.username : row.email;
+        memcpy(dest, values + entries[i].valueOffset, entries[i].valueLength);
+        dest[entries[i].valueLength] = '\0';
+        bulkAppendRow(&loader, entries[i].hash, &row);
+    }
+    bulkFinish(&loader);
+    free(values);
+    free(entries);
+}
+
+/**
+ * @brief fill the indexes after rows were bulk loaded around them
+ */
+static void indexBuild(Table *table)
+{
+    for (uint32_t i = 0; i < table->numIndexes; i++)
+    {
+        indexBuildOne(table, &table->indexes[i]);
+    }
+}
+
+static void indent(uint32_t level)
+{
+    for (uint32_t i = 0; i < level; i++)
+    {
+        printf("  ");
+    }
+}
+
+void printTree(Pager *pager, uint32_t pageNum, uint32_t indentationLevel)
+{
+    void *node = readPage(pager, pageNum);
+    uint32_t numKeys, child;
+
+    switch (getNodeType(node))
+    {
+    case (NODE_LEAF):
+    case (NODE_PAX_LEAF):
+        numKeys = *leafNodeNumCells(node);
+        indent(indentationLevel);
+        printf("- leaf (size %u)\n", numKeys);
+        for (uint32_t i = 0; i < numKeys; i++)
+        {
+            indent(indentationLevel + 1);
+            printf("- %u\n", *leafNodeKey(node, i));
+        }
+        break;
+    case (NODE_INTERNAL):
+        numKeys = *internalNodeNumKeys(node);
+        indent(indentationLevel);
+        printf("- internal (size %u)\n", numKeys);
+        for (uint32_t i = 0; i < numKeys; i++)
+        {
+            child = *internalNodeChild(node, i);
+            printTree(pager, child, indentationLevel + 1);
+
+            indent(indentationLevel + 1);
+            printf("- key %u\n", *internalNodeKey(node, i));
+        }
+        child = *internalNodeRightChild(node);
+        printTree(pager, child, indentationLevel + 1);
+        break;
+    }
+    releasePage(pager, pageNum, node);
+}
+
+void printConstants()
+{
+    printf("ROW_MAX_SIZE: %u\n", ROW_MAX_SIZE);
+    printf("COMMON_NODE_HEADER_SIZE: %u\n", COMMON_NODE_HEADER_SIZE);
+    printf("LEAF_NODE_HEADER_SIZE: %u\n", LEAF_NODE_HEADER_SIZE);
+    printf("LEAF_NODE_SLOT_SIZE: %u\n", LEAF_NODE_SLOT_SIZE);
+    printf("LEAF_NODE_SPACE_FOR_CELLS: %u\n", LEAF_NODE_SPACE_FOR_CELLS);
+    printf("INTERNAL_NODE_MAX_KEYS: %u\n", INTERNAL_NODE_MAX_KEYS);
+}
+
+/**
+ * @brief the upper bound of the histogram bucket holding the pct'th
+ * percentile, in microseconds
+ */
+static double latencyPercentile(const uint64_t *histogram, uint32_t pct)
+{
+    uint64_t total = 0;
+    for (uint32_t i = 0; i < STATS_LATENCY_BUCKETS; i++)
+    {
+        total += histogram[i];
+    }
+    uint64_t rank = (total * pct + 99) / 100;
+    uint64_t seen = 0;
+    for (uint32_t i = 0; i < STATS_LATENCY_BUCKETS; i++)
+    {
+        seen += histogram[i];
+        if (seen >= rank && seen > 0)
+        {
+            return (double)(2ull << i) / 1e3;
+        }
+    }
+    return 0;
+}
+
+static void printLatencies(const char *name, const uint64_t *histogram)
+{
+    uint64_t total = 0;
+    for (uint32_t i = 0; i < STATS_LATENCY_BUCKETS; i++)
+    {
+        total += histogram[i];
+    }
+    printf("%s: %llu, p50 < %.1f us, p99 < %.1f us\n", name, (unsigned long long)total,
+           latencyPercentile(histogram, 50), latencyPercentile(histogram, 99));
+}
+
+void printStats(void)
+{
+    DbStats stats;
+    dbStats(&stats);
+    uint64_t lookups = stats.pageHits + stats.pageMisses;
+    printf("page hits: %llu (%.1f%%)\n", (unsigned long long)stats.pageHits,
+           lookups > 0 ? stats.pageHits * 100.0 / lookups : 0.0);
+    printf("page misses: %llu\n", (unsigned long long)stats.pageMisses);
+    printf("evictions: %llu\n", (unsigned long long)stats.evictions);
+    printf("bytes read: %llu\n", (unsigned long long)stats.bytesRead);
+    printf("bytes written: %llu\n", (unsigned long long)stats.bytesWritten);
+    printf("WAL bytes written: %llu\n", (unsigned long long)stats.walBytesWritten);
+    printf("rows scanned: %llu\n", (unsigned long long)stats.rowsScanned);
+    printf("rows returned: %llu\n", (unsigned long long)stats.rowsReturned);
+    printLatencies("prepares", stats.prepareNanos);
+    printLatencies("executes", stats.executeNanos);
+}
+
+/**
+ * @brief write out buffered rows followed by count more pieces
+ */
+static void sinkWritev(ResultSink *sink, struct iovec *iov, int count)
+{
+    if (sink->fd == -1)
+    {
+        for (int i = 0; i < count; i++)
+        {
+            if (fwrite(iov[i].iov_base, 1, iov[i].iov_len, sink->out) != iov[i].iov_len)
+            {
+                fatalError(DB_ERROR_IO, "Error writing rows: %d", errno);
+            }
+        }
+        return;
+    }
+    if (!sink->direct)
+    {
+        // Whatever the FILE already holds goes out first
+        fflush(sink->out);
+        sink->direct = true;
+    }
+    while (count > 0)
+    {
+        ssize_t written = writev(sink->fd, iov, count);
+        if (written == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            fatalError(DB_ERROR_IO, "Error writing rows: %d", errno);
+        }
+        // Step over whatever a short write did get out
+        for (; count > 0 && (size_t)written >= iov->iov_len; iov++, count--)
+        {
+            written -= iov->iov_len;
+        }
+        if (count > 0)
+        {
+            iov->iov_base = (char *)iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+}
+
+/**
+ * @brief a file sink formatting into buffer
+ *
+ * Full buffers bypass stdio; see sinkClose() for the rest.
+ */
+static void sinkOpenFile(ResultSink *sink, FILE *out, OutputFormat format, char *buffer,
+                         size_t capacity)
+{
+    sink->out = out;
+    sink->fd = fileno(out);
+    sink->direct = false;
+    sink->format = format;
+    sink->buffer = buffer;
+    sink->used = 0;
+    sink->capacity = capacity;
+}
+
+static void sinkOpenMemory(ResultSink *sink, OutputFormat format)
+{
+    sink->out = NULL;
+    sink->fd = -1;
+    sink->direct = false;
+    sink->format = format;
+    sink->buffer = malloc(SINK_BUFFER_SIZE);
+    sink->used = 0;
+    sink->capacity = SINK_BUFFER_SIZE;
+}
+
+static void sinkFlush(ResultSink *sink)
+{
+    struct iovec iov = {.iov_base = sink->buffer, .iov_len = sink->used};
+    if (sink->used > 0)
+    {
+        sinkWritev(sink, &iov, 1);
+    }
+    sink->used = 0;
+}
+
+/**
+ * @brief hand what is left in a file sink's buffer to stdio
+ *
+ * A select that only fills part of the buffer, like a point lookup, then
+ * costs no system call of its own, and rows stay in order with the
+ * caller's own writes to the FILE.
+ */
+static void sinkClose(ResultSink *sink)
+{
+    if (sink->used > 0 && fwrite(sink->buffer, 1, sink->used, sink->out) != sink->used)
+    {
+        fatalError(DB_ERROR_IO, "Error writing rows: %d", errno);
+    }
+    sink->used = 0;
+}
+
+/**
+ * @brief room for len more bytes at the end of the buffer
+ * @param len at most SINK_FIELD_MAX
+ */
+static char *sinkReserve(ResultSink *sink, size_t len)
+{
+    if (sink->used + len > sink->capacity)
+    {
+        if (sink->out != NULL)
+        {
+            sinkFlush(sink);
+        }
+        else
+        {
+            sink->capacity *= 2;
+            sink->buffer = realloc(sink->buffer, sink->capacity);
+        }
+    }
+    return sink->buffer + sink->used;
+}
+
+/**
+ * @brief add len bytes of formatted rows to sink
+ *
+ * A file sink writes a run too big for its buffer together with the
+ * buffer in one writev() rather than copying it.
+ */
+static void sinkWrite(ResultSink *sink, const char *data, size_t len)
+{
+    if (sink->out == NULL || sink->used + len <= sink->capacity)
+    {
+        while (sink->used + len > sink->capacity)
+        {
+            sink->capacity *= 2;
+            sink->buffer = realloc(sink->buffer, sink->capacity);
+        }
+        memcpy(sink->buffer + sink->used, data, len);
+        sink->used += len;
+        return;
+    }
+    struct iovec iov[2] = {
+        {.iov_base = sink->buffer, .iov_len = sink->used},
+        {.iov_base = (void *)data, .iov_len = len},
+    };
+    sinkWritev(sink, iov, 2);
+    sink->used = 0;
+}
+
+/**
+ * @brief add a memory sink's rows to sink in order
+ */
+static void sinkAppend(ResultSink *sink, ResultSink *rows)
+{
+    sinkWrite(sink, rows->buffer, rows->used);
+}
+
+static char *formatId(char *p, uint32_t id)
+{
+    char digits[10];
+    uint32_t numDigits = 0;
+    do
+    {
+        digits[sizeof(digits) - ++numDigits] = '0' + id % 10;
+        id /= 10;
+    } while (id != 0);
+    memcpy(p, digits + sizeof(digits) - numDigits, numDigits);
+    return p + numDigits;
+}
+
+/**
+ * @brief text as a CSV field, quoted only when it has to be
+ */
+static char *formatCsvText(char *p, const char *text, uint32_t length)
+{
+    bool quote = false;
+    for (uint32_t i = 0; i < length && !quote; i++)
+    {
+        quote = text[i] == ',' || text[i] == '"' || text[i] == '\n' || text[i] == '\r';
+    }
+    if (!quote)
+    {
+        memcpy(p, text, length);
+        return p + length;
+    }
+    *p++ = '"';
+    for (uint32_t i = 0; i < length; i++)
+    {
+        if (text[i] == '"')
+        {
+            *p++ = '"';
+        }
+        *p++ = text[i];
+    }
+    *p++ = '"';
+    return p;
+}
+
+/**
+ * @brief format the projected columns of the row in cell cellNum of a leaf
+ *
+ * OUTPUT_TEXT and OUTPUT_CSV end each row with a newline. OUTPUT_BINARY
+ * writes each column in projection order with nothing between them: an id
+ * as 4 bytes, text as a 2-byte length and then its bytes, all in host
+ * byte order.
+ */
+static void printRow(ResultSink *sink, void *node, uint32_t cellNum,
+                     Projection *projection)
+{
+    OutputFormat format = sink->format;
+    char *p = sinkReserve(sink, 1);
+    if (format == OUTPUT_TEXT)
+    {
+        *p++ = '(';
+    }
+    sink->used = p - sink->buffer;
+    for (uint32_t i = 0; i < projection->numColumns; i++)
+    {
+        p = sinkReserve(sink, SINK_FIELD_MAX);
+        if (i > 0 && format != OUTPUT_BINARY)
+        {
+            *p++ = ',';
+            if (format == OUTPUT_TEXT)
+            {
+                *p++ = ' ';
+            }
+        }
+        Column column = projection->columns[i];
+        if (column == COLUMN_ID)
+        {
+            uint32_t id = leafNodeRowId(node, cellNum);
+            if (format == OUTPUT_BINARY)
+            {
+                memcpy(p, &id, sizeof(id));
+                p += sizeof(id);
+            }
+            else
+            {
+                p = formatId(p, id);
+            }
+        }
+        else
+        {
+            uint32_t length;
+            const char *text = leafNodeText(node, cellNum, column, &length);
+            if (format == OUTPUT_BINARY)
+            {
+                uint16_t binaryLength = length;
+                memcpy(p, &binaryLength, sizeof(binaryLength));
+                memcpy(p + sizeof(binaryLength), text, length);
+                p += sizeof(binaryLength) + length;
+            }
+            else if (format == OUTPUT_CSV)
+            {
+                p = formatCsvText(p, text, length);
+            }
+            else
+            {
+                memcpy(p, text, length);
+                p += length;
+            }
+        }
+        sink->used = p - sink->buffer;
+    }
+    if (format == OUTPUT_BINARY)
+    {
+        return;
+    }
+    p = sinkReserve(sink, 2);
+    if (format == OUTPUT_TEXT)
+    {
+        *p++ = ')';
+    }
+    *p++ = '\n';
+    sink->used = p - sink->buffer;
+}
+
+/**
+ * @brief cursor at the first cell whose treeKey() is >= key
+ *
+ * Unlike treeFind(), the cursor always points at a cell or is at EOT.
+ */
+static void treeSeek(Table *tree, uint64_t key, Cursor *cursor)
+{
+    treeFind(tree, key, cursor);
+
+    void *node = readPage(tree->pager, cursor->pageNum);
+    uint32_t numCells = *leafNodeNumCells(node);
+    uint32_t nextPageNum = *leafNodeNextLeaf(node);
+    releasePage(tree->pager, cursor->pageNum, node);
+
+    if (cursor->cellNum < numCells)
+    {
+        return;
+    }
+    // Key is past the end of this leaf; the next row starts the next one
+    if (nextPageNum == 0)
+    {
+        cursor->EOT = true;
+    }
+    else
+    {
+        cursor->pageNum = nextPageNum;
+        cursor->cellNum = 0;
+    }
+}
+
+/**
+ * @brief cursor at the first row whose id is >= key, or at EOT
+ */
+static void tableSeek(Table *table, uint32_t key, Cursor *cursor)
+{
+    treeSeek(table, treeKey(key, 0), cursor);
+}
+
+/**
+ * @brief prefetch the leaves after the cursor's, once it is plainly scanning
+ *
+ * Upcoming leaves are the later children of the parent, so nothing is
+ * guessed from page order. The next batch is requested when the cursor
+ * reaches the middle of the last one, keeping reads in flight ahead of it.
+ * @param leaf the leaf the cursor just left; its parent is searched
+ */
+static void cursorReadAhead(Cursor *cursor, void *leaf)
+{
+    if (++cursor->leavesCrossed < READ_AHEAD_TRIGGER)
+    {
+        return;
+    }
+    if (cursor->readAheadMark != INVALID_PAGE_NUM &&
+        cursor->readAheadMark != cursor->pageNum)
+    {
+        return;
+    }
+
+    Pager *pager = cursor->table->pager;
+    uint32_t parentPageNum = *nodeParent(leaf);
+    void *parent = readPage(pager, parentPageNum);
+    uint32_t pageNums[READ_AHEAD_LEAVES];
+    uint32_t count = 0;
+    if (getNodeType(parent) == NODE_INTERNAL)
+    {
+        uint32_t numKeys = *internalNodeNumKeys(parent);
+        uint32_t childNum = 0;
+        while (childNum <= numKeys && *internalNodeChild(parent, childNum) != cursor->pageNum)
+        {
+            childNum++;
+        }
+        // Not found when the new leaf starts the next parent; the next
+        // crossing looks there
+        for (uint32_t i = childNum + 1; i <= numKeys && count < READ_AHEAD_LEAVES; i++)
+        {
+            pageNums[count++] = *internalNodeChild(parent, i);
+        }
+    }
+    releasePage(pager, parentPageNum, parent);
+
+    cursor->readAheadMark = count > 0 ? pageNums[count / 2] : INVALID_PAGE_NUM;
+    prefetchPages(pager, pageNums, count);
+}
+
+static void cursorAdvance(Cursor *cursor)
+{
+    Pager *pager = cursor->table->pager;
+    uint32_t pageNum = cursor->pageNum;
+    void *node = readPage(pager, pageNum);
+
+    cursor->cellNum += 1;
+    if (cursor->cellNum >= (*leafNodeNumCells(node)))
+    {
+        // Advance to next leaf node
+        uint32_t nextPageNum = *leafNodeNextLeaf(node);
+        if (nextPageNum == 0)
+        {
+            // This was rightmost leaf
+            cursor->EOT = true;
+        }
+        else
+        {
+            cursor->pageNum = nextPageNum;
+            cursor->cellNum = 0;
+            cursorReadAhead(cursor, node);
+        }
+    }
+    releasePage(pager, pageNum, node);
+}
+
+/**
+ * @brief write an LZ4 length's extension bytes, for the part of len past
+ * the 15 its token holds
+ */
+static uint32_t lz4PutLength(uint8_t *dst, uint32_t op, uint32_t len)
+{
+    if (len < 15)
+    {
+        return op;
+    }
+    for (len -= 15; len >= 255; len -= 255)
+    {
+        dst[op++] = 255;
+    }
+    dst[op++] = len;
+    return op;
+}
+
+/**
+ * @brief append a sequence to an LZ4 block: literals, then a match unless
+ * matchLen is 0, as in the block's last sequence
+ * @return the new block length, or 0 if it would pass dstCap
+ */
+static uint32_t lz4PutSequence(uint8_t *dst, uint32_t op, uint32_t dstCap,
+                               const uint8_t *literals, uint32_t litLen,
+                               uint32_t offset, uint32_t matchLen)
+{
+    // Token, literal length, literals, offset, match length
+    uint64_t worst = (uint64_t)op + 1 + litLen / 255 + 1 + litLen + 2 + matchLen / 255 + 1;
+    if (worst > dstCap)
+    {
+        return 0;
+    }
+    uint32_t tokenAt = op++;
+    dst[tokenAt] = (litLen < 15 ? litLen : 15) << 4;
+    op = lz4PutLength(dst, op, litLen);
+    memcpy(dst + op, literals, litLen);
+    op += litLen;
+    if (matchLen == 0)
+    {
+        return op;
+    }
+    dst[op++] = offset & 0xff;
+    dst[op++] = offset >> 8;
+    uint32_t extra = matchLen - LZ4_MIN_MATCH;
+    dst[tokenAt] |= extra < 15 ? extra : 15;
+    return lz4PutLength(dst, op, extra);
+}
+
+/**
+ * @brief compress into the LZ4 block format: greedily, one hash table
+ * probe per position, stepping faster through input that does not match
+ * @param srcLen at most 64 KiB
+ * @return the block length, or 0 if the block would not fit in dstCap
+ */
+static uint32_t lz4Compress(const uint8_t *src, uint32_t srcLen, uint8_t *dst,
+                            uint32_t dstCap)
+{
+    uint16_t table[1 << LZ4_HASH_BITS];
+    memset(table, 0, sizeof(table));
+    uint32_t matchEnd = srcLen > LZ4_LAST_LITERALS ? srcLen - LZ4_LAST_LITERALS : 0;
+    uint32_t anchor = 0;
+    uint32_t ip = 0;
+    uint32_t op = 0;
+    uint32_t misses = 0;
+    while (ip + LZ4_MATCH_LIMIT <= srcLen)
+    {
+        uint32_t sequence, candidate;
+        memcpy(&sequence, src + ip, sizeof(sequence));
+        uint32_t hash = (sequence * 2654435761u) >> (32 - LZ4_HASH_BITS);
+        uint32_t ref = table[hash];
+        table[hash] = ip;
+        memcpy(&candidate, src + ref, sizeof(candidate));
+        if (ref >= ip || candidate != sequence)
+        {
+            ip += 1 + (misses++ >> LZ4_SKIP_SHIFT);
+            continue;
+        }
+        misses = 0;
+
+        // A word at a time, then the bytes of the word that differs
+        uint32_t matchLen = LZ4_MIN_MATCH;
+        while (ip + matchLen + sizeof(uint64_t) <= matchEnd)
+        {
+            uint64_t x, y;
+            memcpy(&x, src + ip + matchLen, sizeof(x));
+            memcpy(&y, src + ref + matchLen, sizeof(y));
+            if (x != y)
+            {
+                break;
+            }
+            matchLen += sizeof(uint64_t);
+        }
+        while (ip + matchLen < matchEnd && src[ref + matchLen] == src[ip + matchLen])
+        {
+            matchLen++;
+        }
+        op = lz4PutSequence(dst, op, dstCap, src + anchor, ip - anchor, ip - ref, matchLen);
+        if (op == 0)
+        {
+            return 0;
+        }
+        ip += matchLen;
+        anchor = ip;
+    }
+    return lz4PutSequence(dst, op, dstCap, src + anchor, srcLen - anchor, 0, 0);
+}
+
+/**
+ * @brief read an LZ4 length's extension bytes, for a length whose token
+ * field is 15
+ * @return false if the block ends first
+ */
+static bool lz4GetLength(const uint8_t **ip, const uint8_t *end, size_t *len)
+{
+    if (*len < 15)
+    {
+        return true;
+    }
+    uint8_t byte;
+    do
+    {
+        if (*ip == end)
+        {
+            return false;
+        }
+        byte = *(*ip)++;
+        *len += byte;
+    } while (byte == 255);
+    return true;
+}
+
+/**
+ * @brief decompress an LZ4 block that must come to exactly dstLen bytes
+ *
+ * Every length and offset is checked, so a damaged block cannot read or
+ * write out of bounds. Away from the ends of either buffer, short copies
+ * are done in whole words, going past the copy's end into bytes that are
+ * written again later.
+ */
+static bool lz4Decompress(const uint8_t *src, uint32_t srcLen, uint8_t *dst, uint32_t dstLen)
+{
+    const uint8_t *ip = src;
+    const uint8_t *end = src + srcLen;
+    uint8_t *op = dst;
+    uint8_t *outEnd = dst + dstLen;
+    while (ip < end)
+    {
+        uint8_t token = *ip++;
+        size_t litLen = token >> 4;
+        if (!lz4GetLength(&ip, end, &litLen) || litLen > (size_t)(end - ip) ||
+            litLen > (size_t)(outEnd - op))
+        {
+            return false;
+        }
+        if (litLen <= 16 && end - ip >= 16 && outEnd - op >= 16)
+        {
+            memcpy(op, ip, 16);
+        }
+        else
+        {
+            memcpy(op, ip, litLen);
+        }
+        ip += litLen;
+        op += litLen;
+        if (ip == end)
+        {
+            // The last sequence has no match
+            return op == outEnd;
+        }
+
+        if (end - ip < 2)
+        {
+            return false;
+        }
+        size_t offset = ip[0] | (size_t)ip[1] << 8;
+        ip += 2;
+        size_t matchLen = token & 15;
+        if (!lz4GetLength(&ip, end, &matchLen))
+        {
+            return false;
+        }
+        matchLen += LZ4_MIN_MATCH;
+        if (offset == 0 || offset > (size_t)(op - dst) || matchLen > (size_t)(outEnd - op))
+        {
+            return false;
+        }
+        // A match may overlap the bytes it produces; copy a period at a time
+        const uint8_t *match = op - offset;
+        if (offset >= sizeof(uint64_t) && matchLen + sizeof(uint64_t) <= (size_t)(outEnd - op))
+        {
+            for (size_t copied = 0; copied < matchLen; copied += sizeof(uint64_t))
+            {
+                memcpy(op + copied, match + copied, sizeof(uint64_t));
+            }
+        }
+        else if (offset == 1)
+        {
+            memset(op, *match, matchLen);
+        }
+        else
+        {
+            for (size_t copied = 0; copied < matchLen; copied += offset)
+            {
+                size_t chunk = matchLen - copied < offset ? matchLen - copied : offset;
+                memcpy(op + copied, match + copied, chunk);
+            }
+        }
+        op += matchLen;
+    }
+    return false;
+}
+
+static uint32_t extentSector(uint32_t extent)
+{
+    return extent >> STORE_EXTENT_BITS;
+}
+
+static uint32_t extentSectors(uint32_t extent)
+{
+    return (extent & ((1u << STORE_EXTENT_BITS) - 1)) + 1;
+}
+
+static uint32_t storeMapSectors(uint32_t numPages)
+{
+    return (numPages * sizeof(uint32_t) + STORE_SECTOR_SIZE - 1) / STORE_SECTOR_SIZE;
+}
+
+static bool storeSectorUsed(PageStore *store, uint32_t sector)
+{
+    return sector < store->numSectors && (store->used[sector / 64] >> (sector % 64)) & 1;
+}
+
+/**
+ * @brief mark count sectors from sector used or free, growing the bitmap
+ * to cover them
+ */
+static void storeMarkSectors(PageStore *store, uint32_t sector, uint32_t count, bool used)
+{
+    uint32_t end = sector + count;
+    if (end > store->numSectors)
+    {
+        uint32_t words = (end + 63) / 64;
+        if (words > store->usedCapacity)
+        {
+            uint32_t capacity = store->usedCapacity * 2 > words ? store->usedCapacity * 2 : words;
+            store->used = realloc(store->used, sizeof(uint64_t) * capacity);
+            memset(store->used + store->usedCapacity, 0,
+                   sizeof(uint64_t) * (capacity - store->usedCapacity));
+            store->usedCapacity = capacity;
+        }
+        store->numSectors = end;
+    }
+    for (uint32_t i = sector; i < end; i++)
+    {
+        if (used)
+        {
+            store->used[i / 64] |= 1ull << (i % 64);
+        }
+        else
+        {
+            store->used[i / 64] &= ~(1ull << (i % 64));
+        }
+    }
+}
+
+/**
+ * @brief claim count free sectors in a row
+ *
+ * First fit, starting from the first sector that may be free. Pages
+ * written together mostly land one after another, in the holes earlier
+ * syncs freed and then past the last sector in use, where the file grows.
+ */
+static uint32_t storeAllocate(PageStore *store, uint32_t count)
+{
+    uint32_t start = store->hint;
+    uint32_t sector = start;
+    uint32_t firstFree = UINT32_MAX;
+    while (sector < store->numSectors && sector - start < count)
+    {
+        if (sector % 64 == 0 && store->used[sector / 64] == UINT64_MAX)
+        {
+            sector += 64;
+            start = sector;
+        }
+        else if (storeSectorUsed(store, sector))
+        {
+            start = ++sector;
+        }
+        else
+        {
+            firstFree = firstFree < sector ? firstFree : sector;
+            sector++;
+        }
+    }
+    storeMarkSectors(store, start, count, true);
+    // A hole too small for this extent may still take a later one
+    store->hint = firstFree < start ? firstFree : start + count;
+    return start;
+}
+
+/**
+ * @brief read a page of a compressed file; unwritten pages read as zero
+ *
+ * An extent the file ends inside of, or a block that does not decompress,
+ * leaves the page all ones, so that its checksum check reports it.
+ * @return false if the read failed, with errno set
+ */
+static bool storeReadPage(Pager *pager, uint32_t pageNum, void *page)
+{
+    PageStore *store = pager->store;
+    uint8_t block[PAGE_SIZE];
+    pthread_rwlock_rdlock(&store->lock);
+    uint32_t extent = pageNum < store->numPages ? store->extents[pageNum] : 0;
+    uint32_t sectors = extentSectors(extent);
+    ssize_t len = (ssize_t)sectors * STORE_SECTOR_SIZE;
+    bool whole = len == PAGE_SIZE;
+    ssize_t bytesRead = extent == 0 ? len
+                                    : pread(pager->fd, whole ? page : block, len,
+                                            (off_t)extentSector(extent) * STORE_SECTOR_SIZE);
+    int error = errno;
+    pthread_rwlock_unlock(&store->lock);
+
+    if (bytesRead == -1)
+    {
+        errno = error;
+        return false;
+    }
+    countStat(STAT_BYTES_READ, extent == 0 ? 0 : bytesRead);
+    if (extent == 0)
+    {
+        memset(page, 0, PAGE_SIZE);
+        return true;
+    }
+    if (whole && bytesRead == len)
+    {
+        return true;
+    }
+    uint16_t blockLen;
+    memcpy(&blockLen, block, sizeof(blockLen));
+    if (whole || bytesRead != len || blockLen > len - STORE_BLOCK_LENGTH_SIZE ||
+        !lz4Decompress(block + STORE_BLOCK_LENGTH_SIZE, blockLen, page, PAGE_SIZE))
+    {
+        memset(page, 0xff, PAGE_SIZE);
+    }
+    return true;
+}
+
+static void storeWrite(int fd, const void *data, size_t len, uint32_t sector)
+{
+    if (pwrite(fd, data, len, (off_t)sector * STORE_SECTOR_SIZE) != (ssize_t)len)
+    {
+        fatalError(DB_ERROR_IO, "Error writing: %d", errno);
+    }
+    countStat(STAT_BYTES_WRITTEN, len);
+}
+
+/**
+ * @brief write pages to free sectors and point the map at them
+ *
+ * A page is compressed when that saves at least a sector. Extents the
+ * allocator hands out back to back go out in one write. The old extents
+ * stay reserved until the next storeSync() makes the new map durable.
+ */
+static void storeWritePages(Pager *pager, const uint32_t *pageNums, void **pages,
+                            uint32_t count)
+{
+    PageStore *store = pager->store;
+    uint32_t maxBlock = PAGE_SIZE - STORE_SECTOR_SIZE - STORE_BLOCK_LENGTH_SIZE;
+    for (uint32_t batchStart = 0; batchStart < count; batchStart += CHECKPOINT_BATCH_PAGES)
+    {
+        uint32_t batchCount = count - batchStart < CHECKPOINT_BATCH_PAGES
+                                  ? count - batchStart
+                                  : CHECKPOINT_BATCH_PAGES;
+        uint32_t extents[CHECKPOINT_BATCH_PAGES];
+        uint8_t *buffer = store->buffer;
+        size_t used = 0;
+        size_t runStart = 0;
+        uint32_t runSector = 0;
+        for (uint32_t i = 0; i < batchCount; i++)
+        {
+            uint8_t *out = buffer + used;
+            uint32_t blockLen = lz4Compress(pages[batchStart + i], PAGE_SIZE,
+                                            out + STORE_BLOCK_LENGTH_SIZE, maxBlock);
+            uint32_t len = PAGE_SIZE;
+            if (blockLen == 0)
+            {
+                memcpy(out, pages[batchStart + i], PAGE_SIZE);
+            }
+            else
+            {
+                uint16_t storedLen = blockLen;
+                memcpy(out, &storedLen, sizeof(storedLen));
+                len = STORE_BLOCK_LENGTH_SIZE + blockLen;
+            }
+            uint32_t sectors = (len + STORE_SECTOR_SIZE - 1) / STORE_SECTOR_SIZE;
+            memset(out + len, 0, sectors * STORE_SECTOR_SIZE - len);
+
+            uint32_t sector = storeAllocate(store, sectors);
+            extents[i] = sector << STORE_EXTENT_BITS | (sectors - 1);
+            if (used > runStart && sector != runSector + (used - runStart) / STORE_SECTOR_SIZE)
+            {
+                storeWrite(pager->fd, buffer + runStart, used - runStart, runSector);
+                runStart = used;
+            }
+            if (used == runStart)
+            {
+                runSector = sector;
+            }
+            used += sectors * STORE_SECTOR_SIZE;
+        }
+        storeWrite(pager->fd, buffer + runStart, used - runStart, runSector);
+
+        // Only now may readers find the new copies
+        pthread_rwlock_wrlock(&store->lock);
+        for (uint32_t i = 0; i < batchCount; i++)
+        {
+            uint32_t pageNum = pageNums[batchStart + i];
+            if (pageNum >= store->capacity)
+            {
+                uint32_t capacity = store->capacity * 2 > pageNum + 1 ? store->capacity * 2
+                                                                      : pageNum + 1;
+                store->extents = realloc(store->extents, sizeof(uint32_t) * capacity);
+                store->capacity = capacity;
+            }
+            while (store->numPages <= pageNum)
+            {
+                store->extents[store->numPages++] = 0;
+            }
+            uint32_t old = store->extents[pageNum];
+            store->extents[pageNum] = extents[i];
+            if (old == 0)
+            {
+                continue;
+            }
+            if (store->numPending == store->pendingCapacity)
+            {
+                store->pendingCapacity = store->pendingCapacity * 2 + 16;
+                store->pending = realloc(store->pending,
+                                         sizeof(uint32_t) * store->pendingCapacity);
+            }
+            store->pending[store->numPending++] = old;
+        }
+        pthread_rwlock_unlock(&store->lock);
+        store->dirty = true;
+    }
+}
+
+static uint32_t *storeField(void *superblock, uint32_t offset)
+{
+    return superblock + offset;
+}
+
+static void storeFsync(int fd)
+{
+    if (fsync(fd) == -1)
+    {
+        fatalError(DB_ERROR_IO, "Error syncing db file: %d", errno);
+    }
+}
+
+/**
+ * @brief write the superblock for the next sequence number over the older
+ * one, and wait for it to reach the disk
+ */
+static void storeWriteSuperblock(int fd, PageStore *store, uint32_t mapSector,
+                                 uint32_t mapChecksum)
+{
+    uint8_t superblock[STORE_SECTOR_SIZE];
+    memset(superblock, 0, sizeof(superblock));
+    *storeField(superblock, STORE_MAGIC_OFFSET) = STORE_MAGIC;
+    *storeField(superblock, STORE_VERSION_OFFSET) = STORE_VERSION;
+    *storeField(superblock, STORE_SEQUENCE_OFFSET) = store->sequence + 1;
+    *storeField(superblock, STORE_NUM_PAGES_OFFSET) = store->numPages;
+    *storeField(superblock, STORE_MAP_SECTOR_OFFSET) = mapSector;
+    *storeField(superblock, STORE_MAP_CHECKSUM_OFFSET) = mapChecksum;
+    *storeField(superblock, STORE_CHECKSUM_OFFSET) = crc32c(superblock, STORE_CHECKSUM_OFFSET);
+    storeWrite(fd, superblock, sizeof(superblock), (store->sequence + 1) % STORE_SUPERBLOCKS);
+    storeFsync(fd);
+    store->sequence++;
+}
+
+/**
+ * @brief make the pages written so far durable, then a map naming them
+ *
+ * The map goes to free sectors as well, and the superblock not in use is
+ * rewritten to point at it. Once that is on disk, nothing names the old
+ * map or the pages' old extents, and their sectors are free.
+ */
+static void storeSync(Pager *pager)
+{
+    PageStore *store = pager->store;
+    if (!store->dirty)
+    {
+        storeFsync(pager->fd);
+        return;
+    }
+    uint32_t mapSectors = storeMapSectors(store->numPages);
+    uint32_t mapSector = mapSectors > 0 ? storeAllocate(store, mapSectors) : 0;
+    size_t mapLen = (size_t)mapSectors * STORE_SECTOR_SIZE;
+    uint8_t *map = calloc(1, mapLen > 0 ? mapLen : 1);
+    memcpy(map, store->extents, sizeof(uint32_t) * store->numPages);
+    uint32_t mapChecksum = crc32c(map, mapLen);
+    if (mapLen > 0)
+    {
+        storeWrite(pager->fd, map, mapLen, mapSector);
+    }
+    free(map);
+    storeFsync(pager->fd);
+    storeWriteSuperblock(pager->fd, store, mapSector, mapChecksum);
+
+    if (store->mapSector != 0)
+    {
+        storeMarkSectors(store, store->mapSector, storeMapSectors(store->mapPages), false);
+    }
+    for (uint32_t i = 0; i < store->numPending; i++)
+    {
+        uint32_t extent = store->pending[i];
+        storeMarkSectors(store, extentSector(extent), extentSectors(extent), false);
+    }
+    store->numPending = 0;
+    // Free sectors at the end go back to the file system; a failed
+    // truncate only leaves them allocated
+    uint32_t numSectors = store->numSectors;
+    while (numSectors > STORE_SUPERBLOCKS && !storeSectorUsed(store, numSectors - 1))
+    {
+        numSectors--;
+    }
+    if (numSectors < store->numSectors &&
+        ftruncate(pager->fd, (off_t)numSectors * STORE_SECTOR_SIZE) == 0)
+    {
+        store->numSectors = numSectors;
+    }
+    store->mapSector = mapSector;
+    store->mapPages = store->numPages;
+    store->dirty = false;
+    store->hint = STORE_SUPERBLOCKS;
+}
+
+/**
+ * @brief ask the kernel to read the extents of pages that will be needed
+ * soon
+ */
+static void storeAdvise(Pager *pager, const uint32_t *pageNums, uint32_t count)
+{
+    PageStore *store = pager->store;
+    pthread_rwlock_rdlock(&store->lock);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        uint32_t extent = pageNums[i] < store->numPages ? store->extents[pageNums[i]] : 0;
+        if (extent != 0)
+        {
+            posix_fadvise(pager->fd, (off_t)extentSector(extent) * STORE_SECTOR_SIZE,
+                          (off_t)extentSectors(extent) * STORE_SECTOR_SIZE,
+                          POSIX_FADV_WILLNEED);
+        }
+    }
+    pthread_rwlock_unlock(&store->lock);
+}
+
+/**
+ * @brief copy the current superblock into superblock
+ * @return false if neither is valid
+ */
+static bool storeReadSuperblock(int fd, void *superblock)
+{
+    uint8_t superblocks[STORE_SUPERBLOCKS * STORE_SECTOR_SIZE];
+    memset(superblocks, 0, sizeof(superblocks));
+    if (pread(fd, superblocks, sizeof(superblocks), 0) == -1)
+    {
+        fatalError(DB_ERROR_IO, "Error reading file: %d", errno);
+    }
+    bool found = false;
+    for (uint32_t i = 0; i < STORE_SUPERBLOCKS; i++)
+    {
+        void *candidate = superblocks + i * STORE_SECTOR_SIZE;
+        if (*storeField(candidate, STORE_MAGIC_OFFSET) != STORE_MAGIC ||
+            *storeField(candidate, STORE_CHECKSUM_OFFSET) !=
+                crc32c(candidate, STORE_CHECKSUM_OFFSET))
+        {
+            continue;
+        }
+        if (!found || *storeField(candidate, STORE_SEQUENCE_OFFSET) >
+                          *storeField(superblock, STORE_SEQUENCE_OFFSET))
+        {
+            memcpy(superblock, candidate, STORE_SECTOR_SIZE);
+            found = true;
+        }
+    }
+    return found;
+}
+
+/**
+ * @brief load the map of a compressed database file, making a new file
+ * compressed if compress is set
+ * @return NULL for an uncompressed file
+ */
+static PageStore *storeOpen(int fd, bool compress)
+{
+    uint32_t magic = 0;
+    off_t fLen = lseek(fd, 0, SEEK_END);
+    if (fLen >= (off_t)sizeof(magic) && pread(fd, &magic, sizeof(magic), 0) != sizeof(magic))
+    {
+        fatalError(DB_ERROR_IO, "Error reading file: %d", errno);
+    }
+    if (magic != STORE_MAGIC && !(fLen == 0 && compress))
+    {
+        return NULL;
+    }
+
+    PageStore *store = malloc(sizeof(PageStore));
+    store->numPages = 0;
+    store->capacity = 1024;
+    store->extents = malloc(sizeof(uint32_t) * store->capacity);
+    store->used = NULL;
+    store->numSectors = 0;
+    store->usedCapacity = 0;
+    store->hint = STORE_SUPERBLOCKS;
+    store->pending = NULL;
+    store->numPending = 0;
+    store->pendingCapacity = 0;
+    store->mapSector = 0;
+    store->mapPages = 0;
+    store->sequence = 0;
+    store->dirty = false;
+    store->buffer = malloc((size_t)CHECKPOINT_BATCH_PAGES * PAGE_SIZE);
+    pthread_rwlock_init(&store->lock, NULL);
+    storeMarkSectors(store, 0, STORE_SUPERBLOCKS, true);
+    if (fLen == 0)
+    {
+        // An empty map, so that the file is known to be compressed from now on
+        storeWriteSuperblock(fd, store, 0, crc32c(NULL, 0));
+        return store;
+    }
+
+    uint8_t superblock[STORE_SECTOR_SIZE];
+    if (!storeReadSuperblock(fd, superblock))
+    {
+        fatalError(DB_ERROR_CORRUPT, "Compressed db file has no valid superblock. Corrupt file.");
+    }
+    uint32_t version = *storeField(superblock, STORE_VERSION_OFFSET);
+    if (version != STORE_VERSION)
+    {
+        fatalError(DB_ERROR_CORRUPT, "Compressed db file has version %u; expected version %u.",
+                   version, STORE_VERSION);
+    }
+    store->sequence = *storeField(superblock, STORE_SEQUENCE_OFFSET);
+    store->mapSector = *storeField(superblock, STORE_MAP_SECTOR_OFFSET);
+    store->mapPages = *storeField(superblock, STORE_NUM_PAGES_OFFSET);
+    uint32_t mapSectors = storeMapSectors(store->mapPages);
+    size_t mapLen = (size_t)mapSectors * STORE_SECTOR_SIZE;
+    uint8_t *map = calloc(1, mapLen > 0 ? mapLen : 1);
+    // A map cut short fails its checksum
+    if (mapLen > 0 && pread(fd, map, mapLen, (off_t)store->mapSector * STORE_SECTOR_SIZE) == -1)
+    {
+        fatalError(DB_ERROR_IO, "Error reading file: %d", errno);
+    }
+    if (crc32c(map, mapLen) != *storeField(superblock, STORE_MAP_CHECKSUM_OFFSET))
+    {
+        fatalError(DB_ERROR_CORRUPT, "Page map checksum mismatch. Corrupt file.");
+    }
+
+    if (store->mapPages > store->capacity)
+    {
+        store->capacity = store->mapPages;
+        store->extents = realloc(store->extents, sizeof(uint32_t) * store->capacity);
+    }
+    memcpy(store->extents, map, sizeof(uint32_t) * store->mapPages);
+    store->numPages = store->mapPages;
+    free(map);
+    if (mapSectors > 0)
+    {
+        storeMarkSectors(store, store->mapSector, mapSectors, true);
+    }
+    for (uint32_t i = 0; i < store->numPages; i++)
+    {
+        uint32_t extent = store->extents[i];
+        if (extent != 0)
+        {
+            storeMarkSectors(store, extentSector(extent), extentSectors(extent), true);
+        }
+    }
+    return store;
+}
+
+static void storeClose(PageStore *store, bool checkpointed)
+{
+    if (checkpointed)
+    {
+        pthread_rwlock_destroy(&store->lock);
+    }
+    free(store->extents);
+    free(store->used);
+    free(store->pending);
+    free(store->buffer);
+    free(store);
+}
+
+/**
+ * @brief pread() a page of the database file, decompressing it from a
+ * compressed one
+ */
+static ssize_t readFilePage(Pager *pager, uint32_t pageNum, void *page)
+{
+    if (pager->store != NULL)
+    {
+        return storeReadPage(pager, pageNum, page) ? (ssize_t)PAGE_SIZE : -1;
+    }
+    ssize_t bytesRead = pread(pager->fd, page, PAGE_SIZE, (off_t)pageNum * PAGE_SIZE);
+    countStat(STAT_BYTES_READ, bytesRead > 0 ? bytesRead : 0);
+    return bytesRead;
+}
+
+/**
+ * @brief make every write to the database file durable
+ */
+static void syncDbFile(Pager *pager)
+{
+    if (pager->store != NULL)
+    {
+        storeSync(pager);
+        return;
+    }
+    if (fsync(pager->fd) == -1)
+    {
+        fatalError(DB_ERROR_IO, "Error syncing db file: %d", errno);
+    }
+}
+
+/**
+ * @brief length of the database file; of its pages, for a compressed one
+ */
+static uint32_t dbFileLength(Pager *pager)
+{
+    if (pager->store != NULL)
+    {
+        return pager->store->numPages * PAGE_SIZE;
+    }
+    return lseek(pager->fd, 0, SEEK_END);
+}
+
+/**
+ * @brief running checksum over 32-bit word pairs, chained through sum
+ *
+ * len must be a multiple of 8.
+ */
+static void walChecksum(const void *data, uint32_t len, uint32_t *sum)
+{
+    const uint8_t *p = data;
+    uint32_t s1 = sum[0];
+    uint32_t s2 = sum[1];
+    for (uint32_t i = 0; i < len; i += 8)
+    {
+        uint32_t x1, x2;
+        memcpy(&x1, p + i, sizeof(x1));
+        memcpy(&x2, p + i + 4, sizeof(x2));
+        s1 += x1 + s2;
+        s2 += x2 + s1;
+    }
+    sum[0] = s1;
+    sum[1] = s2;
+}
+
+static uint32_t walIndexSlot(Wal *wal, uint32_t pageNum)
+{
+    return (pageNum * 2654435761u) & (wal->indexCapacity - 1);
+}
+
+static void walIndexClear(Wal *wal)
+{
+    for (uint32_t i = 0; i < wal->indexCapacity; i++)
+    {
+        wal->index[i].pageNum = INVALID_PAGE_NUM;
+    }
+    wal->indexCount = 0;
+}
+
+static void walIndexPut(Wal *wal, uint32_t pageNum, uint32_t frameNum);
+
+static void walIndexGrow(Wal *wal)
+{
+    WalIndexEntry *old = wal->index;
+    uint32_t oldCapacity = wal->indexCapacity;
+
+    wal->indexCapacity *= 2;
+    wal->index = malloc(sizeof(WalIndexEntry) * wal->indexCapacity);
+    walIndexClear(wal);
+    for (uint32_t i = 0; i < oldCapacity; i++)
+    {
+        if (old[i].pageNum != INVALID_PAGE_NUM)
+        {
+            walIndexPut(wal, old[i].pageNum, old[i].frameNum);
+        }
+    }
+    free(old);
+}
+
+static void walIndexPut(Wal *wal, uint32_t pageNum, uint32_t frameNum)
+{
+    // Linear probing; keep the load factor at or below 0.5
+    if ((wal->indexCount + 1) * 2 > wal->indexCapacity)
+    {
+        walIndexGrow(wal);
+    }
+    uint32_t slot = walIndexSlot(wal, pageNum);
+    while (wal->index[slot].pageNum != INVALID_PAGE_NUM &&
+           wal->index[slot].pageNum != pageNum)
+    {
+        slot = (slot + 1) & (wal->indexCapacity - 1);
+    }
+    if (wal->index[slot].pageNum == INVALID_PAGE_NUM)
+    {
+        wal->indexCount++;
+    }
+    wal->index[slot].pageNum = pageNum;
+    wal->index[slot].frameNum = frameNum;
+}
+
+/**
+ * @brief frame holding the newest logged copy of a page
+ * @return the frame number, or INVALID_FRAME_NUM if it was never logged
+ */
+static uint32_t walFind(Wal *wal, uint32_t pageNum)
+{
+    uint32_t slot = walIndexSlot(wal, pageNum);
+    while (wal->index[slot].pageNum != INVALID_PAGE_NUM)
+    {
+        if (wal->index[slot].pageNum == pageNum)
+        {
+            return wal->index[slot].frameNum;
+        }
+        slot = (slot + 1) & (wal->indexCapacity - 1);
+    }
+    return INVALID_FRAME_NUM;
+}
+
+/**
+ * @brief newest frame of a page below limit, following older versions
+ *
+ * Callers other than the writer hold indexLock.
+ */
+static uint32_t walFindBefore(Wal *wal, uint32_t pageNum, uint32_t limit)
+{
+    uint32_t frameNum = walFind(wal, pageNum);
+    while (frameNum != INVALID_FRAME_NUM && frameNum >= limit)
+    {
+        frameNum = wal->framePrev[frameNum];
+    }
+    return frameNum;
+}
+
+/**
+ * @brief record that frameNum is the newest copy of pageNum
+ *
+ * The frame it replaces stays reachable through framePrev, for readers
+ * whose snapshots predate it.
+ */
+static void walIndexAppend(Wal *wal, uint32_t pageNum, uint32_t frameNum)
+{
+    pthread_rwlock_wrlock(&wal->indexLock);
+    if (frameNum >= wal->framePrevCapacity)
+    {
+        wal->framePrevCapacity *= 2;
+        wal->framePrev = realloc(wal->framePrev, sizeof(uint32_t) * wal->framePrevCapacity);
+    }
+    wal->framePrev[frameNum] = walFind(wal, pageNum);
+    walIndexPut(wal, pageNum, frameNum);
+    pthread_rwlock_unlock(&wal->indexLock);
+}
+
+/**
+ * @brief take pageNum out of the index, closing up its probe run
+ */
+static void walIndexRemove(Wal *wal, uint32_t pageNum)
+{
+    uint32_t mask = wal->indexCapacity - 1;
+    uint32_t hole = walIndexSlot(wal, pageNum);
+    while (wal->index[hole].pageNum != pageNum)
+    {
+        if (wal->index[hole].pageNum == INVALID_PAGE_NUM)
+        {
+            return;
+        }
+        hole = (hole + 1) & mask;
+    }
+    // Move later entries of the run back into the hole, unless that would
+    // put one ahead of its home slot
+    for (uint32_t slot = (hole + 1) & mask; wal->index[slot].pageNum != INVALID_PAGE_NUM;
+         slot = (slot + 1) & mask)
+    {
+        uint32_t home = walIndexSlot(wal, wal->index[slot].pageNum);
+        if (((slot - home) & mask) >= ((slot - hole) & mask))
+        {
+            wal->index[hole] = wal->index[slot];
+            hole = slot;
+        }
+    }
+    wal->index[hole].pageNum = INVALID_PAGE_NUM;
+    wal->indexCount--;
+}
+
+/**
+ * @brief undo walIndexAppend() of the page's newest frame
+ * @param prevFrame that frame's framePrev entry
+ */
+static void walIndexRestore(Wal *wal, uint32_t pageNum, uint32_t prevFrame)
+{
+    if (prevFrame == INVALID_FRAME_NUM)
+    {
+        walIndexRemove(wal, pageNum);
+    }
+    else
+    {
+        walIndexPut(wal, pageNum, prevFrame);
+    }
+}
+
+static off_t walFrameOffset(uint32_t frameNum)
+{
+    return WAL_HEADER_SIZE + (off_t)frameNum * WAL_FRAME_SIZE;
+}
+
+static void walReadFrame(Wal *wal, uint32_t frameNum, void *page)
+{
+    // Positional, so concurrent readers do not share a file offset
+    ssize_t bytesRead = pread(wal->fd, page, PAGE_SIZE,
+                              walFrameOffset(frameNum) + WAL_FRAME_HEADER_SIZE);
+    if (bytesRead != PAGE_SIZE)
+    {
+        fatalError(DB_ERROR_IO, "Error reading WAL frame %u: %d", frameNum, errno);
+    }
+}
+
+/**
+ * @brief start an empty log with a new salt
+ *
+ * Frames left over from before the reset carry the old salt, so recovery
+ * stops at them even if the truncate never reaches the disk.
+ * @return false, changing nothing, while a snapshot may still read the log
+ */
+static bool walReset(Wal *wal)
+{
+    // Forget the frames first: snapshots taken from here on never read
+    // the log, so it can be truncated without the lock
+    pthread_mutex_lock(&wal->snapshotLock);
+    if (wal->snapshots != NULL)
+    {
+        pthread_mutex_unlock(&wal->snapshotLock);
+        return false;
+    }
+    wal->numFrames = 0;
+    wal->lastCommitFrame = 0;
+    wal->backfilled = 0;
+    pthread_rwlock_wrlock(&wal->indexLock);
+    walIndexClear(wal);
+    pthread_rwlock_unlock(&wal->indexLock);
+    pthread_mutex_unlock(&wal->snapshotLock);
+
+    wal->salt++;
+    uint8_t header[WAL_HEADER_SIZE];
+    uint32_t fields[4] = {WAL_MAGIC, WAL_VERSION, PAGE_SIZE, wal->salt};
+    memcpy(header, fields, sizeof(fields));
+    wal->checksum[0] = 0;
+    wal->checksum[1] = 0;
+    walChecksum(header, WAL_HEADER_CHECKSUM_OFFSET, wal->checksum);
+    memcpy(header + WAL_HEADER_CHECKSUM_OFFSET, wal->checksum,
+           sizeof(wal->checksum));
+    memcpy(wal->commitChecksum, wal->checksum, sizeof(wal->checksum));
+
+    if (pwrite(wal->fd, header, WAL_HEADER_SIZE, 0) != WAL_HEADER_SIZE ||
+        ftruncate(wal->fd, WAL_HEADER_SIZE) == -1)
+    {
+        fatalError(DB_ERROR_IO, "Error resetting WAL: %d", errno);
+    }
+    return true;
+}
+
+/**
+ * @brief let snapshots taken from now on see every frame appended so far
+ */
+static void walPublish(Wal *wal)
+{
+    pthread_mutex_lock(&wal->snapshotLock);
+    wal->lastCommitFrame = wal->numFrames;
+    pthread_mutex_unlock(&wal->snapshotLock);
+}
+
+/**
+ * @brief append one page image to the log
+ *
+ * The page's checksum is set first, so the image is ready to be copied
+ * into the database file as it is.
+ * @param dbSize database size in pages for a commit frame, 0 otherwise;
+ * a commit frame is shown to readers at once unless wal->transaction is set
+ */
+static void walAppendFrame(Wal *wal, uint32_t pageNum, void *page, uint32_t dbSize)
+{
+    pageSetChecksum(page);
+    uint8_t *frame = wal->frameBuffer;
+    memcpy(frame + WAL_FRAME_PAGE_NUM_OFFSET, &pageNum, sizeof(pageNum));
+    memcpy(frame + WAL_FRAME_DB_SIZE_OFFSET, &dbSize, sizeof(dbSize));
+    memcpy(frame + WAL_FRAME_TRANSACTION_OFFSET, &(wal->transaction),
+           sizeof(wal->transaction));
+    memcpy(frame + WAL_FRAME_SALT_OFFSET, &(wal->salt), sizeof(wal->salt));
+    memcpy(frame + WAL_FRAME_HEADER_SIZE, page, PAGE_SIZE);
+
+    // The checksum chains through every earlier frame since the reset
+    walChecksum(frame, WAL_FRAME_SALT_OFFSET, wal->checksum);
+    walChecksum(frame + WAL_FRAME_HEADER_SIZE, PAGE_SIZE, wal->checksum);
+    memcpy(frame + WAL_FRAME_CHECKSUM_OFFSET, wal->checksum,
+           sizeof(wal->checksum));
+
+    ssize_t bytesWritten = pwrite(wal->fd, frame, WAL_FRAME_SIZE,
+                                  walFrameOffset(wal->numFrames));
+    if (bytesWritten != WAL_FRAME_SIZE)
+    {
+        fatalError(DB_ERROR_IO, "Error writing WAL: %d", errno);
+    }
+    countStat(STAT_WAL_BYTES_WRITTEN, WAL_FRAME_SIZE);
+
+    walIndexAppend(wal, pageNum, wal->numFrames);
+    wal->numFrames++;
+    if (dbSize != 0)
+    {
+        memcpy(wal->commitChecksum, wal->checksum, sizeof(wal->checksum));
+        if (wal->transaction == 0)
+        {
+            walPublish(wal);
+        }
+    }
+}
+
+static uint64_t monotonicMillis(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+/**
+ * @brief fsync the log, making every commit made so far durable
+ *
+ * The writer and the flusher may both call this; either one's fsync covers
+ * the commits counted before it began.
+ * @return 0, or errno if the fsync failed
+ */
+static int walSyncCommits(Wal *wal)
+{
+    pthread_mutex_lock(&wal->syncLock);
+    uint64_t target = wal->commits;
+    bool synced = target == wal->syncedCommits;
+    uint64_t started = monotonicMillis();
+    pthread_mutex_unlock(&wal->syncLock);
+    if (synced)
+    {
+        return 0;
+    }
+    if (fsync(wal->fd) == -1)
+    {
+        return errno;
+    }
+    pthread_mutex_lock(&wal->syncLock);
+    if (target > wal->syncedCommits)
+    {
+        wal->syncedCommits = target;
+        // Any commit still unsynced came after the fsync began
+        wal->firstUnsyncedMillis = started;
+    }
+    pthread_mutex_unlock(&wal->syncLock);
+    return 0;
+}
+
+static void walSync(Wal *wal)
+{
+    pthread_mutex_lock(&wal->syncLock);
+    // The flusher's failure stands until the log is reopened: the kernel
+    // may have dropped the pages it could not write
+    int error = wal->syncError;
+    pthread_mutex_unlock(&wal->syncLock);
+    if (error == 0)
+    {
+        error = walSyncCommits(wal);
+    }
+    if (error != 0)
+    {
+        fatalError(DB_ERROR_IO, "Error syncing WAL: %d", error);
+    }
+}
+
+/**
+ * @brief group commit: share one fsync between consecutive commits
+ *
+ * A commit is on disk once its group is synced: at the groupCommit'th
+ * commit, when the flusher finds the group's oldest commit
+ * GROUP_COMMIT_DELAY_MS old, or at the next checkpoint, whichever comes
+ * first. So a burst of commits is durable within GROUP_COMMIT_DELAY_MS of
+ * its first even if no commit follows it.
+ */
+static void walCommitted(Wal *wal)
+{
+    pthread_mutex_lock(&wal->syncLock);
+    if (wal->commits == wal->syncedCommits)
+    {
+        wal->firstUnsyncedMillis = monotonicMillis();
+        pthread_cond_signal(&wal->syncWake);
+    }
+    wal->commits++;
+    bool full = wal->commits - wal->syncedCommits >= wal->groupCommit ||
+                wal->syncError != 0;
+    pthread_mutex_unlock(&wal->syncLock);
+
+    if (full)
+    {
+        walSync(wal);
+    }
+}
+
+/**
+ * @brief the flusher thread: sync each group of commits once its oldest is
+ * GROUP_COMMIT_DELAY_MS old
+ */
+static void *walFlusher(void *arg)
+{
+    Wal *wal = arg;
+    pthread_mutex_lock(&wal->syncLock);
+    while (!wal->closing)
+    {
+        if (wal->commits == wal->syncedCommits || wal->syncError != 0)
+        {
+            pthread_cond_wait(&wal->syncWake, &wal->syncLock);
+            continue;
+        }
+        uint64_t deadline = wal->firstUnsyncedMillis + GROUP_COMMIT_DELAY_MS;
+        if (monotonicMillis() < deadline)
+        {
+            struct timespec until = {deadline / 1000, deadline % 1000 * 1000000};
+            pthread_cond_timedwait(&wal->syncWake, &wal->syncLock, &until);
+            continue;
+        }
+        pthread_mutex_unlock(&wal->syncLock);
+        int error = walSyncCommits(wal);
+        pthread_mutex_lock(&wal->syncLock);
+        if (error != 0)
+        {
+            wal->syncError = error;
+        }
+    }
+    pthread_mutex_unlock(&wal->syncLock);
+    return NULL;
+}
+
+/**
+ * @brief copy committed frames of an existing log into the database file
+ * @return number of frames replayed
+ */
+static uint32_t walRecover(Wal *wal, Pager *pager)
+{
+    uint8_t header[WAL_HEADER_SIZE];
+    if (pread(wal->fd, header, WAL_HEADER_SIZE, 0) != WAL_HEADER_SIZE)
+    {
+        return 0;
+    }
+
+    uint32_t fields[4];
+    uint32_t expected[2] = {0, 0};
+    uint32_t stored[2];
+    memcpy(fields, header, sizeof(fields));
+    walChecksum(header, WAL_HEADER_CHECKSUM_OFFSET, expected);
+    memcpy(stored, header + WAL_HEADER_CHECKSUM_OFFSET, sizeof(stored));
+    if (fields[0] != WAL_MAGIC || fields[1] != WAL_VERSION ||
+        fields[2] != PAGE_SIZE || memcmp(expected, stored, sizeof(stored)) != 0)
+    {
+        return 0;
+    }
+    wal->salt = fields[3];
+
+    // Find the last commit frame; anything after it, or after the first
+    // frame that fails its checksum, was never committed. Nor was a commit
+    // across partitions that the commit record does not hold.
+    uint8_t *frame = wal->frameBuffer;
+    uint32_t sum[2] = {expected[0], expected[1]};
+    uint32_t lastCommitFrame = 0;
+    for (uint32_t frameNum = 0;; frameNum++)
+    {
+        if (pread(wal->fd, frame, WAL_FRAME_SIZE, walFrameOffset(frameNum)) != WAL_FRAME_SIZE)
+        {
+            break;
+        }
+        uint32_t salt, dbSize, transaction;
+        memcpy(&salt, frame + WAL_FRAME_SALT_OFFSET, sizeof(salt));
+        memcpy(&dbSize, frame + WAL_FRAME_DB_SIZE_OFFSET, sizeof(dbSize));
+        memcpy(&transaction, frame + WAL_FRAME_TRANSACTION_OFFSET, sizeof(transaction));
+        walChecksum(frame, WAL_FRAME_SALT_OFFSET, sum);
+        walChecksum(frame + WAL_FRAME_HEADER_SIZE, PAGE_SIZE, sum);
+        memcpy(stored, frame + WAL_FRAME_CHECKSUM_OFFSET, sizeof(stored));
+        if (salt != wal->salt || memcmp(sum, stored, sizeof(stored)) != 0)
+        {
+            break;
+        }
+        if (dbSize != 0 && transaction > wal->recordedTransaction)
+        {
+            break;
+        }
+        if (dbSize != 0)
+        {
+            lastCommitFrame = frameNum + 1;
+        }
+    }
+
+    // Later frames of the same page overwrite earlier ones
+    for (uint32_t frameNum = 0; frameNum < lastCommitFrame; frameNum++)
+    {
+        if (pread(wal->fd, frame, WAL_FRAME_SIZE, walFrameOffset(frameNum)) != WAL_FRAME_SIZE)
+        {
+            fatalError(DB_ERROR_IO, "Error reading WAL: %d", errno);
+        }
+        uint32_t pageNum;
+        memcpy(&pageNum, frame + WAL_FRAME_PAGE_NUM_OFFSET, sizeof(pageNum));
+        void *page = frame + WAL_FRAME_HEADER_SIZE;
+        writePages(pager, &pageNum, &page, 1);
+    }
+    if (lastCommitFrame > 0)
+    {
+        syncDbFile(pager);
+    }
+    return lastCommitFrame;
+}
+
+/**
+ * @brief open the write-ahead log next to the database, replaying it first
+ * @param dbFn database filename; the log is <dbFn>-wal
+ * @param pager has its file and ring open, and no frames in use yet
+ * @param recordedTransaction the newest commit across partitions that the
+ * commit record holds; later ones are not replayed
+ */
+static Wal *walOpen(const char *dbFn, Pager *pager, uint32_t groupCommit,
+                    uint32_t recordedTransaction)
+{
+    Wal *wal = malloc(sizeof(Wal));
+    size_t fnLen = strlen(dbFn) + sizeof(WAL_SUFFIX);
+    wal->fn = malloc(fnLen);
+    snprintf(wal->fn, fnLen, "%s%s", dbFn, WAL_SUFFIX);
+
+    wal->fd = open(wal->fn, O_RDWR | O_CREAT, S_IWUSR | S_IRUSR);
+    if (wal->fd == -1)
+    {
+        fatalError(DB_ERROR_IO, "Unable to open WAL file");
+    }
+
+    wal->frameBuffer = malloc(WAL_FRAME_SIZE);
+    wal->indexCapacity = 1024;
+    wal->index = malloc(sizeof(WalIndexEntry) * wal->indexCapacity);
+    wal->framePrevCapacity = 1024;
+    wal->framePrev = malloc(sizeof(uint32_t) * wal->framePrevCapacity);
+    wal->groupCommit = groupCommit > 0 ? groupCommit : 1;
+    wal->salt = 0;
+    wal->snapshots = NULL;
+    wal->transaction = 0;
+    wal->recordedTransaction = recordedTransaction;
+    wal->flusherRunning = false;
+    wal->closing = false;
+    wal->commits = 0;
+    wal->syncedCommits = 0;
+    wal->syncError = 0;
+    pthread_rwlock_init(&wal->indexLock, NULL);
+    pthread_mutex_init(&wal->snapshotLock, NULL);
+    pthread_mutex_init(&wal->syncLock, NULL);
+    // The flusher's deadlines are on the clock monotonicMillis() reads
+    pthread_condattr_t syncWakeAttr;
+    pthread_condattr_init(&syncWakeAttr);
+    pthread_condattr_setclock(&syncWakeAttr, CLOCK_MONOTONIC);
+    pthread_cond_init(&wal->syncWake, &syncWakeAttr);
+    pthread_condattr_destroy(&syncWakeAttr);
+
+    walRecover(wal, pager);
+    walReset(wal);
+    if (wal->groupCommit > 1)
+    {
+        wal->flusherRunning = pthread_create(&wal->flusher, NULL, walFlusher, wal) == 0;
+        if (!wal->flusherRunning)
+        {
+            // Without it no group would be synced on time; sync each commit
+            wal->groupCommit = 1;
+        }
+    }
+    return wal;
+}
+
+/**
+ * @brief close the log
+ * @param checkpointed true if every frame is in the database file, so the
+ * log can be removed; otherwise it is kept for recovery at the next open
+ */
+static void walClose(Wal *wal, bool checkpointed)
+{
+    if (wal->flusherRunning)
+    {
+        pthread_mutex_lock(&wal->syncLock);
+        wal->closing = true;
+        pthread_cond_signal(&wal->syncWake);
+        pthread_mutex_unlock(&wal->syncLock);
+        pthread_join(wal->flusher, NULL);
+    }
+    close(wal->fd);
+    if (checkpointed)
+    {
+        unlink(wal->fn);
+        pthread_rwlock_destroy(&wal->indexLock);
+        pthread_mutex_destroy(&wal->snapshotLock);
+        pthread_mutex_destroy(&wal->syncLock);
+        pthread_cond_destroy(&wal->syncWake);
+    }
+    free(wal->fn);
+    free(wal->frameBuffer);
+    free(wal->index);
+    free(wal->framePrev);
+    free(wal);
+}
+
+/**
+ * @brief start reading the newest committed state through snapshot
+ *
+ * The snapshot's buffers must already be allocated.
+ */
+static void snapshotOpen(Snapshot *snapshot, Pager *pager)
+{
+    Wal *wal = pager->wal;
+    snapshot->pager = pager;
+    snapshot->freePages = (1u << SNAPSHOT_PAGES) - 1;
+    snapshot->prev = NULL;
+    pthread_mutex_lock(&wal->snapshotLock);
+    snapshot->walFrames = wal->lastCommitFrame;
+    snapshot->next = wal->snapshots;
+    if (wal->snapshots != NULL)
+    {
+        wal->snapshots->prev = snapshot;
+    }
+    wal->snapshots = snapshot;
+    pthread_mutex_unlock(&wal->snapshotLock);
+    snapshot->open = true;
+}
+
+static void snapshotClose(Snapshot *snapshot)
+{
+    if (!snapshot->open)
+    {
+        return;
+    }
+    Wal *wal = snapshot->pager->wal;
+    pthread_mutex_lock(&wal->snapshotLock);
+    if (snapshot->prev != NULL)
+    {
+        snapshot->prev->next = snapshot->next;
+    }
+    else
+    {
+        wal->snapshots = snapshot->next;
+    }
+    if (snapshot->next != NULL)
+    {
+        snapshot->next->prev = snapshot->prev;
+    }
+    pthread_mutex_unlock(&wal->snapshotLock);
+    snapshot->open = false;
+}
+
+/**
+ * @brief frames no open snapshot can see past; the caller holds snapshotLock
+ *
+ * A checkpoint may copy frames below this into the database file: every
+ * reader gets the same page from the file as it would from the log.
+ */
+static uint32_t walOldestSnapshot(Wal *wal)
+{
+    uint32_t oldest = wal->lastCommitFrame;
+    for (Snapshot *snapshot = wal->snapshots; snapshot != NULL; snapshot = snapshot->next)
+    {
+        if (snapshot->walFrames < oldest)
+        {
+            oldest = snapshot->walFrames;
+        }
+    }
+    return oldest;
+}
+
+/**
+ * @brief a page as of the snapshot; pair with snapshotReleasePage()
+ *
+ * Pages the log has no visible copy of come from the file mapping when
+ * there is one, and are otherwise read into one of the snapshot's buffers.
+ */
+static void *snapshotReadPage(Snapshot *snapshot, uint32_t pageNum)
+{
+    Pager *pager = snapshot->pager;
+    Wal *wal = pager->wal;
+    pthread_rwlock_rdlock(&wal->indexLock);
+    uint32_t frameNum = walFindBefore(wal, pageNum, snapshot->walFrames);
+    pthread_rwlock_unlock(&wal->indexLock);
+    if (frameNum == INVALID_FRAME_NUM && (size_t)pageNum * PAGE_SIZE < pager->mapLen)
+    {
+        return mappedPage(pager, pageNum);
+    }
+
+    if (snapshot->freePages == 0)
+    {
+        fatalError(DB_ERROR_INTERNAL, "Snapshot holds more than %u pages.", SNAPSHOT_PAGES);
+    }
+    uint32_t slot = __builtin_ctz(snapshot->freePages);
+    snapshot->freePages &= ~(1u << slot);
+    void *page = snapshot->pages + (size_t)slot * PAGE_SIZE;
+    if (frameNum != INVALID_FRAME_NUM)
+    {
+        walReadFrame(wal, frameNum, page);
+        return page;
+    }
+    ssize_t bytesRead = readFilePage(pager, pageNum, page);
+    if (bytesRead != PAGE_SIZE)
+    {
+        fatalError(DB_ERROR_IO, "Error reading file: %d", bytesRead == -1 ? errno : 0);
+    }
+    checkPage(pager, pageNum, page);
+    return page;
+}
+
+static void snapshotReleasePage(Snapshot *snapshot, void *page)
+{
+    uintptr_t offset = (uintptr_t)page - (uintptr_t)snapshot->pages;
+    if (offset < (uintptr_t)SNAPSHOT_PAGES * PAGE_SIZE)
+    {
+        snapshot->freePages |= 1u << (offset / PAGE_SIZE);
+    }
+}
+
+/**
+ * @brief set up an io_uring with room for entries requests in flight
+ * @return NULL if the kernel does not offer io_uring, or forbids it
+ */
+static IoRing *ioRingOpen(uint32_t entries)
+{
+#ifdef HAVE_IO_URING
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    int fd = syscall(__NR_io_uring_setup, entries, &params);
+    if (fd == -1)
+    {
+        return NULL;
+    }
+    // Kernels before 5.4 map the two rings separately; not worth supporting
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP))
+    {
+        close(fd);
+        return NULL;
+    }
+
+    IoRing *ring = malloc(sizeof(IoRing));
+    ring->fd = fd;
+    ring->entries = params.sq_entries;
+    ring->inFlight = 0;
+    ring->unsubmitted = 0;
+    size_t sqLen = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+    size_t cqLen = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->ringsLen = sqLen > cqLen ? sqLen : cqLen;
+    ring->sqesLen = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->rings = mmap(NULL, ring->ringsLen, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    ring->sqes = mmap(NULL, ring->sqesLen, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (ring->rings == MAP_FAILED || ring->sqes == MAP_FAILED)
+    {
+        if (ring->rings != MAP_FAILED)
+        {
+            munmap(ring->rings, ring->ringsLen);
+        }
+        close(fd);
+        free(ring);
+        return NULL;
+    }
+
+    ring->sqHead = ring->rings + params.sq_off.head;
+    ring->sqTail = ring->rings + params.sq_off.tail;
+    ring->sqMask = *(uint32_t *)(ring->rings + params.sq_off.ring_mask);
+    ring->sqArray = ring->rings + params.sq_off.array;
+    ring->cqHead = ring->rings + params.cq_off.head;
+    ring->cqTail = ring->rings + params.cq_off.tail;
+    ring->cqMask = *(uint32_t *)(ring->rings + params.cq_off.ring_mask);
+    ring->cqes = ring->rings + params.cq_off.cqes;
+    return ring;
+#else
+    (void)entries;
+    return NULL;
+#endif
+}
+
+static void ioRingClose(IoRing *ring)
+{
+    munmap(ring->sqes, ring->sqesLen);
+    munmap(ring->rings, ring->ringsLen);
+    close(ring->fd);
+    free(ring);
+}
+
+static bool ioRingFull(IoRing *ring)
+{
+    // Never more in flight than the completion ring is sure to hold
+    return ring->inFlight == ring->entries;
+}
+
+/**
+ * @brief queue a request; ioRingSubmit() starts it
+ * @param addr buffer for IO_READ, iovec array for IO_WRITEV
+ * @param len bytes for IO_READ, iovec count for IO_WRITEV
+ * @return false if the ring is full
+ */
+static bool ioRingQueue(IoRing *ring, IoOp op, int fd, void *addr, uint32_t len,
+                        off_t offset, uint64_t userData)
+{
+#ifdef HAVE_IO_URING
+    if (ioRingFull(ring))
+    {
+        return false;
+    }
+    // Only this side moves the tail; the kernel moves the head
+    uint32_t tail = *ring->sqTail;
+    uint32_t index = tail & ring->sqMask;
+    struct io_uring_sqe *sqe = &((struct io_uring_sqe *)ring->sqes)[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = op == IO_WRITEV ? IORING_OP_WRITEV : IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->addr = (uintptr_t)addr;
+    sqe->len = len;
+    sqe->off = offset;
+    sqe->user_data = userData;
+    ring->sqArray[index] = index;
+    __atomic_store_n(ring->sqTail, tail + 1, __ATOMIC_RELEASE);
+    ring->inFlight++;
+    ring->unsubmitted++;
+    return true;
+#else
+    (void)ring, (void)op, (void)fd, (void)addr, (void)len, (void)offset, (void)userData;
+    return false;
+#endif
+}
+
+/**
+ * @brief hand queued requests to the kernel
+ * @param minComplete block until this many completions are ready
+ * @return false, with errno set, if io_uring_enter() failed
+ */
+static bool ioRingSubmit(IoRing *ring, uint32_t minComplete)
+{
+#ifdef HAVE_IO_URING
+    uint32_t flags = minComplete > 0 ? IORING_ENTER_GETEVENTS : 0;
+    while (true)
+    {
+        int submitted = syscall(__NR_io_uring_enter, ring->fd, ring->unsubmitted,
+                                minComplete, flags, NULL, 0);
+        if (submitted >= 0)
+        {
+            ring->unsubmitted -= submitted;
+            return true;
+        }
+        if (errno != EINTR)
+        {
+            return false;
+        }
+    }
+#else
+    (void)ring, (void)minComplete;
+    return true;
+#endif
+}
+
+/**
+ * @brief take the next completion, if one is ready
+ * @param result bytes transferred, or a negated errno
+ */
+static bool ioRingPop(IoRing *ring, uint64_t *userData, int32_t *result)
+{
+#ifdef HAVE_IO_URING
+    uint32_t head = *ring->cqHead;
+    if (head == __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE))
+    {
+        return false;
+    }
+    struct io_uring_cqe *cqe = &((struct io_uring_cqe *)ring->cqes)[head & ring->cqMask];
+    *userData = cqe->user_data;
+    *result = cqe->res;
+    __atomic_store_n(ring->cqHead, head + 1, __ATOMIC_RELEASE);
+    ring->inFlight--;
+    return true;
+#else
+    (void)ring, (void)userData, (void)result;
+    return false;
+#endif
+}
+
+/**
+ * @brief cover the whole database file with checked flags, and map it for
+ * readPage() if enabled
+ *
+ * Called again whenever a checkpoint changes the file length. Snapshot
+ * readers use the flags and the mapping unlocked, so while any is open
+ * the old ones stay; the pages past the mapping's end are read with pread
+ * instead.
+ */
+static void remapPager(Pager *pager)
+{
+    pthread_mutex_lock(&pager->wal->snapshotLock);
+    if (pager->wal->snapshots != NULL)
+    {
+        pthread_mutex_unlock(&pager->wal->snapshotLock);
+        return;
+    }
+    // Nothing is checked here; pages are checked as they are first read
+    uint32_t numChecked = pager->fLen / PAGE_SIZE;
+    if (numChecked > pager->numChecked)
+    {
+        pager->checked = realloc(pager->checked, sizeof(atomic_bool) * numChecked);
+        for (uint32_t i = pager->numChecked; i < numChecked; i++)
+        {
+            atomic_init(&pager->checked[i], false);
+        }
+        pager->numChecked = numChecked;
+    }
+    if (!pager->useMmap)
+    {
+        pthread_mutex_unlock(&pager->wal->snapshotLock);
+        return;
+    }
+    if (pager->map != NULL)
+    {
+        munmap(pager->map, pager->mapLen);
+        pager->map = NULL;
+        pager->mapLen = 0;
+    }
+
+    size_t mapLen = (pager->fLen / PAGE_SIZE) * (size_t)PAGE_SIZE;
+    void *map = mapLen > 0 ? mmap(NULL, mapLen, PROT_READ, MAP_SHARED, pager->fd, 0) : NULL;
+    if (map != MAP_FAILED)
+    {
+        pager->map = map;
+        pager->mapLen = map != NULL ? mapLen : 0;
+    }
+    pthread_mutex_unlock(&pager->wal->snapshotLock);
+    if (map == MAP_FAILED)
+    {
+        fatalError(DB_ERROR_IO, "Error mapping db file: %d", errno);
+    }
+}
+
+/**
+ * @brief a page straight from the file mapping, checked the first time
+ * any thread reads it
+ */
+static void *mappedPage(Pager *pager, uint32_t pageNum)
+{
+    void *page = pager->map + (size_t)pageNum * PAGE_SIZE;
+    checkPage(pager, pageNum, page);
+    return page;
+}
+
+static Pager *openPager(const char *fn, const PagerOptions *options,
+                        uint32_t recordedTransaction)
+{
+    int fd = open(fn,
+                  O_RDWR |     // Read/Write mode
+                      O_CREAT, // Create file if it does not exist
+                  S_IWUSR |    // User write permission
+                      S_IRUSR  // User read permission
+    );
+    if (fd == -1)
+    {
+        fatalError(DB_ERROR_IO, "Unable to open file");
+    }
+
+    Pager *pager = malloc(sizeof(Pager));
+    pager->fd = fd;
+    pager->store = storeOpen(fd, options->compress);
+    pager->ring = ioRingOpen(IO_RING_ENTRIES);
+    pthread_mutex_init(&pager->ioLock, NULL);
+    pager->numPrefetching = 0;
+    pager->writesInFlight = 0;
+    pager->writeError = 0;
+    pager->inTransaction = false;
+    pager->transactionNumPages = 0;
+
+    // Replay anything committed before an unclean shutdown
+    pager->wal = walOpen(fn, pager, options->groupCommit, recordedTransaction);
+    uint32_t fLen = dbFileLength(pager);
+    pager->fLen = fLen;
+    pager->numPages = fLen / PAGE_SIZE;
+    // We might save a partial page at the end of the file
+    if (fLen % PAGE_SIZE)
+    {
+        pager->numPages++;
+    }
+
+    uint32_t numFrames = options->numFrames;
+    if (numFrames < MIN_POOL_FRAMES)
+    {
+        numFrames = MIN_POOL_FRAMES;
+    }
+    pager->numFrames = numFrames;
+    pager->frames = malloc(sizeof(Frame) * numFrames);
+    // Frame pages come from one mapping made up front, plus one scratch
+    // page: page-aligned, as O_DIRECT needs, and never touched by malloc
+    pager->arenaLen = (size_t)(numFrames + 1) * PAGE_SIZE;
+    pager->arena = mmap(NULL, pager->arenaLen, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (pager->arena == MAP_FAILED)
+    {
+        fatalError(DB_ERROR_FULL, "Unable to allocate %u buffer pool frames.", numFrames);
+    }
+#ifdef MADV_HUGEPAGE
+    // Large pools are worth backing with transparent huge pages
+    madvise(pager->arena, pager->arenaLen, MADV_HUGEPAGE);
+#endif
+    pager->scratch = pager->arena + (size_t)numFrames * PAGE_SIZE;
+    for (uint32_t i = 0; i < numFrames; i++)
+    {
+        pager->frames[i].pageNum = INVALID_PAGE_NUM;
+        pager->frames[i].pinCount = 0;
+        pager->frames[i].dirty = false;
+        pager->frames[i].referenced = false;
+        pager->frames[i].next = -1;
+        pager->frames[i].loading = false;
+        pager->frames[i].prefetched = false;
+        pager->frames[i].verify = false;
+        pager->frames[i].data = pager->arena + (size_t)i * PAGE_SIZE;
+    }
+
+    // Keep the page table load factor at or below 0.5
+    pager->numBuckets = 1;
+    while (pager->numBuckets < numFrames * 2)
+    {
+        pager->numBuckets <<= 1;
+    }
+    pager->buckets = malloc(sizeof(int32_t) * pager->numBuckets);
+    for (uint32_t i = 0; i < pager->numBuckets; i++)
+    {
+        pager->buckets[i] = -1;
+    }
+    pager->clockHand = 0;
+
+    // A compressed file's pages cannot be read in place
+    pager->useMmap = options->useMmap && pager->store == NULL;
+    pager->map = NULL;
+    pager->mapLen = 0;
+    pager->checked = NULL;
+    pager->numChecked = 0;
+    remapPager(pager);
+    pthread_mutex_init(&pager->latch, NULL);
+    pthread_cond_init(&pager->loaded, NULL);
+    return pager;
+}
+
+static uint32_t pageTableBucket(Pager *pager, uint32_t pageNum)
+{
+    // Knuth's multiplicative hash spreads sequential page numbers
+    return (pageNum * 2654435761u) & (pager->numBuckets - 1);
+}
+
+static Frame *pageTableLookup(Pager *pager, uint32_t pageNum)
+{
+    int32_t i = pager->buckets[pageTableBucket(pager, pageNum)];
+    while (i != -1)
+    {
+        if (pager->frames[i].pageNum == pageNum)
+        {
+            return &pager->frames[i];
+        }
+        i = pager->frames[i].next;
+    }
+    return NULL;
+}
+
+static void pageTableInsert(Pager *pager, Frame *frame)
+{
+    uint32_t bucket = pageTableBucket(pager, frame->pageNum);
+    frame->next = pager->buckets[bucket];
+    pager->buckets[bucket] = frame - pager->frames;
+}
+
+static void pageTableRemove(Pager *pager, Frame *frame)
+{
+    int32_t *link = &pager->buckets[pageTableBucket(pager, frame->pageNum)];
+    int32_t target = frame - pager->frames;
+    while (*link != -1)
+    {
+        if (*link == target)
+        {
+            *link = frame->next;
+            frame->next = -1;
+            return;
+        }
+        link = &pager->frames[*link].next;
+    }
+}
+
+/**
+ * @brief pick a frame for a new page using the CLOCK policy
+ *
+ * Free frames are taken first. A dirty victim is spilled to the WAL
+ * before its frame is reused.
+ * @return NULL if every frame is pinned
+ */
+static Frame *evictFrame(Pager *pager)
+{
+    // Two sweeps: the first may do nothing but clear reference bits
+    for (uint32_t scanned = 0; scanned < pager->numFrames * 2; scanned++)
+    {
+        Frame *frame = &pager->frames[pager->clockHand];
+        pager->clockHand = (pager->clockHand + 1) % pager->numFrames;
+
+        if (frame->pageNum == INVALID_PAGE_NUM)
+        {
+            return frame;
+        }
+        if (frame->pinCount > 0)
+        {
+            continue;
+        }
+        if (frame->referenced)
+        {
+            frame->referenced = false;
+            continue;
+        }
+
+        if (frame->dirty)
+        {
+            // Spill to the log; the database file only changes at
+            // checkpoints. Recovery ignores it unless a commit follows.
+            walAppendFrame(pager->wal, frame->pageNum, frame->data, 0);
+            frame->dirty = false;
+        }
+        pageTableRemove(pager, frame);
+        frame->pageNum = INVALID_PAGE_NUM;
+        countStat(STAT_EVICTIONS, 1);
+        return frame;
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief check a frame's checksum the first time it is used after being
+ * read from the database file; the caller holds the latch and a pin
+ *
+ * On a mismatch the pin is dropped, the latch released and the error
+ * raised. The frame stays unchecked, so later uses fail the same way.
+ */
+static void frameVerify(Pager *pager, Frame *frame)
+{
+    if (!frame->verify)
+    {
+        return;
+    }
+    if (!pageChecked(pager, frame->pageNum) && !pageChecksumOk(frame->data))
+    {
+        uint32_t pageNum = frame->pageNum;
+        frame->pinCount--;
+        pthread_mutex_unlock(&pager->latch);
+        fatalError(DB_ERROR_CORRUPT, "Checksum mismatch on page %u. Corrupt file.", pageNum);
+    }
+    setPageChecked(pager, frame->pageNum);
+    frame->verify = false;
+}
+
+/**
+ * @brief fetch a page into the buffer pool and pin it
+ *
+ * Every call must be paired with unpinPage() once the caller is done with
+ * the returned memory.
+ */
+static void *getPage(Pager *pager, uint32_t pageNum)
+{
+    if (pageNum == INVALID_PAGE_NUM)
+    {
+        fatalError(DB_ERROR_CORRUPT, "Tried to fetch page number out of bounds. %u", pageNum);
+    }
+
+    pthread_mutex_lock(&pager->latch);
+    Frame *frame = pageTableLookup(pager, pageNum);
+    if (frame != NULL)
+    {
+        // Pin first so the frame cannot be reused while we wait on it
+        frame->pinCount++;
+        frame->referenced = true;
+        while (frame->loading)
+        {
+            if (frame->prefetched)
+            {
+                // Nobody else may be waiting on the ring; reap it ourselves
+                pthread_mutex_unlock(&pager->latch);
+                pagerReap(pager, true);
+                pthread_mutex_lock(&pager->latch);
+                continue;
+            }
+            pthread_cond_wait(&pager->loaded, &pager->latch);
+        }
+        frameVerify(pager, frame);
+        pthread_mutex_unlock(&pager->latch);
+        countStat(STAT_PAGE_HITS, 1);
+        return frame->data;
+    }
+
+    countStat(STAT_PAGE_MISSES, 1);
+    // Cache miss. Claim a frame, then load it without holding the latch;
+    // other threads asking for the page wait for the loading flag.
+    frame = evictFrame(pager);
+    if (frame == NULL)
+    {
+        // Errors are never raised with the latch held
+        pthread_mutex_unlock(&pager->latch);
+        fatalError(DB_ERROR_FULL, "Buffer pool exhausted: all %u frames are pinned.",
+                   pager->numFrames);
+    }
+    frame->pageNum = pageNum;
+    frame->dirty = false;
+    frame->loading = true;
+    frame->verify = false;
+    frame->pinCount++;
+    frame->referenced = true;
+    pageTableInsert(pager, frame);
+    uint32_t walFrame = walFind(pager->wal, pageNum);
+    bool inFile = pageNum < pager->numPages;
+    if (!inFile)
+    {
+        pager->numPages = pageNum + 1;
+    }
+    pthread_mutex_unlock(&pager->latch);
+
+    memset(frame->data, 0, PAGE_SIZE);
+    bool fromFile = false;
+    if (walFrame != INVALID_FRAME_NUM)
+    {
+        walReadFrame(pager->wal, walFrame, frame->data);
+    }
+    else if ((size_t)pageNum * PAGE_SIZE < pager->mapLen)
+    {
+        memcpy(frame->data, pager->map + (size_t)pageNum * PAGE_SIZE, PAGE_SIZE);
+        fromFile = true;
+    }
+    else if (inFile)
+    {
+        fromFile = true;
+        ssize_t bytesRead = readFilePage(pager, pageNum, frame->data);
+        if (bytesRead == -1)
+        {
+            int error = errno;
+            // Wake anyone waiting on the frame before giving up
+            pthread_mutex_lock(&pager->latch);
+            frame->loading = false;
+            pthread_cond_broadcast(&pager->loaded);
+            pthread_mutex_unlock(&pager->latch);
+            fatalError(DB_ERROR_IO, "Error reading file: %d", error);
+        }
+    }
+
+    pthread_mutex_lock(&pager->latch);
+    frame->loading = false;
+    frame->verify = fromFile;
+    pthread_cond_broadcast(&pager->loaded);
+    frameVerify(pager, frame);
+    pthread_mutex_unlock(&pager->latch);
+    return frame->data;
+}
+
+/**
+ * @brief fetch a page for reading only
+ *
+ * With a file mapping, a page that has not changed since the last
+ * checkpoint comes straight from the mapping, with no copy and no frame.
+ * On a thread reading through a snapshot, the page is as of the snapshot
+ * and the buffer pool is not used. The memory must not be written. Pair
+ * with releasePage().
+ */
+static void *readPage(Pager *pager, uint32_t pageNum)
+{
+    if (readSnapshot != NULL)
+    {
+        return snapshotReadPage(readSnapshot, pageNum);
+    }
+    if ((size_t)pageNum * PAGE_SIZE < pager->mapLen)
+    {
+        pthread_mutex_lock(&pager->latch);
+        bool mapped = pageTableLookup(pager, pageNum) == NULL &&
+                      walFind(pager->wal, pageNum) == INVALID_FRAME_NUM;
+        pthread_mutex_unlock(&pager->latch);
+        if (mapped)
+        {
+            return mappedPage(pager, pageNum);
+        }
+    }
+    return getPage(pager, pageNum);
+}
+
+static void releasePage(Pager *pager, uint32_t pageNum, void *page)
+{
+    uintptr_t address = (uintptr_t)page;
+    uintptr_t mapStart = (uintptr_t)pager->map;
+    if (address >= mapStart && address < mapStart + pager->mapLen)
+    {
+        return;
+    }
+    if (readSnapshot != NULL)
+    {
+        snapshotReleasePage(readSnapshot, page);
+        return;
+    }
+    unpinPage(pager, pageNum, false);
+}
+
+/**
+ * @brief release a reference taken by getPage()
+ * @param dirty true if the caller modified the page
+ */
+static void unpinPage(Pager *pager, uint32_t pageNum, bool dirty)
+{
+    pthread_mutex_lock(&pager->latch);
+    Frame *frame = pageTableLookup(pager, pageNum);
+    if (frame == NULL || frame->pinCount == 0)
+    {
+        pthread_mutex_unlock(&pager->latch);
+        fatalError(DB_ERROR_INTERNAL, "Tried to unpin page %u that is not pinned", pageNum);
+    }
+    frame->pinCount--;
+    frame->dirty |= dirty;
+    pthread_mutex_unlock(&pager->latch);
+}
+
+/**
+ * @brief handle every ready completion; the caller holds ioLock
+ *
+ * A prefetched frame is released to getPage() callers waiting on it. A
+ * failed prefetch read is retried synchronously, so that its error is
+ * reported like any other miss.
+ * @return errno of a read that failed twice, or 0
+ */
+static int pagerReapLocked(Pager *pager)
+{
+    int readError = 0;
+    uint64_t userData;
+    int32_t result;
+    while (ioRingPop(pager->ring, &userData, &result))
+    {
+        if (userData & IO_WRITE_TAG)
+        {
+            pager->writesInFlight--;
+            uint64_t runLen = (userData & ~IO_WRITE_TAG) * PAGE_SIZE;
+            if (result != (int64_t)runLen && pager->writeError == 0)
+            {
+                pager->writeError = result < 0 ? -result : EIO;
+            }
+            countStat(STAT_BYTES_WRITTEN, result > 0 ? result : 0);
+            continue;
+        }
+
+        Frame *frame = &pager->frames[userData];
+        if (result < 0)
+        {
+            off_t offset = (off_t)frame->pageNum * PAGE_SIZE;
+            result = pread(pager->fd, frame->data, PAGE_SIZE, offset);
+            if (result == -1)
+            {
+                readError = errno;
+            }
+        }
+        countStat(STAT_BYTES_READ, result > 0 ? result : 0);
+        pthread_mutex_lock(&pager->latch);
+        frame->loading = false;
+        frame->prefetched = false;
+        frame->pinCount--;
+        pager->numPrefetching--;
+        pthread_cond_broadcast(&pager->loaded);
+        pthread_mutex_unlock(&pager->latch);
+    }
+    return readError;
+}
+
+/**
+ * @brief handle finished ring requests
+ * @param wait block for one to finish if none has
+ */
+static void pagerReap(Pager *pager, bool wait)
+{
+    pthread_mutex_lock(&pager->ioLock);
+    bool ok = true;
+    if (wait && pager->ring->inFlight > 0)
+    {
+        ok = ioRingSubmit(pager->ring, 1);
+    }
+    int error = ok ? 0 : errno;
+    int readError = pagerReapLocked(pager);
+    pthread_mutex_unlock(&pager->ioLock);
+    if (error != 0)
+    {
+        fatalError(DB_ERROR_IO, "Error waiting for I/O: %d", error);
+    }
+    if (readError != 0)
+    {
+        fatalError(DB_ERROR_IO, "Error reading file: %d", readError);
+    }
+}
+
+/**
+ * @brief start reading pages that will be needed soon
+ *
+ * Each page gets a frame, marked loading, and a read on the ring; a
+ * getPage() for it waits for that read instead of issuing its own. Pages
+ * that are resident, logged, mapped or not yet in the file are skipped, and
+ * at most a quarter of the pool is ever waiting on prefetches. Without a
+ * ring, or for a snapshot reader, which never reads from the pool, the
+ * kernel is asked to read the pages into its own cache; likewise for a
+ * compressed file, whose extents may be reused once the map lock is let go.
+ */
+static void prefetchPages(Pager *pager, const uint32_t *pageNums, uint32_t count)
+{
+    if (pager->store != NULL)
+    {
+        storeAdvise(pager, pageNums, count);
+        return;
+    }
+    if (pager->ring == NULL || readSnapshot != NULL)
+    {
+        for (uint32_t i = 0; i < count; i++)
+        {
+            uint32_t run = 1;
+            while (i + run < count && pageNums[i + run] == pageNums[i] + run)
+            {
+                run++;
+            }
+            posix_fadvise(pager->fd, (off_t)pageNums[i] * PAGE_SIZE,
+                          (off_t)run * PAGE_SIZE, POSIX_FADV_WILLNEED);
+            i += run - 1;
+        }
+        return;
+    }
+    pthread_mutex_lock(&pager->ioLock);
+    for (uint32_t i = 0; i < count && !ioRingFull(pager->ring); i++)
+    {
+        uint32_t pageNum = pageNums[i];
+        off_t offset = (off_t)pageNum * PAGE_SIZE;
+        if ((size_t)offset < pager->mapLen || offset >= (off_t)pager->fLen)
+        {
+            continue;
+        }
+
+        pthread_mutex_lock(&pager->latch);
+        if (pager->numPrefetching >= pager->numFrames / 4)
+        {
+            pthread_mutex_unlock(&pager->latch);
+            break;
+        }
+        if (pageTableLookup(pager, pageNum) != NULL ||
+            walFind(pager->wal, pageNum) != INVALID_FRAME_NUM)
+        {
+            pthread_mutex_unlock(&pager->latch);
+            continue;
+        }
+        Frame *frame = evictFrame(pager);
+        if (frame == NULL)
+        {
+            pthread_mutex_unlock(&pager->latch);
+            break;
+        }
+        frame->pageNum = pageNum;
+        frame->dirty = false;
+        frame->loading = true;
+        frame->prefetched = true;
+        frame->verify = true;
+        frame->pinCount = 1; // held by the read until it is reaped
+        frame->referenced = true;
+        pageTableInsert(pager, frame);
+        pager->numPrefetching++;
+        pthread_mutex_unlock(&pager->latch);
+
+        // A partial last page reads short; the rest stays zero
+        memset(frame->data, 0, PAGE_SIZE);
+        ioRingQueue(pager->ring, IO_READ, pager->fd, frame->data, PAGE_SIZE, offset,
+                    frame - pager->frames);
+    }
+    bool ok = ioRingSubmit(pager->ring, 0);
+    int error = errno;
+    pthread_mutex_unlock(&pager->ioLock);
+    if (!ok)
+    {
+        fatalError(DB_ERROR_IO, "Error submitting reads: %d", error);
+    }
+}
+
+/**
+ * @brief write pages to their places in the database file
+ *
+ * Each run of adjacent page numbers is a single vectored write. With a
+ * ring, all of the runs are in flight at once. A compressed file's pages
+ * go to new extents instead; see storeWritePages().
+ * @param count at most CHECKPOINT_BATCH_PAGES
+ */
+static void writePages(Pager *pager, const uint32_t *pageNums, void **pages,
+                       uint32_t count)
+{
+    if (pager->store != NULL)
+    {
+        storeWritePages(pager, pageNums, pages, count);
+        return;
+    }
+    struct iovec iov[CHECKPOINT_BATCH_PAGES];
+    for (uint32_t i = 0; i < count; i++)
+    {
+        iov[i].iov_base = pages[i];
+        iov[i].iov_len = PAGE_SIZE;
+    }
+
+    if (pager->ring == NULL)
+    {
+        uint32_t first = 0;
+        for (uint32_t i = 1; i <= count; i++)
+        {
+            if (i < count && pageNums[i] == pageNums[i - 1] + 1)
+            {
+                continue;
+            }
+            ssize_t len = (ssize_t)(i - first) * PAGE_SIZE;
+            if (pwritev(pager->fd, &iov[first], i - first,
+                        (off_t)pageNums[first] * PAGE_SIZE) != len)
+            {
+                fatalError(DB_ERROR_IO, "Error writing: %d", errno);
+            }
+            countStat(STAT_BYTES_WRITTEN, len);
+            first = i;
+        }
+        return;
+    }
+
+    pthread_mutex_lock(&pager->ioLock);
+    bool ok = true;
+    int readError = 0;
+    pager->writeError = 0;
+    uint32_t first = 0;
+    for (uint32_t i = 1; i <= count && ok; i++)
+    {
+        if (i < count && pageNums[i] == pageNums[i - 1] + 1)
+        {
+            continue;
+        }
+        // The completion must report the whole run written
+        uint64_t userData = IO_WRITE_TAG | (i - first);
+        while (ok && !ioRingQueue(pager->ring, IO_WRITEV, pager->fd, &iov[first], i - first,
+                                  (off_t)pageNums[first] * PAGE_SIZE, userData))
+        {
+            ok = ioRingSubmit(pager->ring, 1);
+            readError = pagerReapLocked(pager);
+        }
+        pager->writesInFlight++;
+        first = i;
+    }
+    while (ok && pager->writesInFlight > 0)
+    {
+        ok = ioRingSubmit(pager->ring, 1);
+        int error = pagerReapLocked(pager);
+        readError = readError != 0 ? readError : error;
+    }
+    int error = ok ? pager->writeError : errno;
+    pthread_mutex_unlock(&pager->ioLock);
+    if (error != 0)
+    {
+        fatalError(DB_ERROR_IO, "Error writing: %d", error);
+    }
+    if (readError != 0)
+    {
+        fatalError(DB_ERROR_IO, "Error reading file: %d", readError);
+    }
+}
+
+/**
+ * @brief wait out every ring request, ignoring the results
+ *
+ * The kernel must be done with the frames before they are freed.
+ */
+static void ioRingDrain(Pager *pager)
+{
+    uint64_t userData;
+    int32_t result;
+    while (pager->ring->inFlight > 0 && ioRingSubmit(pager->ring, 1))
+    {
+        while (ioRingPop(pager->ring, &userData, &result))
+        {
+        }
+    }
+}
+
+/**
+ * @brief make every change since the last commit durable as one unit
+ *
+ * Dirty pages are appended to the WAL and the last one is marked as the
+ * commit frame. Readers find logged pages through the WAL index, so the
+ * database file itself is only written at checkpoints. Does nothing inside
+ * a transaction.
+ */
+static void commitPager(Pager *pager)
+{
+    Wal *wal = pager->wal;
+    if (pager->inTransaction)
+    {
+        return;
+    }
+    uint32_t numDirty = 0;
+    for (uint32_t i = 0; i < pager->numFrames; i++)
+    {
+        if (pager->frames[i].pageNum != INVALID_PAGE_NUM && pager->frames[i].dirty)
+        {
+            numDirty++;
+        }
+    }
+
+    if (numDirty == 0)
+    {
+        if (wal->numFrames == wal->lastCommitFrame)
+        {
+            // Nothing changed
+            return;
+        }
+        // Every change was spilled by eviction; log the newest one again
+        // as the commit frame
+        uint32_t frameNum = wal->numFrames - 1;
+        uint32_t pageNum;
+        off_t offset = walFrameOffset(frameNum) + WAL_FRAME_PAGE_NUM_OFFSET;
+        if (pread(wal->fd, &pageNum, sizeof(pageNum), offset) != sizeof(pageNum))
+        {
+            fatalError(DB_ERROR_IO, "Error reading WAL: %d", errno);
+        }
+        walReadFrame(wal, frameNum, pager->scratch);
+        walAppendFrame(wal, pageNum, pager->scratch, pager->numPages);
+    }
+
+    for (uint32_t i = 0; i < pager->numFrames && numDirty > 0; i++)
+    {
+        Frame *frame = &pager->frames[i];
+        if (frame->pageNum == INVALID_PAGE_NUM || !frame->dirty)
+        {
+            continue;
+        }
+        numDirty--;
+        walAppendFrame(wal, frame->pageNum, frame->data,
+                       numDirty == 0 ? pager->numPages : 0);
+        frame->dirty = false;
+    }
+
+    walCommitted(wal);
+    // A commit across partitions may not reach the database file before
+    // the commit record holds it; commitParts() checkpoints after that
+    if (wal->transaction == 0 && wal->numFrames - wal->backfilled >= WAL_CHECKPOINT_FRAMES)
+    {
+        checkpointPager(pager);
+    }
+}
+
+/**
+ * @brief forget a page the pool holds; the caller holds the latch
+ */
+static void frameDrop(Pager *pager, Frame *frame)
+{
+    pageTableRemove(pager, frame);
+    frame->pageNum = INVALID_PAGE_NUM;
+    frame->dirty = false;
+    frame->referenced = false;
+}
+
+/**
+ * @brief throw away every change since the transaction began
+ *
+ * The dirty frames go, and so do pages eviction spilled to the log since
+ * the last commit: their frames come out of the WAL index, newest first,
+ * and the next append overwrites them. Nothing is read or written but the
+ * spilled frames' page numbers; the committed pages are read again when
+ * next used.
+ */
+static void rollbackPager(Pager *pager)
+{
+    Wal *wal = pager->wal;
+    uint32_t numSpilled = wal->numFrames - wal->lastCommitFrame;
+    uint32_t *spilled = malloc(sizeof(uint32_t) * (numSpilled + 1));
+    for (uint32_t i = 0; i < numSpilled; i++)
+    {
+        off_t offset = walFrameOffset(wal->lastCommitFrame + i) + WAL_FRAME_PAGE_NUM_OFFSET;
+        if (pread(wal->fd, &spilled[i], sizeof(uint32_t), offset) != sizeof(uint32_t))
+        {
+            free(spilled);
+            fatalError(DB_ERROR_IO, "Error reading WAL: %d", errno);
+        }
+    }
+    pthread_rwlock_wrlock(&wal->indexLock);
+    for (uint32_t i = numSpilled; i-- > 0;)
+    {
+        walIndexRestore(wal, spilled[i], wal->framePrev[wal->lastCommitFrame + i]);
+    }
+    pthread_rwlock_unlock(&wal->indexLock);
+    wal->numFrames = wal->lastCommitFrame;
+    memcpy(wal->checksum, wal->commitChecksum, sizeof(wal->checksum));
+
+    pthread_mutex_lock(&pager->latch);
+    for (uint32_t i = 0; i < numSpilled; i++)
+    {
+        Frame *frame = pageTableLookup(pager, spilled[i]);
+        if (frame != NULL && frame->pinCount == 0)
+        {
+            frameDrop(pager, frame);
+        }
+    }
+    for (uint32_t i = 0; i < pager->numFrames; i++)
+    {
+        if (pager->frames[i].pageNum != INVALID_PAGE_NUM && pager->frames[i].dirty)
+        {
+            frameDrop(pager, &pager->frames[i]);
+        }
+    }
+    pthread_mutex_unlock(&pager->latch);
+    free(spilled);
+    pager->numPages = pager->transactionNumPages;
+    pager->inTransaction = false;
+}
+
+static int compareIndexEntries(const void *a, const void *b)
+{
+    uint32_t x = ((const WalIndexEntry *)a)->pageNum;
+    uint32_t y = ((const WalIndexEntry *)b)->pageNum;
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief copy each logged page, as of frame safeFrames, into the database
+ * file
+ *
+ * Pages whose copy is below wal->backfilled are already there.
+ */
+static void backfillPager(Pager *pager, uint32_t safeFrames)
+{
+    Wal *wal = pager->wal;
+    // The log must be durable before the database file changes
+    walSync(wal);
+
+    // Write in page order, a batch at a time
+    WalIndexEntry *entries = malloc(sizeof(WalIndexEntry) * wal->indexCount);
+    uint32_t numEntries = 0;
+    for (uint32_t i = 0; i < wal->indexCapacity; i++)
+    {
+        uint32_t pageNum = wal->index[i].pageNum;
+        if (pageNum == INVALID_PAGE_NUM)
+        {
+            continue;
+        }
+        uint32_t frameNum = walFindBefore(wal, pageNum, safeFrames);
+        if (frameNum != INVALID_FRAME_NUM && frameNum >= wal->backfilled)
+        {
+            entries[numEntries].pageNum = pageNum;
+            entries[numEntries].frameNum = frameNum;
+            numEntries++;
+        }
+    }
+    qsort(entries, numEntries, sizeof(WalIndexEntry), compareIndexEntries);
+
+    uint32_t pageNums[CHECKPOINT_BATCH_PAGES];
+    void *pages[CHECKPOINT_BATCH_PAGES];
+    void *buffers = malloc((size_t)CHECKPOINT_BATCH_PAGES * PAGE_SIZE);
+    uint32_t batchCount = 0;
+    for (uint32_t i = 0; i < numEntries; i++)
+    {
+        // A resident clean page matches its newest frame; skip the read
+        Frame *frame = pageTableLookup(pager, entries[i].pageNum);
+        bool current = frame != NULL && walFind(wal, entries[i].pageNum) == entries[i].frameNum;
+        void *page = current ? frame->data : buffers + (size_t)batchCount * PAGE_SIZE;
+        if (!current)
+        {
+            walReadFrame(wal, entries[i].frameNum, page);
+        }
+        pageNums[batchCount] = entries[i].pageNum;
+        pages[batchCount] = page;
+        if (++batchCount == CHECKPOINT_BATCH_PAGES || i == numEntries - 1)
+        {
+            writePages(pager, pageNums, pages, batchCount);
+            batchCount = 0;
+        }
+    }
+    free(buffers);
+    free(entries);
+
+    syncDbFile(pager);
+    wal->backfilled = safeFrames;
+}
+
+/**
+ * @brief copy committed pages from the WAL into the database file, and
+ * empty the WAL once no reader can need it
+ *
+ * A reader's snapshot may take any page not logged before it from the
+ * database file, so pages are copied only as of the oldest open snapshot,
+ * and the log is kept until every snapshot is closed; later checkpoints
+ * pick up from there. Must only be called right after commitPager(), when
+ * no page is dirty.
+ */
+static void checkpointPager(Pager *pager)
+{
+    Wal *wal = pager->wal;
+    if (wal->numFrames == 0)
+    {
+        return;
+    }
+    pthread_mutex_lock(&wal->snapshotLock);
+    uint32_t safeFrames = walOldestSnapshot(wal);
+    pthread_mutex_unlock(&wal->snapshotLock);
+    if (safeFrames > wal->backfilled)
+    {
+        backfillPager(pager, safeFrames);
+    }
+    if (wal->backfilled < wal->numFrames || !walReset(wal))
+    {
+        return;
+    }
+    pager->fLen = dbFileLength(pager);
+    remapPager(pager);
+}
+
+/**
+ * @brief close the pager of a file that failed to open
+ *
+ * The error may have left its latch held, so it is released as after any
+ * caught error. Its log is removed too unless it holds frames to recover,
+ * so a log this open created is not left behind.
+ */
+static void abandonPager(Pager *pager)
+{
+    char *walFn = pager->wal->numFrames == 0 ? strdup(pager->wal->fn) : NULL;
+    releasePager(pager, false);
+    if (walFn != NULL)
+    {
+        unlink(walFn);
+        free(walFn);
+    }
+}
+
+/**
+ * @brief open one database file: a whole table, or one partition of one
+ * @param layout partition settings written to a new file's header
+ * @param recordedTransaction as for walOpen()
+ * @return true if the file was new
+ */
+static bool openPartition(Table *table, const char *fn, const PagerOptions *options,
+                          uint32_t partition, const PagerOptions *layout,
+                          uint32_t recordedTransaction)
+{
+    Pager *pager = openPager(fn, options, recordedTransaction);
+    // The file is closed again before any error goes on to the caller
+    ErrorScope scope;
+    ErrorScope *outer = errorScope;
+    errorScope = &scope;
+    if (setjmp(scope.jump) != 0)
+    {
+        errorScope = outer;
+        abandonPager(pager);
+        fatalError(scope.code, "%s", scope.message);
+    }
+    if (pager->fLen % PAGE_SIZE != 0)
+    {
+        fatalError(DB_ERROR_CORRUPT, "Db file is not a whole number of pages. Corrupt file.");
+    }
+
+    bool created = pager->numPages == 0;
+    if (created)
+    {
+        // New database file: the header, then every root as an empty
+        // leaf. Leaves split from the table's keep the layout chosen here.
+        void *header = getPage(pager, HEADER_PAGE_NUM);
+        *headerField(header, HEADER_MAGIC_OFFSET) = DB_MAGIC;
+        *headerField(header, HEADER_VERSION_OFFSET) = DB_VERSION;
+        *headerField(header, HEADER_PAGE_SIZE_OFFSET) = PAGE_SIZE;
+        *headerField(header, HEADER_ROW_COUNT_OFFSET) = 0;
+        *headerField(header, HEADER_FREE_LIST_OFFSET) = 0; // no free pages
+        *headerRoot(header, 0) = TABLE_ROOT_PAGE_NUM;
+        for (uint32_t i = 0; i < NUM_INDEXES; i++)
+        {
+            *headerRoot(header, i + 1) = INDEX_ROOT_PAGE_NUM + i;
+        }
+        *headerField(header, HEADER_PARTITION_OFFSET) = partition;
+        *headerField(header, HEADER_NUM_PARTITIONS_OFFSET) = layout->numPartitions;
+        *headerField(header, HEADER_PARTITIONING_OFFSET) = layout->partitioning;
+        *headerField(header, HEADER_PARTITION_WIDTH_OFFSET) = layout->partitionWidth;
+        unpinPage(pager, HEADER_PAGE_NUM, true);
+
+        for (uint32_t pageNum = TABLE_ROOT_PAGE_NUM;
+             pageNum < INDEX_ROOT_PAGE_NUM + NUM_INDEXES; pageNum++)
+        {
+            void *rootNode = getPage(pager, pageNum);
+            initializeLeafNode(rootNode);
+            if (pageNum == TABLE_ROOT_PAGE_NUM && options->columnar)
+            {
+                setNodeType(rootNode, NODE_PAX_LEAF);
+            }
+            setNodeRoot(rootNode, true);
+            unpinPage(pager, pageNum, true);
+        }
+        commitPager(pager);
+    }
+
+    // Only the header is read here; every other page is checked against
+    // its checksum when it is first read
+    void *header = readPage(pager, HEADER_PAGE_NUM);
+    uint32_t magic = *headerField(header, HEADER_MAGIC_OFFSET);
+    uint32_t version = *headerField(header, HEADER_VERSION_OFFSET);
+    uint32_t pageSize = *headerField(header, HEADER_PAGE_SIZE_OFFSET);
+    uint32_t roots[NUM_INDEXES + 1];
+    for (uint32_t i = 0; i <= NUM_INDEXES; i++)
+    {
+        roots[i] = *headerRoot(header, i);
+    }
+    uint32_t filePartition = *headerField(header, HEADER_PARTITION_OFFSET);
+    uint32_t numPartitions = *headerField(header, HEADER_NUM_PARTITIONS_OFFSET);
+    PartitionScheme partitioning = *headerField(header, HEADER_PARTITIONING_OFFSET);
+    uint32_t partitionWidth = *headerField(header, HEADER_PARTITION_WIDTH_OFFSET);
+    releasePage(pager, HEADER_PAGE_NUM, header);
+    if (magic != DB_MAGIC)
+    {
+        // Files from before the header start with the table's root
+        fatalError(DB_ERROR_CORRUPT, "Db file has no header. Recreate it.");
+    }
+    if (version != DB_VERSION || pageSize != PAGE_SIZE)
+    {
+        fatalError(DB_ERROR_CORRUPT, "Db file has version %u and %u-byte pages; "
+                   "expected version %u and %u-byte pages.",
+                   version, pageSize, DB_VERSION, PAGE_SIZE);
+    }
+    if (filePartition != partition ||
+        (partition > 0 && (numPartitions != layout->numPartitions ||
+                           partitioning != layout->partitioning ||
+                           partitionWidth != layout->partitionWidth)))
+    {
+        fatalError(DB_ERROR_CORRUPT, "%s is partition %u of %u; expected partition %u of %u.",
+                   fn, filePartition, numPartitions, partition, layout->numPartitions);
+    }
+    errorScope = outer;
+
+    table->pager = pager;
+    table->rootPageNum = roots[0];
+    table->scanThreads = 1;
+    table->output = stdout;
+    table->outputFormat = OUTPUT_TEXT;
+    table->numIndexes = NUM_INDEXES;
+    table->indexes = malloc(sizeof(Index) * NUM_INDEXES);
+    for (uint32_t i = 0; i < NUM_INDEXES; i++)
+    {
+        Index *index = &table->indexes[i];
+        index->tree.rootPageNum = roots[i + 1];
+        index->tree.pager = pager;
+        index->tree.scanThreads = 1;
+        index->tree.output = NULL;
+        index->tree.outputFormat = OUTPUT_TEXT;
+        index->tree.indexes = NULL;
+        index->tree.numIndexes = 0;
+        index->tree.partitions = NULL;
+        index->tree.commitLog = NULL;
+        index->tree.numPartitions = 1;
+        index->column = INDEXED_COLUMNS[i];
+    }
+    table->partitions = NULL;
+    table->commitLog = NULL;
+    table->numPartitions = numPartitions > 1 ? numPartitions : 1;
+    table->partitioning = partitioning;
+    table->partitionWidth = partitionWidth;
+    return created;
+}
+
+/**
+ * @brief the id the commit record <fn>-commit holds, 0 if there is none
+ */
+static uint32_t commitRecordRead(const char *fn)
+{
+    size_t fnLen = strlen(fn) + sizeof(COMMIT_SUFFIX);
+    char *recordFn = malloc(fnLen);
+    snprintf(recordFn, fnLen, "%s%s", fn, COMMIT_SUFFIX);
+    int fd = open(recordFn, O_RDONLY);
+    free(recordFn);
+    if (fd == -1)
+    {
+        if (errno == ENOENT)
+        {
+            return 0;
+        }
+        fatalError(DB_ERROR_IO, "Unable to open commit record: %d", errno);
+    }
+    uint32_t record[2];
+    ssize_t bytesRead = pread(fd, record, sizeof(record), 0);
+    int error = errno;
+    close(fd);
+    if (bytesRead == 0)
+    {
+        return 0;
+    }
+    if (bytesRead == -1)
+    {
+        fatalError(DB_ERROR_IO, "Error reading commit record: %d", error);
+    }
+    if (bytesRead != sizeof(record) || record[1] != ~record[0])
+    {
+        fatalError(DB_ERROR_CORRUPT, "Commit record is corrupt.");
+    }
+    return record[0];
+}
+
+/**
+ * @brief open the commit record for a partitioned table's commits
+ * @param lastTransaction what commitRecordRead() found in it
+ */
+static CommitLog *commitLogOpen(const char *fn, uint32_t lastTransaction)
+{
+    size_t fnLen = strlen(fn) + sizeof(COMMIT_SUFFIX);
+    char *recordFn = malloc(fnLen);
+    snprintf(recordFn, fnLen, "%s%s", fn, COMMIT_SUFFIX);
+    int fd = open(recordFn, O_RDWR | O_CREAT, S_IWUSR | S_IRUSR);
+    free(recordFn);
+    if (fd == -1)
+    {
+        fatalError(DB_ERROR_IO, "Unable to open commit record: %d", errno);
+    }
+    CommitLog *log = malloc(sizeof(CommitLog));
+    log->fd = fd;
+    log->lastTransaction = lastTransaction;
+    atomic_init(&log->started, 0);
+    atomic_init(&log->finished, 0);
+    return log;
+}
+
+/**
+ * @brief open database
+ * @param fn database filename; further partitions are <fn>-p1 and so on
+ * @param options pager settings chosen at startup
+ */
+Table *openDatabase(const char *fn, const PagerOptions *options)
+{
+    PagerOptions layout = *options;
+    if (layout.numPartitions > MAX_PARTITIONS)
+    {
+        fatalError(DB_ERROR_RANGE, "At most %u partitions.", MAX_PARTITIONS);
+    }
+    if (layout.numPartitions < 2)
+    {
+        layout.numPartitions = 0;
+        layout.partitioning = PARTITION_HASH;
+        layout.partitionWidth = 0;
+    }
+    else if (layout.partitioning != PARTITION_RANGE)
+    {
+        layout.partitionWidth = 0;
+    }
+    else if (layout.partitionWidth == 0)
+    {
+        layout.partitionWidth = UINT32_MAX / layout.numPartitions + 1;
+    }
+
+    // Commits across partitions the record does not hold never happened
+    uint32_t recordedTransaction = commitRecordRead(fn);
+    Table first;
+    bool created = openPartition(&first, fn, options, 0, &layout, recordedTransaction);
+    Table *table = malloc(sizeof(Table));
+    *table = first;
+    if (table->numPartitions == 1)
+    {
+        return table;
+    }
+    // An existing database keeps the layout its first file records
+    layout.numPartitions = table->numPartitions;
+    layout.partitioning = table->partitioning;
+    layout.partitionWidth = table->partitionWidth;
+
+    size_t fnLen = strlen(fn) + 16;
+    char *partitionFn = malloc(fnLen);
+    // A partition that fails to open closes the ones before it, then the
+    // error goes on to the caller
+    ErrorScope scope;
+    ErrorScope *outer = errorScope;
+    volatile uint32_t numOpened = 1;
+    errorScope = &scope;
+    if (setjmp(scope.jump) != 0)
+    {
+        errorScope = outer;
+        free(partitionFn);
+        table->numPartitions = numOpened;
+        uint32_t numParts;
+        Table *parts = tableParts(table, &numParts);
+        for (uint32_t i = 0; i < numParts; i++)
+        {
+            abandonPager(parts[i].pager);
+            free(parts[i].indexes);
+        }
+        free(table->partitions);
+        free(table);
+        fatalError(scope.code, "%s", scope.message);
+    }
+
+    // An existing database never grows a partition file back: that would
+    // open an empty partition in place of the lost rows. Every file is
+    // checked before any is opened, so a failed open writes nothing.
+    for (uint32_t i = 1; !created && i < table->numPartitions; i++)
+    {
+        snprintf(partitionFn, fnLen, "%s-p%u", fn, i);
+        if (access(partitionFn, F_OK) != 0)
+        {
+            fatalError(DB_ERROR_CORRUPT, "Partition file %s is missing.", partitionFn);
+        }
+    }
+
+    table->partitions = malloc(sizeof(Table) * table->numPartitions);
+    table->partitions[0] = *table;
+    table->partitions[0].partitions = NULL;
+    table->partitions[0].numPartitions = 1;
+    for (uint32_t i = 1; i < table->numPartitions; i++)
+    {
+        snprintf(partitionFn, fnLen, "%s-p%u", fn, i);
+        Table *partition = &table->partitions[i];
+        openPartition(partition, partitionFn, options, i, &layout, recordedTransaction);
+        partition->numPartitions = 1;
+        numOpened = i + 1;
+    }
+    table->commitLog = commitLogOpen(fn, recordedTransaction);
+    errorScope = outer;
+    free(partitionFn);
+    return table;
+}
+
+/**
+ * @brief the partitions of a table, or the table itself if it has none
+ */
+static Table *tableParts(Table *table, uint32_t *numParts)
+{
+    *numParts = table->partitions != NULL ? table->numPartitions : 1;
+    return table->partitions != NULL ? table->partitions : table;
+}
+
+/**
+ * @brief the partition a row with this id belongs in
+ */
+static uint32_t partitionOf(Table *table, uint32_t id)
+{
+    if (table->partitioning == PARTITION_RANGE)
+    {
+        uint32_t partition = id / table->partitionWidth;
+        return partition < table->numPartitions ? partition : table->numPartitions - 1;
+    }
+    return ((uint64_t)(uint32_t)(id * 2654435761u) * table->numPartitions) >> 32;
+}
+
+/**
+ * @brief true if the pager has changes its WAL does not show readers yet
+ */
+static bool pagerChanged(Pager *pager)
+{
+    for (uint32_t i = 0; i < pager->numFrames; i++)
+    {
+        if (pager->frames[i].pageNum != INVALID_PAGE_NUM && pager->frames[i].dirty)
+        {
+            return true;
+        }
+    }
+    return pager->wal->numFrames != pager->wal->lastCommitFrame;
+}
+
+/**
+ * @brief commit partitions first to last of a partitioned table, in all of
+ * them or, after a crash, in none
+ *
+ * With changes in one partition this is commitPager(). Otherwise each
+ * changed partition logs its commit tagged with a new transaction id and
+ * holds it back from readers; once every log is synced, the commit record
+ * takes the id, and then every partition shows the commit. See CommitLog.
+ */
+static void commitParts(Table *table, uint32_t first, uint32_t last)
+{
+    uint32_t numChanged = 0;
+    for (uint32_t i = first; i <= last && numChanged < 2; i++)
+    {
+        numChanged += pagerChanged(table->partitions[i].pager);
+    }
+    if (numChanged < 2)
+    {
+        for (uint32_t i = first; i <= last; i++)
+        {
+            commitPager(table->partitions[i].pager);
+        }
+        return;
+    }
+
+    CommitLog *log = table->commitLog;
+    uint32_t transaction = log->lastTransaction + 1;
+    bool changed[MAX_PARTITIONS];
+    for (uint32_t i = first; i <= last; i++)
+    {
+        Pager *pager = table->partitions[i].pager;
+        changed[i] = pagerChanged(pager);
+        if (changed[i])
+        {
+            pager->wal->transaction = transaction;
+            commitPager(pager);
+            pager->wal->transaction = 0;
+        }
+    }
+    for (uint32_t i = first; i <= last; i++)
+    {
+        if (changed[i])
+        {
+            walSync(table->partitions[i].pager->wal);
+        }
+    }
+    uint32_t record[2] = {transaction, ~transaction};
+    if (pwrite(log->fd, record, sizeof(record), 0) != sizeof(record))
+    {
+        fatalError(DB_ERROR_IO, "Error writing commit record: %d", errno);
+    }
+    if (fsync(log->fd) != 0)
+    {
+        fatalError(DB_ERROR_IO, "Error syncing commit record: %d", errno);
+    }
+    log->lastTransaction = transaction;
+
+    atomic_fetch_add(&log->started, 1);
+    for (uint32_t i = first; i <= last; i++)
+    {
+        if (changed[i])
+        {
+            walPublish(table->partitions[i].pager->wal);
+        }
+    }
+    atomic_fetch_add(&log->finished, 1);
+
+    for (uint32_t i = first; i <= last; i++)
+    {
+        Pager *pager = table->partitions[i].pager;
+        if (changed[i] && pager->wal->numFrames - pager->wal->backfilled >= WAL_CHECKPOINT_FRAMES)
+        {
+            checkpointPager(pager);
+        }
+    }
+}
+
+/**
+ * @brief partitions that may hold ids in [lowId, highId]; none if *first
+ * ends up past *last
+ */
+static void partitionSpan(Table *table, uint32_t lowId, uint32_t highId, uint32_t *first,
+                          uint32_t *last)
+{
+    if (table->partitioning == PARTITION_RANGE || lowId == highId)
+    {
+        *first = partitionOf(table, lowId);
+        *last = lowId <= highId ? partitionOf(table, highId) : 0;
+        return;
+    }
+    *first = 0;
+    *last = table->numPartitions - 1;
+}
+
+
+
+void setScanThreads(Table *table, uint32_t scanThreads)
+{
+    // Each worker pins one leaf at a time; leave frames for the rest
+    uint32_t maxThreads = table->pager->numFrames / 2;
+    if (maxThreads > MAX_SCAN_THREADS)
+    {
+        maxThreads = MAX_SCAN_THREADS;
+    }
+    if (scanThreads > maxThreads)
+    {
+        scanThreads = maxThreads;
+    }
+    table->scanThreads = scanThreads > 1 ? scanThreads : 1;
+    for (uint32_t i = 0; table->partitions != NULL && i < table->numPartitions; i++)
+    {
+        table->partitions[i].scanThreads = table->scanThreads;
+    }
+}
+
+/**
+ * @brief close one file and free its pager without writing anything
+ */
+static bool releasePager(Pager *pager, bool checkpointed)
+{
+    if (pager->ring != NULL)
+    {
+        ioRingDrain(pager);
+        ioRingClose(pager->ring);
+    }
+    walClose(pager->wal, checkpointed);
+    if (pager->map != NULL)
+    {
+        munmap(pager->map, pager->mapLen);
+    }
+    free(pager->checked);
+    if (pager->store != NULL)
+    {
+        storeClose(pager->store, checkpointed);
+    }
+
+    int result = close(pager->fd);
+    munmap(pager->arena, pager->arenaLen);
+
+    if (checkpointed)
+    {
+        pthread_mutex_destroy(&pager->latch);
+        pthread_cond_destroy(&pager->loaded);
+        pthread_mutex_destroy(&pager->ioLock);
+    }
+    free(pager->frames);
+    free(pager->buckets);
+    free(pager);
+    return result != -1;
+}
+
+/**
+ * @brief close the files and free the table without writing anything
+ * @param checkpointed false after a caught error: the WAL is left for
+ * recovery, and the latch may still be held, so it is not destroyed
+ * @return false if a database file did not close cleanly
+ */
+static bool releaseDatabase(Table *table, bool checkpointed)
+{
+    uint32_t numParts;
+    Table *parts = tableParts(table, &numParts);
+    bool closed = true;
+    for (uint32_t i = 0; i < numParts; i++)
+    {
+        closed = releasePager(parts[i].pager, checkpointed) && closed;
+        free(parts[i].indexes);
+    }
+    if (table->commitLog != NULL)
+    {
+        closed = close(table->commitLog->fd) != -1 && closed;
+        free(table->commitLog);
+    }
+    free(table->partitions);
+    free(table);
+    return closed;
+}
+
+/**
+ * @brief close database
+ */
+void closeDatabase(Table *table)
+{
+    uint32_t numParts;
+    Table *parts = tableParts(table, &numParts);
+    for (uint32_t i = 0; i < numParts; i++)
+    {
+        if (parts[i].pager->inTransaction)
+        {
+            rollbackPager(parts[i].pager);
+        }
+        commitPager(parts[i].pager);
+        checkpointPager(parts[i].pager);
+    }
+    if (!releaseDatabase(table, true))
+    {
+        fatalError(DB_ERROR_IO, "Error closing db file.");
+    }
+}
+
+/**
+ * @brief fetch the leaf under the cursor; the current row is its cell
+ * cursor->cellNum
+ *
+ * The leaf is read-only and stays valid until cursorRelease().
+ */
+static void *cursorLeaf(Cursor *cursor)
+{
+    cursor->page = readPage(cursor->table->pager, cursor->pageNum);
+    return cursor->page;
+}
+
+static void cursorRelease(Cursor *cursor)
+{
+    releasePage(cursor->table->pager, cursor->pageNum, cursor->page);
+    cursor->page = NULL;
+}
+
+/*
+Leaf row views read one column of one cell from a leaf of either layout.
+In a table's PAX leaves the id is the key; index leaves always use the row
+layout, where the id is the indexed row's.
+*/
+static uint32_t leafNodeRowId(void *node, uint32_t cellNum)
+{
+    if (isPaxLeaf(node))
+    {
+        return paxLeafIds(node)[cellNum];
+    }
+    return tableRowInt(leafNodeValue(node, cellNum), COLUMN_ID);
+}
+
+static const char *leafNodeText(void *node, uint32_t cellNum, Column column,
+                                uint32_t *length)
+{
+    if (isPaxLeaf(node))
+    {
+        return paxLeafText(node, cellNum, column, length);
+    }
+    return tableRowText(leafNodeValue(node, cellNum), column, length);
+}
+
+/*
+Key selection kernels. Each sets bit i of mask, which starts zeroed, for
+every i < count whose key keys[i * stride] lies in [low, high]; low must
+not exceed high. stride is 1 for a PAX id minipage and 2 for the keys in a
+row leaf's 8-byte slots. A key is in range when key - low <= high - low
+as unsigned numbers, which is one compare per lane.
+*/
+static void selectKeysScalar(const uint32_t *keys, uint32_t stride, uint32_t start,
+                             uint32_t count, uint32_t low, uint32_t high,
+                             uint64_t *mask)
+{
+    for (uint32_t i = start; i < count; i++)
+    {
+        uint64_t inside = keys[i * stride] - low <= high - low;
+        mask[i / 64] |= inside << (i % 64);
+    }
+}
+
+#if defined(HAVE_SSE2)
+static void selectKeysSse2(const uint32_t *keys, uint32_t stride, uint32_t count,
+                           uint32_t low, uint32_t high, uint64_t *mask)
+{
+    // SSE2 only compares signed lanes; flipping the sign bit of both
+    // sides turns that into an unsigned compare
+    const __m128i lowV = _mm_set1_epi32((int32_t)low);
+    const __m128i sign = _mm_set1_epi32(INT32_MIN);
+    const __m128i span = _mm_set1_epi32((int32_t)((high - low) ^ 0x80000000u));
+    uint32_t i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128i x;
+        if (stride == 1)
+        {
+            x = _mm_loadu_si128((const __m128i *)(keys + i));
+        }
+        else
+        {
+            __m128 a = _mm_loadu_ps((const float *)(keys + 2 * i));
+            __m128 b = _mm_loadu_ps((const float *)(keys + 2 * i + 4));
+            x = _mm_castps_si128(_mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+        }
+        __m128i outside = _mm_cmpgt_epi32(_mm_xor_si128(_mm_sub_epi32(x, lowV), sign), span);
+        uint64_t inside = ~_mm_movemask_ps(_mm_castsi128_ps(outside)) & 0xf;
+        mask[i / 64] |= inside << (i % 64);
+    }
+    selectKeysScalar(keys, stride, i, count, low, high, mask);
+}
+#endif
+
+#if defined(HAVE_AVX2)
+__attribute__((target("avx2"))) static void
+selectKeysAvx2(const uint32_t *keys, uint32_t stride, uint32_t count, uint32_t low,
+               uint32_t high, uint64_t *mask)
+{
+    const __m256i lowV = _mm256_set1_epi32((int32_t)low);
+    const __m256i sign = _mm256_set1_epi32(INT32_MIN);
+    const __m256i span = _mm256_set1_epi32((int32_t)((high - low) ^ 0x80000000u));
+    uint32_t i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        __m256i x;
+        if (stride == 1)
+        {
+            x = _mm256_loadu_si256((const __m256i *)(keys + i));
+        }
+        else
+        {
+            // The shuffle picks keys within each 128-bit half; the permute
+            // puts the halves back in order
+            __m256 a = _mm256_loadu_ps((const float *)(keys + 2 * i));
+            __m256 b = _mm256_loadu_ps((const float *)(keys + 2 * i + 8));
+            __m256 even = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+            x = _mm256_permute4x64_epi64(_mm256_castps_si256(even), _MM_SHUFFLE(3, 1, 2, 0));
+        }
+        __m256i outside = _mm256_cmpgt_epi32(_mm256_xor_si256(_mm256_sub_epi32(x, lowV), sign),
+                                             span);
+        uint64_t inside = ~_mm256_movemask_ps(_mm256_castsi256_ps(outside)) & 0xff;
+        mask[i / 64] |= inside << (i % 64);
+    }
+    selectKeysScalar(keys, stride, i, count, low, high, mask);
+}
+#endif
+
+#if defined(HAVE_NEON)
+static void selectKeysNeon(const uint32_t *keys, uint32_t stride, uint32_t count,
+                           uint32_t low, uint32_t high, uint64_t *mask)
+{
+    static const uint32_t laneBits[4] = {1, 2, 4, 8};
+    const uint32x4_t lowV = vdupq_n_u32(low);
+    const uint32x4_t span = vdupq_n_u32(high - low);
+    const uint32x4_t bitsV = vld1q_u32(laneBits);
+    uint32_t i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        uint32x4_t x = stride == 1 ? vld1q_u32(keys + i) : vld2q_u32(keys + 2 * i).val[0];
+        uint32x4_t inside = vcleq_u32(vsubq_u32(x, lowV), span);
+        mask[i / 64] |= (uint64_t)vaddvq_u32(vandq_u32(inside, bitsV)) << (i % 64);
+    }
+    selectKeysScalar(keys, stride, i, count, low, high, mask);
+}
+#endif
+
+/**
+ * @brief select the cells of a leaf whose keys lie in [low, high]
+ *
+ * In a table leaf the key is the row id, so this evaluates an id range
+ * for the whole leaf in one pass. Bit i of mask, which must hold
+ * LEAF_MASK_WORDS words, is set if cell i is selected.
+ */
+static void leafNodeSelectKeys(void *node, uint32_t low, uint32_t high, uint64_t *mask)
+{
+    memset(mask, 0, sizeof(uint64_t) * LEAF_MASK_WORDS);
+    uint32_t count = *leafNodeNumCells(node);
+    if (count == 0 || low > high)
+    {
+        return;
+    }
+    const uint32_t *keys = leafNodeKey(node, 0);
+    uint32_t stride = isPaxLeaf(node) ? 1 : LEAF_NODE_SLOT_SIZE / LEAF_NODE_KEY_SIZE;
+#if defined(HAVE_AVX2)
+    if (__builtin_cpu_supports("avx2"))
+    {
+        selectKeysAvx2(keys, stride, count, low, high, mask);
+        return;
+    }
+#endif
+#if defined(HAVE_SSE2)
+    selectKeysSse2(keys, stride, count, low, high, mask);
+#elif defined(HAVE_NEON)
+    selectKeysNeon(keys, stride, count, low, high, mask);
+#else
+    selectKeysScalar(keys, stride, 0, count, low, high, mask);
+#endif
+}
+
+/**
+ * @brief print the cells of node selected by leafNodeSelectKeys()
+ */
+static void printSelectedRows(ResultSink *sink, void *node, const uint64_t *mask,
+                              Projection *projection)
+{
+    uint32_t numRows = 0;
+    for (uint32_t word = 0; word < LEAF_MASK_WORDS; word++)
+    {
+        numRows += __builtin_popcountll(mask[word]);
+        for (uint64_t bits = mask[word]; bits != 0; bits &= bits - 1)
+        {
+            printRow(sink, node, word * 64 + __builtin_ctzll(bits), projection);
+        }
+    }
+    countStat(STAT_ROWS_RETURNED, numRows);
+}
+
+/**
+ * @brief what separates the fields of a record: a tab, if one comes before
+ * any comma, or else a comma
+ *
+ * The first field is an id or a column name, so neither of them is in it.
+ */
+static char importDelimiter(const char *record, const char *end)
+{
+    for (const char *c = record; c < end && *c != '\n'; c++)
+    {
+        if (*c == ',' || *c == '\t')
+        {
+            return *c;
+        }
+    }
+    return ',';
+}
+
+/**
+ * @brief the newline that ends the record at record, or NULL if [record,
+ * end) holds no whole one
+ *
+ * A newline inside a quoted field is part of the field.
+ */
+static char *importRecordEnd(char *record, char *end)
+{
+    char *lineEnd = memchr(record, '\n', end - record);
+    if (lineEnd == NULL || memchr(record, '"', lineEnd - record) == NULL)
+    {
+        return lineEnd;
+    }
+    char delimiter = importDelimiter(record, end);
+    bool quoted = false;
+    bool fieldStart = true;
+    for (char *c = record; c < end; c++)
+    {
+        if (quoted)
+        {
+            if (*c == '"')
+            {
+                if (c + 1 == end)
+                {
+                    return NULL; // A "" may be split across reads
+                }
+                quoted = c[1] == '"';
+                c += quoted;
+            }
+            continue;
+        }
+        if (*c == '\n')
+        {
+            return c;
+        }
+        quoted = *c == '"' && fieldStart;
+        fieldStart = *c == delimiter;
+    }
+    return NULL;
+}
+
+/**
+ * @brief split a record into fields, unquoting them in place
+ *
+ * A field that starts with a double quote runs to the closing one, and ""
+ * within it stands for one quote, as RFC 4180 has it. The first maxFields
+ * fields are stored.
+ * @return the number of fields, or 0 if a quoted field is malformed
+ */
+static uint32_t splitImportRecord(char *record, size_t len, char **fields,
+                                  uint32_t *lengths, uint32_t maxFields)
+{
+    if (len > 0 && record[len - 1] == '\r')
+    {
+        len--;
+    }
+    char delimiter = importDelimiter(record, record + len);
+    char *end = record + len;
+    char *c = record;
+    uint32_t numFields = 0;
+    while (true)
+    {
+        char *field = c;
+        char *fieldEnd;
+        if (c < end && *c == '"')
+        {
+            fieldEnd = field;
+            for (c++;; c++)
+            {
+                if (c == end)
+                {
+                    return 0; // No closing quote
+                }
+                if (*c == '"' && (c + 1 == end || c[1] != '"'))
+                {
+                    break;
+                }
+                c += *c == '"';
+                *fieldEnd++ = *c;
+            }
+            c++;
+            if (c < end && *c != delimiter)
+            {
+                return 0; // Text after the closing quote
+            }
+        }
+        else
+        {
+            fieldEnd = memchr(c, delimiter, end - c);
+            fieldEnd = fieldEnd != NULL ? fieldEnd : end;
+            c = fieldEnd;
+        }
+        if (numFields < maxFields)
+        {
+            fields[numFields] = field;
+            lengths[numFields] = fieldEnd - field;
+        }
+        numFields++;
+        if (c == end)
+        {
+            return numFields;
+        }
+        c++;
+    }
+}
+
+/**
+ * @brief the row in the fields of one "id,username,email" record
+ */
+static bool parseImportRow(char **fields, const uint32_t *lengths, uint32_t numFields,
+                           Row *row)
+{
+    if (numFields != TABLE_ROW_NUM_COLUMNS || lengths[COLUMN_ID] == 0)
+    {
+        return false;
+    }
+    uint64_t id = 0;
+    for (uint32_t i = 0; i < lengths[COLUMN_ID]; i++)
+    {
+        char c = fields[COLUMN_ID][i];
+        if (c < '0' || c > '9')
+        {
+            return false;
+        }
+        id = id * 10 + (c - '0');
+        if (id > UINT32_MAX)
+        {
+            return false;
+        }
+    }
+    row->id = id;
+
+    if (lengths[COLUMN_USERNAME] > COLUMN_USERNAME_SIZE ||
+        lengths[COLUMN_EMAIL] > COLUMN_EMAIL_SIZE)
+    {
+        return false;
+    }
+    memcpy(row->username, fields[COLUMN_USERNAME], lengths[COLUMN_USERNAME]);
+    row->username[lengths[COLUMN_USERNAME]] = '\0';
+    memcpy(row->email, fields[COLUMN_EMAIL], lengths[COLUMN_EMAIL]);
+    row->email[lengths[COLUMN_EMAIL]] = '\0';
+    return true;
+}
+
+/**
+ * @brief whether the fields of a record name the table's columns, in order
+ */
+static bool isImportHeader(char **fields, const uint32_t *lengths, uint32_t numFields)
+{
+    if (numFields != TABLE_ROW_NUM_COLUMNS)
+    {
+        return false;
+    }
+    for (uint32_t i = 0; i < TABLE_ROW_NUM_COLUMNS; i++)
+    {
+        if (lengths[i] != strlen(COLUMN_NAMES[i]) ||
+            memcmp(fields[i], COLUMN_NAMES[i], lengths[i]) != 0)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief install bulk loaded rows, count them and index them
+ */
+static void importBulkFinish(Table *table, BulkLoader *loader)
+{
+    // Committed with the new root
+    headerAddRows(table->pager, loader->numRows);
+    bulkFinish(loader);
+    indexBuild(table);
+}
+
+/**
+ * @brief load rows from a CSV or TSV file
+ *
+ * Into an empty table, rows in ascending id order are bulk loaded. Once a
+ * row arrives out of order, or if the table already has rows, the rest are
+ * inserted one by one and committed in batches. Duplicate ids are skipped.
+ * Fields may be quoted as RFC 4180 has it, as .mode csv writes them, and a
+ * first line of the column names is skipped as a header. A malformed line
+ * stops the import; rows before it are kept.
+ */
+void importFile(Table *table, const char *path)
+{
+    FILE *file = fopen(path, "r");
+    if (file == NULL)
+    {
+        printf("Error: could not open '%s'.\n", path);
+        return;
+    }
+
+    // Each partition is bulk loaded on its own: ids ascending overall are
+    // ascending within every partition
+    uint32_t numParts;
+    Table *parts = tableParts(table, &numParts);
+    BulkLoader *loaders = malloc(sizeof(BulkLoader) * numParts);
+    bool bulk[MAX_PARTITIONS];
+    for (uint32_t i = 0; i < numParts; i++)
+    {
+        Table *part = &parts[i];
+        void *root = readPage(part->pager, part->rootPageNum);
+        // The bulk loader writes the file directly, which no rollback could undo
+        bulk[i] = !part->pager->inTransaction && isLeafNode(root) &&
+                  *leafNodeNumCells(root) == 0;
+        releasePage(part->pager, part->rootPageNum, root);
+        if (bulk[i])
+        {
+            bulkBegin(&loaders[i], part);
+        }
+    }
+
+    char *buffer = malloc(IMPORT_BUFFER_SIZE);
+    size_t used = 0;
+    bool eof = false;
+    uint32_t lineNum = 0;
+    uint32_t imported = 0;
+    uint32_t duplicates = 0;
+    uint32_t uncommitted = 0;
+    bool malformed = false;
+    Row row;
+
+    while (!malformed && !(eof && used == 0))
+    {
+        if (!eof)
+        {
+            size_t bytesRead = fread(buffer + used, 1, IMPORT_BUFFER_SIZE - used, file);
+            used += bytesRead;
+            eof = bytesRead == 0;
+        }
+
+        char *line = buffer;
+        char *bufferEnd = buffer + used;
+        while (line < bufferEnd)
+        {
+            char *lineEnd = importRecordEnd(line, bufferEnd);
+            if (lineEnd == NULL)
+            {
+                if (!eof && bufferEnd - line == IMPORT_BUFFER_SIZE)
+                {
+                    printf("Error: line %u of '%s' is too long.\n", lineNum + 1, path);
+                    malformed = true;
+                    break;
+                }
+                if (!eof)
+                {
+                    break; // Partial line; read more behind it
+                }
+                lineEnd = bufferEnd; // Last line has no newline
+            }
+            uint32_t recordLine = ++lineNum;
+            size_t len = lineEnd - line;
+            char *next = lineEnd + (lineEnd < bufferEnd);
+            // Quoted fields may hold newlines of their own
+            for (char *c = memchr(line, '\n', len); c != NULL;
+                 c = memchr(c + 1, '\n', lineEnd - c - 1))
+            {
+                lineNum++;
+            }
+
+            if (len == 0 || (len == 1 && line[0] == '\r'))
+            {
+                line = next;
+                continue;
+            }
+            char *fields[TABLE_ROW_NUM_COLUMNS];
+            uint32_t lengths[TABLE_ROW_NUM_COLUMNS];
+            uint32_t numFields = splitImportRecord(line, len, fields, lengths,
+                                                   TABLE_ROW_NUM_COLUMNS);
+            if (recordLine == 1 && isImportHeader(fields, lengths, numFields))
+            {
+                line = next;
+                continue;
+            }
+            if (!parseImportRow(fields, lengths, numFields, &row))
+            {
+                printf("Error: line %u of '%s' is malformed.\n", recordLine, path);
+                malformed = true;
+                break;
+            }
+            line = next;
+
+            uint32_t partition = numParts > 1 ? partitionOf(table, row.id) : 0;
+            BulkLoader *loader = &loaders[partition];
+            if (bulk[partition] && loader->numRows > 0 && row.id == loader->lastKey)
+            {
+                duplicates++;
+                continue;
+            }
+            if (bulk[partition] && loader->numRows > 0 && row.id < loader->lastKey)
+            {
+                importBulkFinish(&parts[partition], loader);
+                bulk[partition] = false;
+            }
+            if (bulk[partition])
+            {
+                bulkAppendRow(loader, row.id, &row);
+                imported++;
+                continue;
+            }
+
+            if (!tableInsert(&parts[partition], &row))
+            {
+                duplicates++;
+                continue;
+            }
+            imported++;
+            if (++uncommitted == IMPORT_COMMIT_ROWS)
+            {
+                for (uint32_t i = 0; i < numParts; i++)
+                {
+                    commitPager(parts[i].pager);
+                }
+                uncommitted = 0;
+            }
+        }
+
+        used = bufferEnd - line;
+        memmove(buffer, line, used);
+    }
+
+    for (uint32_t i = 0; i < numParts; i++)
+    {
+        if (bulk[i])
+        {
+            importBulkFinish(&parts[i], &loaders[i]);
+        }
+        commitPager(parts[i].pager);
+    }
+    free(loaders);
+    free(buffer);
+    fclose(file);
+
+    printf("Imported %u rows.\n", imported);
+    if (duplicates > 0)
+    {
+        printf("Skipped %u duplicate keys.\n", duplicates);
+    }
+}
+
+/**
+ * @brief record that the next "?" in a statement sets target
+ */
+static bool addParam(Statement *statement, ParamTarget target)
+{
+    if (statement->numParams == STATEMENT_MAX_PARAMS)
+    {
+        return false;
+    }
+    statement->params[statement->numParams++] = target;
+    return true;
+}
+
+static bool isPlaceholder(const char *token)
+{
+    return strcmp(token, "?") == 0;
+}
+
+static PrepareResult parseId(const char *s, uint32_t *id)
+{
+    if (s == NULL)
+    {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    char *end;
+    errno = 0;
+    long long value = strtoll(s, &end, 10);
+    if (end == s || *end != '\0' || errno == ERANGE || value > UINT32_MAX)
+    {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    if (value < 0)
+    {
+        return PREPARE_NEGATIVE_ID;
+    }
+    *id = (uint32_t)value;
+    return PREPARE_SUCCESS;
+}
+
+static PrepareResult parseIdOrParam(const char *s, uint32_t *id,
+                                    Statement *statement, ParamTarget target)
+{
+    if (s != NULL && isPlaceholder(s))
+    {
+        *id = 0;
+        return addParam(statement, target) ? PREPARE_SUCCESS
+                                           : PREPARE_SYNTAX_ERROR;
+    }
+    return parseId(s, id);
+}
+
+static PrepareResult prepareInsertStatement(char *buffer, Statement *statement)
+{
+    strtok(buffer, " "); // the keyword
+    char *id_string = strtok(NULL, " ");
+    char *username = strtok(NULL, " ");
+    char *email = strtok(NULL, " ");
+
+    if (id_string == NULL || username == NULL || email == NULL)
+    {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    statement->rowToInsert.id = 0;
+    statement->rowToInsert.username[0] = '\0';
+    statement->rowToInsert.email[0] = '\0';
+
+    PrepareResult result = parseIdOrParam(id_string, &(statement->rowToInsert.id),
+                                          statement, PARAM_ID);
+    if (result != PREPARE_SUCCESS)
+    {
+        return result;
+    }
+
+    if (isPlaceholder(username))
+    {
+        addParam(statement, PARAM_USERNAME);
+    }
+    else if (strlen(username) > COLUMN_USERNAME_SIZE)
+    {
+        return PREPARE_STRING_TOO_LONG;
+    }
+    else
+    {
+        strcpy(statement->rowToInsert.username, username);
+    }
+
+    if (isPlaceholder(email))
+    {
+        addParam(statement, PARAM_EMAIL);
+    }
+    else if (strlen(email) > COLUMN_EMAIL_SIZE)
+    {
+        return PREPARE_STRING_TOO_LONG;
+    }
+    else
+    {
+        strcpy(statement->rowToInsert.email, email);
+    }
+
+    return PREPARE_SUCCESS;
+}
+
+/**
+ * @brief the table column a statement calls name, if there is one
+ */
+static bool columnByName(const char *name, Column *column)
+{
+    for (uint32_t i = 0; i < TABLE_ROW_NUM_COLUMNS; i++)
+    {
+        if (strcmp(name, COLUMN_NAMES[i]) == 0)
+        {
+            *column = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief parse the rest of "where <username | email> = <value>"
+ */
+static PrepareResult prepareTextPredicate(const char *column, const char *op,
+                                          Statement *statement)
+{
+    Predicate *predicate = &(statement->predicate);
+    predicate->type = PREDICATE_TEXT_EQUAL;
+    predicate->column = strcmp(column, "username") == 0 ? COLUMN_USERNAME : COLUMN_EMAIL;
+    predicate->value[0] = '\0';
+
+    char *value = strtok(NULL, " ");
+    if (strcmp(op, "=") != 0 || value == NULL || strtok(NULL, " ") != NULL)
+    {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    if (isPlaceholder(value))
+    {
+        return addParam(statement, PARAM_TEXT_EQUAL) ? PREPARE_SUCCESS : PREPARE_SYNTAX_ERROR;
+    }
+    if (strlen(value) > COLUMN_MAX_LENGTHS[predicate->column])
+    {
+        return PREPARE_STRING_TOO_LONG;
+    }
+    strcpy(predicate->value, value);
+    return PREPARE_SUCCESS;
+}
+
+static PrepareResult prepareWhereClause(char *where, Statement *statement);
+
+static PrepareResult prepareSelectStatement(char *buffer, Statement *statement)
+{
+    char *keyword = strtok(buffer, " ");
+    if (strcmp(keyword, "select") != 0)
+    {
+        return PREPARE_UNRECOGNIZED_STATEMENT;
+    }
+
+    // select [* | <column>[, <column>...]] ...
+    // where a column is id, username or email, or all of them are
+    // aggregates: count(*), min(id) or max(id)
+    Projection *projection = &(statement->projection);
+    projection->numColumns = 0;
+    uint32_t numAggregates = 0;
+    char *where = strtok(NULL, " ,");
+    while (where != NULL && strcmp(where, "where") != 0)
+    {
+        if (strcmp(where, "*") == 0)
+        {
+            where = strtok(NULL, " ,");
+            break;
+        }
+        if (projection->numColumns == PROJECTION_MAX_COLUMNS)
+        {
+            return PREPARE_SYNTAX_ERROR;
+        }
+        Column *column = &(projection->columns[projection->numColumns++]);
+        if (strcmp(where, "count(*)") == 0)
+        {
+            *column = COLUMN_COUNT;
+            numAggregates++;
+        }
+        else if (strcmp(where, "min(id)") == 0)
+        {
+            *column = COLUMN_MIN_ID;
+            numAggregates++;
+        }
+        else if (strcmp(where, "max(id)") == 0)
+        {
+            *column = COLUMN_MAX_ID;
+            numAggregates++;
+        }
+        else if (!columnByName(where, column))
+        {
+            return PREPARE_SYNTAX_ERROR;
+        }
+        where = strtok(NULL, " ,");
+    }
+    if (numAggregates > 0 && numAggregates != projection->numColumns)
+    {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    if (projection->numColumns == 0)
+    {
+        for (uint32_t i = 0; i < TABLE_ROW_NUM_COLUMNS; i++)
+        {
+            projection->columns[i] = i;
+        }
+        projection->numColumns = TABLE_ROW_NUM_COLUMNS;
+    }
+
+    return prepareWhereClause(where, statement);
+}
+
+/**
+ * @brief parse an optional where clause into the statement's predicate
+ * @param where the token after the statement's other clauses, or NULL
+ */
+static PrepareResult prepareWhereClause(char *where, Statement *statement)
+{
+    Predicate *predicate = &(statement->predicate);
+    predicate->type = PREDICATE_NONE;
+    predicate->lowId = 0;
+    predicate->highId = UINT32_MAX;
+    if (where == NULL)
+    {
+        return PREPARE_SUCCESS;
+    }
+
+    // where id = <id>
+    // where id between <low> and <high>
+    // where username = <username>
+    // where email = <email>
+    // Any <id> or text value may be a "?" placeholder
+    char *column = strtok(NULL, " ");
+    char *op = strtok(NULL, " ");
+    if (strcmp(where, "where") != 0 || column == NULL || op == NULL)
+    {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    if (strcmp(column, "username") == 0 || strcmp(column, "email") == 0)
+    {
+        return prepareTextPredicate(column, op, statement);
+    }
+    if (strcmp(column, "id") != 0)
+    {
+        return PREPARE_SYNTAX_ERROR;
+    }
+
+    predicate->type = PREDICATE_ID_RANGE;
+    if (strcmp(op, "=") == 0)
+    {
+        PrepareResult result = parseIdOrParam(strtok(NULL, " "),
+                                              &(predicate->lowId), statement,
+                                              PARAM_ID_EQUAL);
+        if (result != PREPARE_SUCCESS)
+        {
+            return result;
+        }
+        predicate->highId = predicate->lowId;
+    }
+    else if (strcmp(op, "between") == 0)
+    {
+        PrepareResult result = parseIdOrParam(strtok(NULL, " "),
+                                              &(predicate->lowId), statement,
+                                              PARAM_LOW_ID);
+        if (result != PREPARE_SUCCESS)
+        {
+            return result;
+        }
+        char *and = strtok(NULL, " ");
+        if (and == NULL || strcmp(and, "and") != 0)
+        {
+            return PREPARE_SYNTAX_ERROR;
+        }
+        result = parseIdOrParam(strtok(NULL, " "), &(predicate->highId),
+                                statement, PARAM_HIGH_ID);
+        if (result != PREPARE_SUCCESS)
+        {
+            return result;
+        }
+    }
+    else
+    {
+        return PREPARE_SYNTAX_ERROR;
+    }
+
+    if (strtok(NULL, " ") != NULL)
+    {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    return PREPARE_SUCCESS;
+}
+
+static PrepareResult prepareDeleteStatement(char *buffer, Statement *statement)
+{
+    // delete [where ...]; with no where clause every row goes
+    char *keyword = strtok(buffer, " ");
+    if (strcmp(keyword, "delete") != 0)
+    {
+        return PREPARE_UNRECOGNIZED_STATEMENT;
+    }
+    return prepareWhereClause(strtok(NULL, " "), statement);
+}
+
+/**
+ * @brief begin, commit or rollback, with nothing after the keyword
+ */
+static PrepareResult prepareTransactionStatement(char *buffer, Statement *statement)
+{
+    char *keyword = strtok(buffer, " ");
+    if (strcmp(keyword, "begin") == 0)
+    {
+        statement->type = STATEMENT_BEGIN;
+    }
+    else if (strcmp(keyword, "commit") == 0)
+    {
+        statement->type = STATEMENT_COMMIT;
+    }
+    else if (strcmp(keyword, "rollback") == 0)
+    {
+        statement->type = STATEMENT_ROLLBACK;
+    }
+    else
+    {
+        return PREPARE_UNRECOGNIZED_STATEMENT;
+    }
+    return strtok(NULL, " ") == NULL ? PREPARE_SUCCESS : PREPARE_SYNTAX_ERROR;
+}
+
+PrepareResult prepareStatement(const char *sql, Statement *statement)
+{
+    uint64_t start = monotonicNanos();
+    statement->numParams = 0;
+    PrepareResult result = PREPARE_UNRECOGNIZED_STATEMENT;
+    // The tokenizer writes into its input
+    char *buffer = strdup(sql);
+    if (strncmp(buffer, "insert", 6) == 0)
+    {
+        statement->type = STATEMENT_INSERT;
+        result = prepareInsertStatement(buffer, statement);
+    }
+    else if (strncmp(buffer, "select", 6) == 0)
+    {
+        statement->type = STATEMENT_SELECT;
+        result = prepareSelectStatement(buffer, statement);
+    }
+    else if (strncmp(buffer, "delete", 6) == 0)
+    {
+        statement->type = STATEMENT_DELETE;
+        result = prepareDeleteStatement(buffer, statement);
+    }
+    else if (strncmp(buffer, "begin", 5) == 0 || strncmp(buffer, "commit", 6) == 0 ||
+             strncmp(buffer, "rollback", 8) == 0)
+    {
+        result = prepareTransactionStatement(buffer, statement);
+    }
+    free(buffer);
+    countLatency(STAT_PREPARE_NANOS, start);
+    return result;
+}
+
+BindResult bindId(Statement *statement, uint32_t index, uint32_t value)
+{
+    if (index >= statement->numParams)
+    {
+        return BIND_OUT_OF_RANGE;
+    }
+    switch (statement->params[index])
+    {
+    case (PARAM_ID):
+        statement->rowToInsert.id = value;
+        return BIND_SUCCESS;
+    case (PARAM_ID_EQUAL):
+        statement->predicate.lowId = value;
+        statement->predicate.highId = value;
+        return BIND_SUCCESS;
+    case (PARAM_LOW_ID):
+        statement->predicate.lowId = value;
+        return BIND_SUCCESS;
+    case (PARAM_HIGH_ID):
+        statement->predicate.highId = value;
+        return BIND_SUCCESS;
+    default:
+        return BIND_TYPE_MISMATCH;
+    }
+}
+
+BindResult bindText(Statement *statement, uint32_t index, const char *value,
+                    uint32_t length)
+{
+    if (index >= statement->numParams)
+    {
+        return BIND_OUT_OF_RANGE;
+    }
+    char *dest;
+    uint32_t maxLength;
+    switch (statement->params[index])
+    {
+    case (PARAM_USERNAME):
+        dest = statement->rowToInsert.username;
+        maxLength = COLUMN_USERNAME_SIZE;
+        break;
+    case (PARAM_EMAIL):
+        dest = statement->rowToInsert.email;
+        maxLength = COLUMN_EMAIL_SIZE;
+        break;
+    case (PARAM_TEXT_EQUAL):
+        dest = statement->predicate.value;
+        maxLength = COLUMN_MAX_LENGTHS[statement->predicate.column];
+        break;
+    default:
+        return BIND_TYPE_MISMATCH;
+    }
+    if (length > maxLength)
+    {
+        return BIND_STRING_TOO_LONG;
+    }
+    memcpy(dest, value, length);
+    dest[length] = '\0';
+    return BIND_SUCCESS;
+}
+
+ExecuteResult executeInsertStatement(Statement *statement, Table *table)
+{
+    if (table->partitions != NULL)
+    {
+        table = &table->partitions[partitionOf(table, statement->rowToInsert.id)];
+    }
+    if (!tableInsert(table, &(statement->rowToInsert)))
+    {
+        return EXECUTE_DUPLICATE_KEY;
+    }
+    commitPager(table->pager);
+    return EXECUTE_SUCCESS;
+}
+
+/**
+ * @brief the partitions a statement may change or read
+ */
+static void statementSpan(Statement *statement, Table *table, uint32_t *first, uint32_t *last)
+{
+    Predicate *predicate = &(statement->predicate);
+    if (table->partitions == NULL)
+    {
+        *first = 0;
+        *last = 0;
+    }
+    else if (statement->type == STATEMENT_INSERT)
+    {
+        *first = partitionOf(table, statement->rowToInsert.id);
+        *last = *first;
+    }
+    else if (statement->type == STATEMENT_SELECT || statement->type == STATEMENT_DELETE)
+    {
+        partitionSpan(table, predicate->lowId, predicate->highId, first, last);
+        if (predicate->type == PREDICATE_TEXT_EQUAL)
+        {
+            *first = 0;
+            *last = table->numPartitions - 1;
+        }
+    }
+    else
+    {
+        *first = 0;
+        *last = table->numPartitions - 1;
+    }
+}
+
+ExecuteResult executeDeleteStatement(Statement *statement, Table *table)
+{
+    if (table->partitions != NULL)
+    {
+        uint32_t first;
+        uint32_t last;
+        statementSpan(statement, table, &first, &last);
+        // Outside a transaction the partitions commit the delete together
+        bool autocommit = !table->pager->inTransaction;
+        for (uint32_t i = first; i <= last && autocommit; i++)
+        {
+            Pager *pager = table->partitions[i].pager;
+            pager->inTransaction = true;
+            pager->transactionNumPages = pager->numPages;
+        }
+        for (uint32_t i = first; i <= last; i++)
+        {
+            executeDeleteStatement(statement, &table->partitions[i]);
+        }
+        for (uint32_t i = first; i <= last && autocommit; i++)
+        {
+            table->partitions[i].pager->inTransaction = false;
+        }
+        if (autocommit)
+        {
+            commitParts(table, first, last);
+        }
+        return EXECUTE_SUCCESS;
+    }
+
+    Predicate *predicate = &(statement->predicate);
+    if (predicate->type == PREDICATE_TEXT_EQUAL)
+    {
+        // Deletes change the index, so collect every match first
+        uint32_t numIds = 0;
+        uint32_t capacity = 16;
+        uint32_t *ids = malloc(sizeof(uint32_t) * capacity);
+        IndexProbe probe;
+        indexProbeBegin(&probe, tableIndex(table, predicate->column), predicate->value,
+                        strlen(predicate->value));
+        uint32_t id;
+        while (indexProbeNext(&probe, &id))
+        {
+            if (numIds == capacity)
+            {
+                capacity *= 2;
+                ids = realloc(ids, sizeof(uint32_t) * capacity);
+            }
+            ids[numIds++] = id;
+        }
+        for (uint32_t i = 0; i < numIds; i++)
+        {
+            tableDelete(table, ids[i]);
+        }
+        free(ids);
+    }
+    else
+    {
+        uint32_t low = predicate->lowId;
+        while (low <= predicate->highId)
+        {
+            Cursor cursor;
+            tableSeek(table, low, &cursor);
+            if (cursor.EOT)
+            {
+                break;
+            }
+            uint32_t key = cursorKey(&cursor);
+            if (key > predicate->highId)
+            {
+                break;
+            }
+            tableDelete(table, key);
+            if (key == UINT32_MAX)
+            {
+                break;
+            }
+            low = key + 1;
+        }
+    }
+    commitPager(table->pager);
+    return EXECUTE_SUCCESS;
+}
+
+/**
+ * @brief append the leaves that may hold keys in [lowId, highId], in order
+ *
+ * Only internal nodes are read.
+ */
+static void collectLeaves(Pager *pager, uint32_t pageNum, uint32_t lowId,
+                          uint32_t highId, ParallelScan *scan)
+{
+    void *node = readPage(pager, pageNum);
+    if (isLeafNode(node))
+    {
+        releasePage(pager, pageNum, node);
+        // Grow by doubling; a power of two count means the array is full
+        if ((scan->numLeaves & (scan->numLeaves - 1)) == 0)
+        {
+            uint32_t capacity = scan->numLeaves == 0 ? 1 : scan->numLeaves * 2;
+            scan->leaves = realloc(scan->leaves, sizeof(uint32_t) * capacity);
+        }
+        scan->leaves[scan->numLeaves++] = pageNum;
+        return;
+    }
+
+    uint32_t numKeys = *internalNodeNumKeys(node);
+    for (uint32_t i = internalNodeFindChild(node, treeKey(lowId, 0)); i <= numKeys; i++)
+    {
+        collectLeaves(pager, *internalNodeChild(node, i), lowId, highId, scan);
+        if (i < numKeys && *internalNodeKey(node, i) >= highId)
+        {
+            break;
+        }
+    }
+    releasePage(pager, pageNum, node);
+}
+
+/**
+ * @brief claim and fill chunks until none are left
+ */
+static void scanChunks(ParallelScan *scan)
+{
+    Pager *pager = scan->table->pager;
+    Predicate *predicate = &(scan->statement->predicate);
+    Projection *projection = &(scan->statement->projection);
+
+    while (!atomic_load(&scan->failed))
+    {
+        uint32_t chunkNum = atomic_fetch_add(&scan->nextChunk, 1);
+        if (chunkNum >= scan->numChunks)
+        {
+            return;
+        }
+        ScanChunk *chunk = &scan->chunks[chunkNum];
+        bool output = scan->sink != NULL;
+        if (output)
+        {
+            pthread_mutex_lock(&scan->lock);
+            while (chunkNum >= scan->numPrinted + SCAN_CHUNKS_AHEAD * scan->numThreads &&
+                   !atomic_load(&scan->failed))
+            {
+                pthread_cond_wait(&scan->chunkDone, &scan->lock);
+            }
+            pthread_mutex_unlock(&scan->lock);
+            sinkOpenMemory(&chunk->sink, scan->sink->format);
+        }
+
+        uint32_t first = chunkNum * SCAN_LEAVES_PER_CHUNK;
+        uint32_t last = first + SCAN_LEAVES_PER_CHUNK;
+        if (last > scan->numLeaves)
+        {
+            last = scan->numLeaves;
+        }
+        // Start the whole chunk reading before waiting on its first leaf
+        prefetchPages(pager, &scan->leaves[first], last - first);
+        for (uint32_t i = first; i < last; i++)
+        {
+            uint32_t pageNum = scan->leaves[i];
+            void *node = readPage(pager, pageNum);
+            countStat(STAT_ROWS_SCANNED, *leafNodeNumCells(node));
+            if (output)
+            {
+                uint64_t selected[LEAF_MASK_WORDS];
+                leafNodeSelectKeys(node, predicate->lowId, predicate->highId, selected);
+                printSelectedRows(&chunk->sink, node, selected, projection);
+            }
+            releasePage(pager, pageNum, node);
+        }
+
+        pthread_mutex_lock(&scan->lock);
+        chunk->done = true;
+        pthread_cond_broadcast(&scan->chunkDone);
+        pthread_mutex_unlock(&scan->lock);
+    }
+}
+
+static void *scanWorker(void *arg)
+{
+    ParallelScan *scan = arg;
+    // A worker has no caller to return an error to; it hands the first one
+    // to the thread that started the scan
+    ErrorScope scope;
+    errorScope = &scope;
+    if (setjmp(scope.jump) != 0)
+    {
+        pthread_mutex_lock(&scan->lock);
+        if (!atomic_load(&scan->failed))
+        {
+            scan->errorCode = scope.code;
+            memcpy(scan->errorMessage, scope.message, ERROR_MESSAGE_SIZE);
+            atomic_store(&scan->failed, true);
+        }
+        pthread_cond_broadcast(&scan->chunkDone);
+        pthread_mutex_unlock(&scan->lock);
+        return NULL;
+    }
+    scanChunks(scan);
+    return NULL;
+}
+
+/**
+ * @brief run a select on table->scanThreads workers
+ *
+ * Output matches the sequential scan row for row.
+ * @return false, having done nothing, if the range is too small to split
+ */
+static bool parallelScan(Statement *statement, Table *table, ResultSink *sink)
+{
+    ParallelScan scan = {
+        .table = table,
+        .statement = statement,
+        .sink = sink,
+    };
+    collectLeaves(table->pager, table->rootPageNum, statement->predicate.lowId,
+                  statement->predicate.highId, &scan);
+    if (scan.numLeaves <= SCAN_LEAVES_PER_CHUNK)
+    {
+        free(scan.leaves);
+        return false;
+    }
+
+    scan.numChunks = (scan.numLeaves + SCAN_LEAVES_PER_CHUNK - 1) / SCAN_LEAVES_PER_CHUNK;
+    scan.chunks = calloc(scan.numChunks, sizeof(ScanChunk));
+    atomic_init(&scan.nextChunk, 0);
+    atomic_init(&scan.failed, false);
+    pthread_mutex_init(&scan.lock, NULL);
+    pthread_cond_init(&scan.chunkDone, NULL);
+
+    scan.numThreads = table->scanThreads;
+    if (scan.numThreads > scan.numChunks)
+    {
+        scan.numThreads = scan.numChunks;
+    }
+    pthread_t threads[MAX_SCAN_THREADS];
+    uint32_t numStarted = 0;
+    while (numStarted < scan.numThreads)
+    {
+        if (pthread_create(&threads[numStarted], NULL, scanWorker, &scan) != 0)
+        {
+            pthread_mutex_lock(&scan.lock);
+            if (!atomic_load(&scan.failed))
+            {
+                scan.errorCode = DB_ERROR_INTERNAL;
+                snprintf(scan.errorMessage, ERROR_MESSAGE_SIZE,
+                         "Error starting scan thread: %d", errno);
+                atomic_store(&scan.failed, true);
+            }
+            pthread_mutex_unlock(&scan.lock);
+            break;
+        }
+        numStarted++;
+    }
+
+    // Workers wait on the chunks printed, so an error writing them stops
+    // the scan before it goes on
+    ErrorScope scope;
+    ErrorScope *outer = errorScope;
+    errorScope = &scope;
+    if (setjmp(scope.jump) != 0)
+    {
+        pthread_mutex_lock(&scan.lock);
+        if (!atomic_load(&scan.failed))
+        {
+            scan.errorCode = scope.code;
+            memcpy(scan.errorMessage, scope.message, ERROR_MESSAGE_SIZE);
+            atomic_store(&scan.failed, true);
+        }
+        pthread_cond_broadcast(&scan.chunkDone);
+        pthread_mutex_unlock(&scan.lock);
+    }
+    else
+    {
+        for (uint32_t i = 0; i < scan.numChunks && numStarted > 0; i++)
+        {
+            ScanChunk *chunk = &scan.chunks[i];
+            pthread_mutex_lock(&scan.lock);
+            while (!chunk->done && !atomic_load(&scan.failed))
+            {
+                pthread_cond_wait(&scan.chunkDone, &scan.lock);
+            }
+            bool ready = chunk->done;
+            pthread_mutex_unlock(&scan.lock);
+            if (!ready)
+            {
+                break;
+            }
+            if (sink != NULL)
+            {
+                sinkAppend(sink, &chunk->sink);
+                free(chunk->sink.buffer);
+                chunk->sink.buffer = NULL;
+                pthread_mutex_lock(&scan.lock);
+                scan.numPrinted = i + 1;
+                pthread_cond_broadcast(&scan.chunkDone);
+                pthread_mutex_unlock(&scan.lock);
+            }
+        }
+    }
+    errorScope = outer;
+
+    for (uint32_t i = 0; i < numStarted; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+    for (uint32_t i = 0; i < scan.numChunks; i++)
+    {
+        // Chunks after a failure were never printed
+        free(scan.chunks[i].sink.buffer);
+    }
+    pthread_mutex_destroy(&scan.lock);
+    pthread_cond_destroy(&scan.chunkDone);
+    free(scan.chunks);
+    free(scan.leaves);
+    if (atomic_load(&scan.failed))
+    {
+        fatalError(scan.errorCode, "%s", scan.errorMessage);
+    }
+    return true;
+}
+
+/**
+ * @brief run a select on an indexed column: a few page reads per match
+ */
+static void executeIndexSelect(Statement *statement, Table *table, ResultSink *sink)
+{
+    Predicate *predicate = &(statement->predicate);
+    IndexProbe probe;
+    indexProbeBegin(&probe, tableIndex(table, predicate->column), predicate->value,
+                    strlen(predicate->value));
+    uint32_t id;
+    while (indexProbeNext(&probe, &id))
+    {
+        Cursor cursor;
+        void *node = indexedRow(table, id, &cursor);
+        countStat(STAT_ROWS_SCANNED, 1);
+        if (sink != NULL)
+        {
+            printRow(sink, node, cursor.cellNum, &(statement->projection));
+            countStat(STAT_ROWS_RETURNED, 1);
+        }
+        cursorRelease(&cursor);
+    }
+}
+
+/**
+ * @brief run a select on ids with one cursor
+ */
+static void scanRows(Statement *statement, Table *table, ResultSink *sink)
+{
+    Predicate *predicate = &(statement->predicate);
+    // Rows are in key order, so a range scan ends at the first leaf that
+    // goes past it. Each leaf's ids are filtered in one pass.
+    Cursor cursor;
+    tableSeek(table, predicate->lowId, &cursor);
+    while (!(cursor.EOT))
+    {
+        void *node = cursorLeaf(&cursor);
+        uint32_t numCells = *leafNodeNumCells(node);
+        bool pastRange = numCells > 0 &&
+                         *leafNodeKey(node, numCells - 1) > predicate->highId;
+        countStat(STAT_ROWS_SCANNED, numCells);
+        if (sink != NULL)
+        {
+            uint64_t selected[LEAF_MASK_WORDS];
+            leafNodeSelectKeys(node, predicate->lowId, predicate->highId, selected);
+            printSelectedRows(sink, node, selected, &(statement->projection));
+        }
+        cursorRelease(&cursor);
+        if (pastRange)
+        {
+            break;
+        }
+        // Step off the last cell, onto the next leaf
+        cursor.cellNum = numCells > 0 ? numCells - 1 : 0;
+        cursorAdvance(&cursor);
+    }
+}
+
+/**
+ * @brief run a select on one unpartitioned table
+ * @param sink NULL to only count rows
+ */
+static void selectRows(Statement *statement, Table *table, ResultSink *sink)
+{
+    if (statement->predicate.type == PREDICATE_TEXT_EQUAL)
+    {
+        executeIndexSelect(statement, table, sink);
+    }
+    else if (table->scanThreads == 1 || !parallelScan(statement, table, sink))
+    {
+        scanRows(statement, table, sink);
+    }
+}
+
+/**
+ * @brief fill batches of a claimed partition until it has no more room or
+ * is finished, then let it go
+ */
+static void scanPartitionRows(PartitionScan *scan, uint32_t partition)
+{
+    Table *table = &scan->table->partitions[scan->first + partition];
+    PartitionQueue *queue = &scan->parts[partition];
+    Predicate *predicate = &(scan->statement->predicate);
+    Projection *projection = &(scan->statement->projection);
+
+    // Only the worker holding the partition fills batches past the ready
+    // ones, or moves resumeId
+    pthread_mutex_lock(&scan->lock);
+    PartitionRows *rows = &queue->batches[(queue->head + queue->numReady) %
+                                          PARTITION_SCAN_BATCHES];
+    pthread_mutex_unlock(&scan->lock);
+    uint32_t resumeId = queue->resumeId;
+    rows->numRows = 0;
+    rows->sink.used = 0;
+
+    Cursor cursor;
+    tableSeek(table, resumeId, &cursor);
+    while (true)
+    {
+        bool finished = cursor.EOT;
+        if (!finished)
+        {
+            void *node = cursorLeaf(&cursor);
+            uint32_t numCells = *leafNodeNumCells(node);
+            uint32_t lastKey = numCells > 0 ? *leafNodeKey(node, numCells - 1) : 0;
+            countStat(STAT_ROWS_SCANNED, numCells);
+            uint64_t selected[LEAF_MASK_WORDS];
+            leafNodeSelectKeys(node, predicate->lowId, predicate->highId, selected);
+            for (uint32_t word = 0; word < LEAF_MASK_WORDS; word++)
+            {
+                for (uint64_t bits = selected[word]; bits != 0; bits &= bits - 1)
+                {
+                    uint32_t cellNum = word * 64 + __builtin_ctzll(bits);
+                    if (rows->numRows == rows->capacity)
+                    {
+                        rows->capacity = rows->capacity == 0 ? 256 : rows->capacity * 2;
+                        rows->ids = realloc(rows->ids, sizeof(uint32_t) * rows->capacity);
+                        rows->ends = realloc(rows->ends, sizeof(size_t) * rows->capacity);
+                    }
+                    printRow(&rows->sink, node, cellNum, projection);
+                    rows->ids[rows->numRows] = leafNodeRowId(node, cellNum);
+                    rows->ends[rows->numRows++] = rows->sink.used;
+                }
+            }
+            cursorRelease(&cursor);
+            finished = lastKey >= predicate->highId;
+            if (numCells > 0)
+            {
+                resumeId = lastKey + 1;
+            }
+            if (!finished)
+            {
+                cursor.cellNum = numCells > 0 ? numCells - 1 : 0;
+                cursorAdvance(&cursor);
+            }
+        }
+        if (!finished && rows->numRows < PARTITION_SCAN_BATCH_ROWS)
+        {
+            continue;
+        }
+
+        countStat(STAT_ROWS_RETURNED, rows->numRows);
+        pthread_mutex_lock(&scan->lock);
+        queue->numReady += rows->numRows > 0;
+        queue->resumeId = resumeId;
+        queue->finished = finished;
+        scan->numFinished += finished;
+        bool room = !finished && queue->numReady < PARTITION_SCAN_BATCHES;
+        if (room)
+        {
+            rows = &queue->batches[(queue->head + queue->numReady) % PARTITION_SCAN_BATCHES];
+        }
+        else
+        {
+            queue->claimed = false;
+        }
+        pthread_cond_broadcast(&scan->changed);
+        pthread_mutex_unlock(&scan->lock);
+        if (!room)
+        {
+            return;
+        }
+        rows->numRows = 0;
+        rows->sink.used = 0;
+    }
+}
+
+/**
+ * @brief the unclaimed partition with the fewest batches ready, claimed,
+ * waiting for one to have room; numParts once every partition is finished
+ */
+static uint32_t claimPartition(PartitionScan *scan)
+{
+    pthread_mutex_lock(&scan->lock);
+    uint32_t partition = scan->numParts;
+    while (!atomic_load(&scan->failed) && scan->numFinished < scan->numParts)
+    {
+        for (uint32_t i = 0; i < scan->numParts; i++)
+        {
+            PartitionQueue *queue = &scan->parts[i];
+            if (!queue->claimed && !queue->finished &&
+                queue->numReady < PARTITION_SCAN_BATCHES &&
+                (partition == scan->numParts ||
+                 queue->numReady < scan->parts[partition].numReady))
+            {
+                partition = i;
+            }
+        }
+        if (partition < scan->numParts)
+        {
+            scan->parts[partition].claimed = true;
+            break;
+        }
+        pthread_cond_wait(&scan->changed, &scan->lock);
+    }
+    pthread_mutex_unlock(&scan->lock);
+    return partition;
+}
+
+static void *partitionScanWorker(void *arg)
+{
+    PartitionScan *scan = arg;
+    ErrorScope scope;
+    errorScope = &scope;
+    if (setjmp(scope.jump) != 0)
+    {
+        pthread_mutex_lock(&scan->lock);
+        if (!atomic_load(&scan->failed))
+        {
+            scan->errorCode = scope.code;
+            memcpy(scan->errorMessage, scope.message, ERROR_MESSAGE_SIZE);
+            atomic_store(&scan->failed, true);
+        }
+        pthread_cond_broadcast(&scan->changed);
+        pthread_mutex_unlock(&scan->lock);
+        return NULL;
+    }
+    while (true)
+    {
+        uint32_t partition = claimPartition(scan);
+        if (partition == scan->numParts)
+        {
+            break;
+        }
+        scanPartitionRows(scan, partition);
+    }
+    return NULL;
+}
+
+/**
+ * @brief the next batch of a partition ready to merge, waiting for it;
+ * NULL once the partition has no more
+ */
+static PartitionRows *partitionBatch(PartitionScan *scan, uint32_t partition)
+{
+    PartitionQueue *queue = &scan->parts[partition];
+    pthread_mutex_lock(&scan->lock);
+    while (queue->numReady == 0 && !queue->finished && !atomic_load(&scan->failed))
+    {
+        pthread_cond_wait(&scan->changed, &scan->lock);
+    }
+    PartitionRows *rows = queue->numReady > 0 && !atomic_load(&scan->failed)
+                              ? &queue->batches[queue->head]
+                              : NULL;
+    pthread_mutex_unlock(&scan->lock);
+    return rows;
+}
+
+/**
+ * @brief hand a merged batch back to its partition to be filled again
+ */
+static void partitionBatchDone(PartitionScan *scan, uint32_t partition)
+{
+    PartitionQueue *queue = &scan->parts[partition];
+    pthread_mutex_lock(&scan->lock);
+    queue->head = (queue->head + 1) % PARTITION_SCAN_BATCHES;
+    queue->numReady--;
+    pthread_cond_broadcast(&scan->changed);
+    pthread_mutex_unlock(&scan->lock);
+}
+
+/**
+ * @brief write hash partitions first to last to sink merged by id, as
+ * scanThreads workers scan them
+ */
+static void partitionScan(Statement *statement, Table *table, uint32_t first, uint32_t last,
+                          ResultSink *sink)
+{
+    PartitionScan scan = {
+        .table = table,
+        .statement = statement,
+        .format = sink->format,
+        .first = first,
+        .numParts = last - first + 1,
+    };
+    scan.parts = calloc(scan.numParts, sizeof(PartitionQueue));
+    for (uint32_t i = 0; i < scan.numParts; i++)
+    {
+        scan.parts[i].resumeId = statement->predicate.lowId;
+        for (uint32_t j = 0; j < PARTITION_SCAN_BATCHES; j++)
+        {
+            sinkOpenMemory(&scan.parts[i].batches[j].sink, scan.format);
+        }
+    }
+    atomic_init(&scan.failed, false);
+    pthread_mutex_init(&scan.lock, NULL);
+    pthread_cond_init(&scan.changed, NULL);
+
+    uint32_t numThreads = table->scanThreads < scan.numParts ? table->scanThreads
+                                                             : scan.numParts;
+    pthread_t threads[MAX_SCAN_THREADS];
+    volatile uint32_t numStarted = 0;
+    while (numStarted < numThreads &&
+           pthread_create(&threads[numStarted], NULL, partitionScanWorker, &scan) == 0)
+    {
+        numStarted++;
+    }
+    if (numStarted == 0)
+    {
+        scan.errorCode = DB_ERROR_INTERNAL;
+        snprintf(scan.errorMessage, ERROR_MESSAGE_SIZE, "Error starting scan thread: %d",
+                 errno);
+        atomic_store(&scan.failed, true);
+    }
+
+    // Workers wait on the merge for room, so an error writing rows stops
+    // the scan before it goes on
+    ErrorScope scope;
+    ErrorScope *outer = errorScope;
+    errorScope = &scope;
+    if (setjmp(scope.jump) != 0)
+    {
+        pthread_mutex_lock(&scan.lock);
+        if (!atomic_load(&scan.failed))
+        {
+            scan.errorCode = scope.code;
+            memcpy(scan.errorMessage, scope.message, ERROR_MESSAGE_SIZE);
+            atomic_store(&scan.failed, true);
+        }
+        pthread_cond_broadcast(&scan.changed);
+        pthread_mutex_unlock(&scan.lock);
+    }
+    else
+    {
+        PartitionRows *batches[MAX_PARTITIONS];
+        uint32_t next[MAX_PARTITIONS] = {0};
+        for (uint32_t i = 0; i < scan.numParts; i++)
+        {
+            batches[i] = partitionBatch(&scan, i);
+        }
+        while (!atomic_load(&scan.failed))
+        {
+            // The partition with the lowest next id writes every row of its
+            // batch below the others' lowest
+            uint32_t lowest = UINT32_MAX;
+            uint32_t secondLowest = UINT32_MAX;
+            uint32_t from = scan.numParts;
+            for (uint32_t i = 0; i < scan.numParts; i++)
+            {
+                if (batches[i] == NULL)
+                {
+                    continue;
+                }
+                uint32_t id = batches[i]->ids[next[i]];
+                if (from == scan.numParts || id < lowest)
+                {
+                    secondLowest = lowest;
+                    lowest = id;
+                    from = i;
+                }
+                else if (id < secondLowest)
+                {
+                    secondLowest = id;
+                }
+            }
+            if (from == scan.numParts)
+            {
+                break;
+            }
+            PartitionRows *rows = batches[from];
+            size_t start = next[from] > 0 ? rows->ends[next[from] - 1] : 0;
+            uint32_t end = next[from] + 1;
+            while (end < rows->numRows && rows->ids[end] < secondLowest)
+            {
+                end++;
+            }
+            sinkWrite(sink, rows->sink.buffer + start, rows->ends[end - 1] - start);
+            next[from] = end;
+            if (end == rows->numRows)
+            {
+                partitionBatchDone(&scan, from);
+                batches[from] = partitionBatch(&scan, from);
+                next[from] = 0;
+            }
+        }
+    }
+    errorScope = outer;
+
+    for (uint32_t i = 0; i < numStarted; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+    for (uint32_t i = 0; i < scan.numParts; i++)
+    {
+        for (uint32_t j = 0; j < PARTITION_SCAN_BATCHES; j++)
+        {
+            free(scan.parts[i].batches[j].sink.buffer);
+            free(scan.parts[i].batches[j].ids);
+            free(scan.parts[i].batches[j].ends);
+        }
+    }
+    free(scan.parts);
+    pthread_mutex_destroy(&scan.lock);
+    pthread_cond_destroy(&scan.changed);
+    if (atomic_load(&scan.failed))
+    {
+        fatalError(scan.errorCode, "%s", scan.errorMessage);
+    }
+}
+
+/**
+ * @brief write hash partitions' rows in id order with one cursor each
+ *
+ * Every cursor keeps its current leaf pinned, one frame of each
+ * partition's pool.
+ */
+static void mergePartitions(Statement *statement, Table *table, uint32_t first, uint32_t last,
+                            ResultSink *sink)
+{
+    Predicate *predicate = &(statement->predicate);
+    Cursor cursors[MAX_PARTITIONS];
+    uint32_t numCursors = 0;
+    for (uint32_t i = first; i <= last; i++)
+    {
+        Cursor *cursor = &cursors[numCursors];
+        tableSeek(&table->partitions[i], predicate->lowId, cursor);
+        if (!cursor->EOT)
+        {
+            countStat(STAT_ROWS_SCANNED, *leafNodeNumCells(cursorLeaf(cursor)));
+            numCursors++;
+        }
+    }
+
+    while (numCursors > 0)
+    {
+        uint32_t from = 0;
+        for (uint32_t i = 1; i < numCursors; i++)
+        {
+            if (leafNodeRowId(cursors[i].page, cursors[i].cellNum) <
+                leafNodeRowId(cursors[from].page, cursors[from].cellNum))
+            {
+                from = i;
+            }
+        }
+        Cursor *cursor = &cursors[from];
+        if (leafNodeRowId(cursor->page, cursor->cellNum) > predicate->highId)
+        {
+            break;
+        }
+        printRow(sink, cursor->page, cursor->cellNum, &(statement->projection));
+        countStat(STAT_ROWS_RETURNED, 1);
+
+        // Move on, past any empty leaves
+        cursor->cellNum++;
+        while (cursor->cellNum >= *leafNodeNumCells(cursor->page))
+        {
+            uint32_t nextPageNum = *leafNodeNextLeaf(cursor->page);
+            cursorRelease(cursor);
+            if (nextPageNum == 0)
+            {
+                *cursor = cursors[--numCursors];
+                break;
+            }
+            cursor->pageNum = nextPageNum;
+            cursor->cellNum = 0;
+            countStat(STAT_ROWS_SCANNED, *leafNodeNumCells(cursorLeaf(cursor)));
+        }
+    }
+    for (uint32_t i = 0; i < numCursors; i++)
+    {
+        cursorRelease(&cursors[i]);
+    }
+}
+
+/**
+ * @brief whether a select outputs aggregates rather than rows
+ */
+static bool isAggregate(Projection *projection)
+{
+    // prepareSelectStatement() allows no mix of the two
+    return projection->numColumns > 0 && projection->columns[0] >= COLUMN_COUNT;
+}
+
+static bool projectsColumn(Projection *projection, Column column)
+{
+    for (uint32_t i = 0; i < projection->numColumns; i++)
+    {
+        if (projection->columns[i] == column)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void aggregatesBegin(Aggregates *aggregates)
+{
+    aggregates->empty = true;
+    aggregates->count = 0;
+    aggregates->minId = 0;
+    aggregates->maxId = 0;
+}
+
+/**
+ * @brief fold in count rows whose ids run from minId to maxId
+ */
+static void aggregatesAdd(Aggregates *aggregates, uint32_t minId, uint32_t maxId,
+                          uint32_t count)
+{
+    if (aggregates->empty || minId < aggregates->minId)
+    {
+        aggregates->minId = minId;
+    }
+    if (aggregates->empty || maxId > aggregates->maxId)
+    {
+        aggregates->maxId = maxId;
+    }
+    aggregates->count += count;
+    aggregates->empty = false;
+}
+
+/**
+ * @brief whether column has no value: min(id) or max(id) when no row matched
+ */
+static bool aggregateIsNull(const Aggregates *aggregates, Column column)
+{
+    return aggregates->empty && column != COLUMN_COUNT;
+}
+
+static uint32_t aggregateValue(const Aggregates *aggregates, Column column)
+{
+    switch (column)
+    {
+    case (COLUMN_COUNT):
+        return aggregates->count;
+    case (COLUMN_MIN_ID):
+        return aggregates->minId;
+    case (COLUMN_MAX_ID):
+        return aggregates->maxId;
+    default:
+        return 0;
+    }
+}
+
+/**
+ * @brief format the one row of an aggregate select, its values as ids
+ *
+ * A min(id) or max(id) of no rows has no value: NULL in OUTPUT_TEXT and an
+ * empty field in OUTPUT_CSV. OUTPUT_BINARY writes both as a byte, 1 before
+ * the id or 0 alone when there is none.
+ */
+static void printAggregates(ResultSink *sink, Projection *projection,
+                            const Aggregates *aggregates)
+{
+    OutputFormat format = sink->format;
+    char *p = sinkReserve(sink, 1);
+    if (format == OUTPUT_TEXT)
+    {
+        *p++ = '(';
+    }
+    sink->used = p - sink->buffer;
+    for (uint32_t i = 0; i < projection->numColumns; i++)
+    {
+        p = sinkReserve(sink, SINK_FIELD_MAX);
+        Column column = projection->columns[i];
+        bool isNull = aggregateIsNull(aggregates, column);
+        uint32_t value = aggregateValue(aggregates, column);
+        if (format == OUTPUT_BINARY)
+        {
+            if (column != COLUMN_COUNT)
+            {
+                *p++ = !isNull;
+            }
+            if (!isNull)
+            {
+                memcpy(p, &value, sizeof(value));
+                p += sizeof(value);
+            }
+        }
+        else
+        {
+            if (i > 0)
+            {
+                *p++ = ',';
+                if (format == OUTPUT_TEXT)
+                {
+                    *p++ = ' ';
+                }
+            }
+            if (!isNull)
+            {
+                p = formatId(p, value);
+            }
+            else if (format == OUTPUT_TEXT)
+            {
+                memcpy(p, "NULL", 4);
+                p += 4;
+            }
+        }
+        sink->used = p - sink->buffer;
+    }
+    countStat(STAT_ROWS_RETURNED, 1);
+    if (format == OUTPUT_BINARY)
+    {
+        return;
+    }
+    p = sinkReserve(sink, 2);
+    if (format == OUTPUT_TEXT)
+    {
+        *p++ = ')';
+    }
+    *p++ = '\n';
+    sink->used = p - sink->buffer;
+}
+
+/**
+ * @brief rows in the table, as the file header counts them
+ */
+static uint32_t headerRowCount(Pager *pager)
+{
+    void *header = readPage(pager, HEADER_PAGE_NUM);
+    uint32_t numRows = *headerField(header, HEADER_ROW_COUNT_OFFSET);
+    releasePage(pager, HEADER_PAGE_NUM, header);
+    return numRows;
+}
+
+/**
+ * @brief the largest id <= highId in the subtree at pageNum
+ *
+ * Descends towards highId; a child before that one is only tried when the
+ * one found holds no id low enough, so this is one root-to-leaf path
+ * unless highId falls between two leaves.
+ * @return false if the subtree has no such id
+ */
+static bool treeMaxId(Pager *pager, uint32_t pageNum, uint32_t highId, uint32_t *id)
+{
+    void *node = readPage(pager, pageNum);
+    if (getNodeType(node) != NODE_INTERNAL)
+    {
+        // Binary search for the first key past highId
+        uint32_t low = 0;
+        uint32_t high = *leafNodeNumCells(node);
+        while (low != high)
+        {
+            uint32_t mid = (low + high) / 2;
+            if (*leafNodeKey(node, mid) > highId)
+            {
+                high = mid;
+            }
+            else
+            {
+                low = mid + 1;
+            }
+        }
+        if (low > 0)
+        {
+            *id = *leafNodeKey(node, low - 1);
+        }
+        releasePage(pager, pageNum, node);
+        return low > 0;
+    }
+    uint32_t childNum = internalNodeFindChild(node, treeKey(highId, 0));
+    releasePage(pager, pageNum, node);
+    while (true)
+    {
+        // Only one page is held at a time, as snapshots need
+        node = readPage(pager, pageNum);
+        uint32_t childPageNum = *internalNodeChild(node, childNum);
+        releasePage(pager, pageNum, node);
+        if (treeMaxId(pager, childPageNum, highId, id))
+        {
+            return true;
+        }
+        if (childNum == 0)
+        {
+            return false;
+        }
+        childNum--;
+    }
+}
+
+/**
+ * @brief count the rows with ids in [lowId, highId], a leaf at a time
+ *
+ * A leaf wholly inside the range counts as its number of cells; only the
+ * leaves at the ends are filtered, by the selection kernels.
+ */
+static uint32_t countRange(Table *table, uint32_t lowId, uint32_t highId)
+{
+    uint32_t count = 0;
+    Cursor cursor;
+    tableSeek(table, lowId, &cursor);
+    while (!(cursor.EOT))
+    {
+        void *node = cursorLeaf(&cursor);
+        uint32_t numCells = *leafNodeNumCells(node);
+        bool pastRange = numCells > 0 && *leafNodeKey(node, numCells - 1) > highId;
+        if (numCells > 0 && *leafNodeKey(node, 0) >= lowId && !pastRange)
+        {
+            count += numCells;
+        }
+        else
+        {
+            uint64_t selected[LEAF_MASK_WORDS];
+            leafNodeSelectKeys(node, lowId, highId, selected);
+            for (uint32_t word = 0; word < LEAF_MASK_WORDS; word++)
+            {
+                count += __builtin_popcountll(selected[word]);
+            }
+            countStat(STAT_ROWS_SCANNED, numCells);
+        }
+        cursorRelease(&cursor);
+        if (pastRange)
+        {
+            break;
+        }
+        cursor.cellNum = numCells > 0 ? numCells - 1 : 0;
+        cursorAdvance(&cursor);
+    }
+    return count;
+}
+
+/**
+ * @brief fold the rows of one unpartitioned table that a select matches
+ * into aggregates, reading none of them
+ */
+static void aggregateRows(Statement *statement, Table *table, Aggregates *aggregates)
+{
+    Predicate *predicate = &(statement->predicate);
+    if (predicate->type == PREDICATE_TEXT_EQUAL)
+    {
+        // Index entries carry the ids
+        IndexProbe probe;
+        indexProbeBegin(&probe, tableIndex(table, predicate->column), predicate->value,
+                        strlen(predicate->value));
+        uint32_t id;
+        while (indexProbeNext(&probe, &id))
+        {
+            aggregatesAdd(aggregates, id, id, 1);
+        }
+        return;
+    }
+
+    Cursor cursor;
+    tableSeek(table, predicate->lowId, &cursor);
+    if (cursor.EOT || predicate->lowId > predicate->highId)
+    {
+        return;
+    }
+    uint32_t minId = cursorKey(&cursor);
+    uint32_t maxId;
+    if (minId > predicate->highId ||
+        !treeMaxId(table->pager, table->rootPageNum, predicate->highId, &maxId))
+    {
+        return;
+    }
+    uint32_t count = 0;
+    if (projectsColumn(&(statement->projection), COLUMN_COUNT))
+    {
+        // When the range takes in the first and the last row, it takes in
+        // every one
+        uint32_t firstId = minId;
+        uint32_t lastId = maxId;
+        if (predicate->lowId > 0)
+        {
+            tableSeek(table, 0, &cursor);
+            firstId = cursorKey(&cursor);
+        }
+        if (predicate->highId < UINT32_MAX)
+        {
+            treeMaxId(table->pager, table->rootPageNum, UINT32_MAX, &lastId);
+        }
+        count = firstId == minId && lastId == maxId
+                    ? headerRowCount(table->pager)
+                    : countRange(table, minId, maxId);
+    }
+    aggregatesAdd(aggregates, minId, maxId, count);
+}
+
+ExecuteResult executeSelectStatement(Statement *statement, Table *table)
+{
+    char buffer[SINK_BUFFER_SIZE];
+    ResultSink sink;
+    ResultSink *output = NULL;
+    if (table->output != NULL)
+    {
+        sinkOpenFile(&sink, table->output, table->outputFormat, buffer, sizeof(buffer));
+        output = &sink;
+    }
+
+    uint32_t first;
+    uint32_t last;
+    statementSpan(statement, table, &first, &last);
+    if (isAggregate(&(statement->projection)))
+    {
+        uint32_t numParts;
+        Table *parts = tableParts(table, &numParts);
+        Aggregates aggregates;
+        aggregatesBegin(&aggregates);
+        for (uint32_t i = first; i <= last; i++)
+        {
+            aggregateRows(statement, &parts[i], &aggregates);
+        }
+        if (output != NULL)
+        {
+            printAggregates(output, &(statement->projection), &aggregates);
+        }
+    }
+    else if (table->partitions == NULL)
+    {
+        selectRows(statement, table, output);
+    }
+    else if (first == last || output == NULL || table->partitioning == PARTITION_RANGE ||
+             statement->predicate.type == PREDICATE_TEXT_EQUAL)
+    {
+        // Range partitions hold ascending runs of ids, so they are read in
+        // turn; so are partitions searched by index
+        for (uint32_t i = first; i <= last; i++)
+        {
+            selectRows(statement, &table->partitions[i], output);
+        }
+    }
+    else if (table->scanThreads > 1 &&
+             statement->predicate.highId - statement->predicate.lowId >= PARTITION_SCAN_MIN_IDS)
+    {
+        partitionScan(statement, table, first, last, output);
+    }
+    else
+    {
+        mergePartitions(statement, table, first, last, output);
+    }
+
+    if (output != NULL)
+    {
+        sinkClose(output);
+    }
+    return EXECUTE_SUCCESS;
+}
+
+/**
+ * @brief begin, commit or roll back a transaction
+ *
+ * Until the commit, commitPager() leaves every change pending, so the
+ * statements in between become durable together with one WAL fsync, or
+ * not at all; commitParts() makes that hold across partitions too.
+ */
+static ExecuteResult executeTransactionStatement(Statement *statement, Table *table)
+{
+    // Every partition is in the transaction or none is
+    if ((statement->type == STATEMENT_BEGIN) == table->pager->inTransaction)
+    {
+        return table->pager->inTransaction ? EXECUTE_IN_TRANSACTION : EXECUTE_NO_TRANSACTION;
+    }
+    uint32_t numParts;
+    Table *parts = tableParts(table, &numParts);
+    for (uint32_t i = 0; i < numParts; i++)
+    {
+        Pager *pager = parts[i].pager;
+        switch (statement->type)
+        {
+        case (STATEMENT_BEGIN):
+            // A rollback goes back to the last commit frame
+            commitPager(pager);
+            pager->inTransaction = true;
+            pager->transactionNumPages = pager->numPages;
+            break;
+        case (STATEMENT_COMMIT):
+            pager->inTransaction = false;
+            break;
+        default:
+            rollbackPager(pager);
+            break;
+        }
+    }
+    if (statement->type == STATEMENT_COMMIT)
+    {
+        if (table->partitions != NULL)
+        {
+            commitParts(table, 0, numParts - 1);
+        }
+        else
+        {
+            commitPager(table->pager);
+        }
+    }
+    // Partitions went to their WALs first so their fsyncs run back to back
+    for (uint32_t i = 0; i < numParts && statement->type == STATEMENT_COMMIT; i++)
+    {
+        walSync(parts[i].pager->wal);
+    }
+    return EXECUTE_SUCCESS;
+}
+
+ExecuteResult executeStatement(Statement *statement, Table *table)
+{
+    uint64_t start = monotonicNanos();
+    ExecuteResult result = EXECUTE_SUCCESS;
+    switch (statement->type)
+    {
+    case (STATEMENT_INSERT):
+        result = executeInsertStatement(statement, table);
+        break;
+    case (STATEMENT_SELECT):
+        result = executeSelectStatement(statement, table);
+        break;
+    case (STATEMENT_DELETE):
+        result = executeDeleteStatement(statement, table);
+        break;
+    case (STATEMENT_BEGIN):
+    case (STATEMENT_COMMIT):
+    case (STATEMENT_ROLLBACK):
+        result = executeTransactionStatement(statement, table);
+        break;
+    }
+    countLatency(STAT_EXECUTE_NANOS, start);
+    return result;
+}
+
+/*
+ * Embedding API. Every call that reaches the engine runs inside an
+ * ErrorScope, so failures come back as a DbResult instead of exiting.
+ * Selects read through snapshots; inserts, deletes and vacuum steps take
+ * the writeLocks of the partitions they change and go through the buffer
+ * pool, which no reader touches.
+ */
+
+static DbResult setError(Database *db, DbResult code, const char *message)
+{
+    pthread_mutex_lock(&db->lock);
+    db->errorCode = code;
+    snprintf(db->errorMessage, ERROR_MESSAGE_SIZE, "%s", message);
+    pthread_mutex_unlock(&db->lock);
+    return code;
+}
+
+/**
+ * @brief the sticky error of a failed database, or DB_OK
+ */
+static DbResult failedResult(Database *db)
+{
+    pthread_mutex_lock(&db->lock);
+    DbResult result = db->failed ? db->errorCode : DB_OK;
+    pthread_mutex_unlock(&db->lock);
+    return result;
+}
+
+/**
+ * @brief run body(arg), catching anything it raises
+ *
+ * A caught error is sticky: the engine may have stopped half way through
+ * changing a page, so every later call on db fails with the same code.
+ */
+static DbResult runGuarded(Database *db, DbResult (*body)(void *arg), void *arg)
+{
+    DbResult failed = failedResult(db);
+    if (failed != DB_OK)
+    {
+        return failed;
+    }
+    ErrorScope scope;
+    ErrorScope *outer = errorScope;
+    errorScope = &scope;
+    if (setjmp(scope.jump) != 0)
+    {
+        errorScope = outer;
+        setError(db, scope.code, scope.message);
+        pthread_mutex_lock(&db->lock);
+        db->failed = true;
+        pthread_mutex_unlock(&db->lock);
+        return scope.code;
+    }
+    DbResult result = body(arg);
+    errorScope = outer;
+    return result;
+}
+
+static DbResult openBody(void *arg)
+{
+    OpenRequest *request = arg;
+    request->db->table = openDatabase(request->fn, request->options);
+    return DB_OK;
+}
+
+static DbResult checkpointBody(void *arg)
+{
+    uint32_t numParts;
+    Table *parts = tableParts(arg, &numParts);
+    for (uint32_t i = 0; i < numParts; i++)
+    {
+        if (parts[i].pager->inTransaction)
+        {
+            rollbackPager(parts[i].pager);
+        }
+        commitPager(parts[i].pager);
+        checkpointPager(parts[i].pager);
+    }
+    return DB_OK;
+}
+
+/**
+ * @brief run an insert, a delete or a transaction statement
+ */
+static DbResult writeBody(void *arg)
+{
+    DbStatement *stmt = arg;
+    switch (executeStatement(&(stmt->statement), stmt->db->table))
+    {
+    case (EXECUTE_SUCCESS):
+        return DB_DONE;
+    case (EXECUTE_DUPLICATE_KEY):
+        return setError(stmt->db, DB_ERROR_DUPLICATE_KEY, "Duplicate key.");
+    case (EXECUTE_IN_TRANSACTION):
+        return setError(stmt->db, DB_ERROR_MISUSE, "A transaction is already open.");
+    default:
+        return setError(stmt->db, DB_ERROR_MISUSE, "No transaction is open.");
+    }
+}
+
+/**
+ * @brief move a select to its next row, starting it if need be
+ *
+ * A select sees the table as of its first step, whatever is inserted while
+ * it runs. The caller has set readSnapshot.
+ */
+static DbResult selectBody(void *arg)
+{
+    DbStatement *stmt = arg;
+    Table *table = stmt->table;
+    Predicate *predicate = &(stmt->statement.predicate);
+    bool indexed = predicate->type == PREDICATE_TEXT_EQUAL;
+    if (!stmt->active)
+    {
+        if (!stmt->snapshot.open)
+        {
+            snapshotOpen(&(stmt->snapshot), table->pager);
+        }
+        if (indexed)
+        {
+            indexProbeBegin(&(stmt->probe), tableIndex(table, predicate->column),
+                            predicate->value, strlen(predicate->value));
+        }
+        else
+        {
+            tableSeek(table, predicate->lowId, &(stmt->cursor));
+        }
+        stmt->active = true;
+    }
+    else
+    {
+        cursorRelease(&(stmt->cursor));
+        if (!indexed)
+        {
+            cursorAdvance(&(stmt->cursor));
+        }
+    }
+    stmt->leaf = NULL;
+
+    uint32_t id;
+    if (indexed)
+    {
+        if (indexProbeNext(&(stmt->probe), &id))
+        {
+            stmt->leaf = indexedRow(table, id, &(stmt->cursor));
+            countStat(STAT_ROWS_SCANNED, 1);
+            countStat(STAT_ROWS_RETURNED, 1);
+            return DB_ROW;
+        }
+    }
+    else if (!(stmt->cursor.EOT))
+    {
+        void *node = cursorLeaf(&(stmt->cursor));
+        if (leafNodeRowId(node, stmt->cursor.cellNum) <= predicate->highId)
+        {
+            stmt->leaf = node;
+            countStat(STAT_ROWS_SCANNED, 1);
+            countStat(STAT_ROWS_RETURNED, 1);
+            return DB_ROW;
+        }
+        cursorRelease(&(stmt->cursor));
+    }
+    stmt->active = false;
+    snapshotClose(&(stmt->snapshot));
+    return DB_DONE;
+}
+
+/**
+ * @brief selectBody() on every part of a partitioned select, merged
+ *
+ * Parts are started together and advanced one row at a time, so their
+ * rows come out in id order; an indexed select reads them in turn.
+ */
+static DbResult mergeBody(void *arg)
+{
+    DbStatement *stmt = arg;
+    Table *table = stmt->db->table;
+    uint32_t first;
+    uint32_t last;
+    statementSpan(&(stmt->statement), table, &first, &last);
+    for (uint32_t i = first; i <= last; i++)
+    {
+        DbStatement *part = &stmt->parts[i];
+        if (!stmt->active)
+        {
+            // Whatever was bound since the last run
+            part->statement = stmt->statement;
+        }
+        if (!stmt->active || i == stmt->current)
+        {
+            readSnapshot = &(part->snapshot);
+            selectBody(part);
+            readSnapshot = NULL;
+        }
+    }
+    stmt->active = true;
+    stmt->leaf = NULL;
+
+    bool indexed = stmt->statement.predicate.type == PREDICATE_TEXT_EQUAL;
+    for (uint32_t i = first; i <= last; i++)
+    {
+        DbStatement *part = &stmt->parts[i];
+        if (part->leaf == NULL)
+        {
+            continue;
+        }
+        if (stmt->leaf == NULL ||
+            (!indexed && leafNodeRowId(part->leaf, part->cursor.cellNum) <
+                             leafNodeRowId(stmt->leaf, stmt->cursor.cellNum)))
+        {
+            stmt->current = i;
+            stmt->leaf = part->leaf;
+            stmt->cursor.cellNum = part->cursor.cellNum;
+        }
+    }
+    if (stmt->leaf == NULL)
+    {
+        stmt->active = false;
+        return DB_DONE;
+    }
+    return DB_ROW;
+}
+
+/**
+ * @brief compute an aggregate select's row; each part reads its own
+ * snapshot, all of them opened by the caller
+ */
+static DbResult aggregateBody(void *arg)
+{
+    DbStatement *stmt = arg;
+    aggregatesBegin(&(stmt->aggregates));
+    if (stmt->parts == NULL)
+    {
+        aggregateRows(&(stmt->statement), stmt->table, &(stmt->aggregates));
+        return DB_ROW;
+    }
+    uint32_t first;
+    uint32_t last;
+    statementSpan(&(stmt->statement), stmt->table, &first, &last);
+    for (uint32_t i = first; i <= last; i++)
+    {
+        readSnapshot = &(stmt->parts[i].snapshot);
+        aggregateRows(&(stmt->statement), stmt->parts[i].table, &(stmt->aggregates));
+        readSnapshot = NULL;
+    }
+    return DB_ROW;
+}
+
+static DbResult vacuumBody(void *arg)
+{
+    vacuumStep(arg);
+    return DB_OK;
+}
+
+static DbResult releaseBody(void *arg)
+{
+    cursorRelease(arg);
+    return DB_OK;
+}
+
+/**
+ * @brief runGuarded() with this thread reading through stmt's snapshot
+ */
+static DbResult runSelect(DbStatement *stmt, DbResult (*body)(void *arg), void *arg)
+{
+    readSnapshot = &(stmt->snapshot);
+    DbResult result = runGuarded(stmt->db, body, arg);
+    readSnapshot = NULL;
+    return result;
+}
+
+/**
+ * @brief end a select part way through, releasing its snapshot
+ */
+static void dropCursor(DbStatement *stmt)
+{
+    if (!stmt->active)
+    {
+        return;
+    }
+    if (stmt->parts != NULL)
+    {
+        for (uint32_t i = 0; i < stmt->db->table->numPartitions; i++)
+        {
+            dropCursor(&stmt->parts[i]);
+        }
+    }
+    else
+    {
+        if (stmt->leaf != NULL)
+        {
+            runSelect(stmt, releaseBody, &(stmt->cursor));
+        }
+        snapshotClose(&(stmt->snapshot));
+    }
+    stmt->active = false;
+    stmt->leaf = NULL;
+}
+
+static void unlockWriters(Database *db, uint32_t first, uint32_t last)
+{
+    for (uint32_t i = first; i <= last; i++)
+    {
+        pthread_mutex_unlock(&db->writeLocks[i]);
+    }
+}
+
+/**
+ * @brief take the writeLocks of partitions first to last, unless this
+ * thread holds them all for a transaction
+ */
+static void writerLock(Database *db, uint32_t first, uint32_t last)
+{
+    if (transactionDb != db)
+    {
+        for (uint32_t i = first; i <= last; i++)
+        {
+            pthread_mutex_lock(&db->writeLocks[i]);
+        }
+    }
+}
+
+static void writerUnlock(Database *db, uint32_t first, uint32_t last)
+{
+    if (transactionDb != db)
+    {
+        unlockWriters(db, first, last);
+    }
+}
+
+DbResult dbOpen(const char *fn, const PagerOptions *options, Database **db)
+{
+    PagerOptions defaults = {
+        .numFrames = DEFAULT_POOL_FRAMES,
+        .groupCommit = DEFAULT_GROUP_COMMIT,
+        .useMmap = false,
+        .columnar = false,
+        .compress = false,
+        .numPartitions = 1,
+        .partitioning = PARTITION_HASH,
+        .partitionWidth = 0,
+    };
+    *db = calloc(1, sizeof(Database));
+    pthread_mutex_init(&(*db)->lock, NULL);
+    for (uint32_t i = 0; i < MAX_PARTITIONS; i++)
+    {
+        pthread_mutex_init(&(*db)->writeLocks[i], NULL);
+    }
+    OpenRequest request = {
+        .db = *db,
+        .fn = fn,
+        .options = options != NULL ? options : &defaults,
+    };
+    return runGuarded(*db, openBody, &request);
+}
+
+DbResult dbClose(Database *db)
+{
+    pthread_mutex_lock(&db->lock);
+    uint32_t numStatements = db->numStatements;
+    pthread_mutex_unlock(&db->lock);
+    if (numStatements > 0)
+    {
+        return setError(db, DB_ERROR_MISUSE, "Finalize every statement before closing.");
+    }
+    if (transactionDb == db)
+    {
+        transactionDb = NULL;
+        unlockWriters(db, 0, db->table->numPartitions - 1);
+    }
+    DbResult result = failedResult(db);
+    if (db->table != NULL)
+    {
+        result = runGuarded(db, checkpointBody, db->table);
+        if (!releaseDatabase(db->table, failedResult(db) == DB_OK) && result == DB_OK)
+        {
+            result = DB_ERROR_IO;
+        }
+    }
+    pthread_mutex_destroy(&db->lock);
+    for (uint32_t i = 0; i < MAX_PARTITIONS; i++)
+    {
+        pthread_mutex_destroy(&db->writeLocks[i]);
+    }
+    free(db);
+    return result;
+}
+
+DbResult dbPrepare(Database *db, const char *sql, DbStatement **stmt)
+{
+    *stmt = NULL;
+    DbResult failed = failedResult(db);
+    if (failed != DB_OK)
+    {
+        return failed;
+    }
+    Statement statement;
+    switch (prepareStatement(sql, &statement))
+    {
+    case (PREPARE_SUCCESS):
+        break;
+    case (PREPARE_NEGATIVE_ID):
+        return setError(db, DB_ERROR_RANGE, "ID must be positive.");
+    case (PREPARE_STRING_TOO_LONG):
+        return setError(db, DB_ERROR_TOO_LONG, "String is too long.");
+    default:
+        return setError(db, DB_ERROR_SYNTAX, "Syntax error. Could not parse statement.");
+    }
+
+    *stmt = malloc(sizeof(DbStatement));
+    (*stmt)->db = db;
+    (*stmt)->table = db->table;
+    (*stmt)->statement = statement;
+    (*stmt)->active = false;
+    (*stmt)->leaf = NULL;
+    (*stmt)->snapshot.open = false;
+    (*stmt)->snapshot.pages = NULL;
+    (*stmt)->parts = NULL;
+    (*stmt)->current = 0;
+    if (statement.type == STATEMENT_SELECT && db->table->partitions != NULL)
+    {
+        (*stmt)->parts = malloc(sizeof(DbStatement) * db->table->numPartitions);
+        for (uint32_t i = 0; i < db->table->numPartitions; i++)
+        {
+            DbStatement *part = &(*stmt)->parts[i];
+            *part = **stmt;
+            part->table = &db->table->partitions[i];
+            part->parts = NULL;
+            part->snapshot.pages = malloc((size_t)SNAPSHOT_PAGES * PAGE_SIZE);
+        }
+    }
+    else if (statement.type == STATEMENT_SELECT)
+    {
+        (*stmt)->snapshot.pages = malloc((size_t)SNAPSHOT_PAGES * PAGE_SIZE);
+    }
+    pthread_mutex_lock(&db->lock);
+    db->numStatements++;
+    pthread_mutex_unlock(&db->lock);
+    return DB_OK;
+}
+
+static DbResult bindResult(Database *db, BindResult result)
+{
+    switch (result)
+    {
+    case (BIND_SUCCESS):
+        return DB_OK;
+    case (BIND_OUT_OF_RANGE):
+        return setError(db, DB_ERROR_RANGE, "No placeholder with that index.");
+    case (BIND_TYPE_MISMATCH):
+        return setError(db, DB_ERROR_MISMATCH, "Placeholder takes the other kind of value.");
+    default:
+        return setError(db, DB_ERROR_TOO_LONG, "String is too long.");
+    }
+}
+
+DbResult dbBindId(DbStatement *stmt, uint32_t index, uint32_t value)
+{
+    if (stmt->active)
+    {
+        return setError(stmt->db, DB_ERROR_MISUSE, "Reset the statement before binding.");
+    }
+    return bindResult(stmt->db, bindId(&(stmt->statement), index, value));
+}
+
+DbResult dbBindText(DbStatement *stmt, uint32_t index, const char *value,
+                    uint32_t length)
+{
+    if (stmt->active)
+    {
+        return setError(stmt->db, DB_ERROR_MISUSE, "Reset the statement before binding.");
+    }
+    return bindResult(stmt->db, bindText(&(stmt->statement), index, value, length));
+}
+
+/**
+ * @brief open the snapshots of parts first to last of a partitioned select
+ *
+ * They agree on which commits they see: none is opened while a commit
+ * across partitions is being shown, and all are opened again if one began
+ * meanwhile. Writers are never waited for, so an open transaction does not
+ * hold readers up.
+ */
+static void openPartSnapshots(DbStatement *stmt, uint32_t first, uint32_t last)
+{
+    CommitLog *log = stmt->db->table->commitLog;
+    for (;;)
+    {
+        unsigned started = atomic_load(&log->started);
+        if (atomic_load(&log->finished) != started)
+        {
+            sched_yield();
+            continue;
+        }
+        for (uint32_t i = first; i <= last; i++)
+        {
+            snapshotOpen(&(stmt->parts[i].snapshot), stmt->parts[i].table->pager);
+        }
+        if (atomic_load(&log->started) == started)
+        {
+            return;
+        }
+        for (uint32_t i = first; i <= last; i++)
+        {
+            snapshotClose(&(stmt->parts[i].snapshot));
+        }
+    }
+}
+
+/**
+ * @brief dbStep() on an aggregate select: its row, then DB_DONE
+ *
+ * The snapshots last only while the row is computed.
+ */
+static DbResult stepAggregate(DbStatement *stmt)
+{
+    Database *db = stmt->db;
+    DbResult failed = failedResult(db);
+    if (stmt->active || failed != DB_OK)
+    {
+        stmt->active = false;
+        return failed != DB_OK ? failed : DB_DONE;
+    }
+    uint32_t first = 0;
+    uint32_t last = 0;
+    if (stmt->parts != NULL)
+    {
+        statementSpan(&(stmt->statement), db->table, &first, &last);
+        openPartSnapshots(stmt, first, last);
+    }
+    else
+    {
+        snapshotOpen(&(stmt->snapshot), stmt->table->pager);
+    }
+    // aggregateBody() moves readSnapshot from part to part
+    DbResult result = stmt->parts != NULL ? runGuarded(db, aggregateBody, stmt)
+                                          : runSelect(stmt, aggregateBody, stmt);
+    readSnapshot = NULL;
+    for (uint32_t i = first; stmt->parts != NULL && i <= last; i++)
+    {
+        snapshotClose(&(stmt->parts[i].snapshot));
+    }
+    snapshotClose(&(stmt->snapshot));
+    stmt->active = result == DB_ROW;
+    return result;
+}
+
+DbResult dbStep(DbStatement *stmt)
+{
+    Database *db = stmt->db;
+    StatementType type = stmt->statement.type;
+    if (type == STATEMENT_SELECT && isAggregate(&(stmt->statement.projection)))
+    {
+        return stepAggregate(stmt);
+    }
+    if (type == STATEMENT_SELECT && stmt->parts != NULL)
+    {
+        DbResult failed = failedResult(db);
+        if (!stmt->active && failed == DB_OK)
+        {
+            uint32_t first;
+            uint32_t last;
+            statementSpan(&(stmt->statement), db->table, &first, &last);
+            openPartSnapshots(stmt, first, last);
+        }
+        // mergeBody() moves readSnapshot from part to part
+        DbResult result = failed != DB_OK ? failed : runGuarded(db, mergeBody, stmt);
+        readSnapshot = NULL;
+        return result;
+    }
+    if (type == STATEMENT_SELECT)
+    {
+        return runSelect(stmt, selectBody, stmt);
+    }
+    if (type == STATEMENT_BEGIN && transactionDb != NULL && transactionDb != db)
+    {
+        return setError(db, DB_ERROR_MISUSE,
+                        "This thread has a transaction open on another database.");
+    }
+    bool held = transactionDb == db;
+    uint32_t first;
+    uint32_t last;
+    statementSpan(&(stmt->statement), db->table, &first, &last);
+    writerLock(db, first, last);
+    DbResult result = runGuarded(db, writeBody, stmt);
+    bool ended = type == STATEMENT_COMMIT || type == STATEMENT_ROLLBACK;
+    // Other threads' inserts wait for the commit, or for a failure
+    bool open = held ? !(result == DB_DONE && ended)
+                     : result == DB_DONE && type == STATEMENT_BEGIN;
+    if (open && failedResult(db) == DB_OK)
+    {
+        transactionDb = db;
+        return result;
+    }
+    if (held)
+    {
+        // The transaction's begin took every partition's
+        transactionDb = NULL;
+        first = 0;
+        last = db->table->numPartitions - 1;
+    }
+    // first is past last when the statement spans no partition
+    if (first <= last)
+    {
+        unlockWriters(db, first, last);
+    }
+    return result;
+}
+
+DbResult dbVacuum(Database *db)
+{
+    uint32_t numParts;
+    Table *parts = tableParts(db->table, &numParts);
+    DbResult result = DB_OK;
+    for (uint32_t i = 0; i < numParts && result == DB_OK; i++)
+    {
+        Vacuum vacuum;
+        vacuumBegin(&vacuum, &parts[i]);
+        while (result == DB_OK && !vacuum.done)
+        {
+            // Writers get a turn between steps
+            writerLock(db, i, i);
+            result = runGuarded(db, vacuumBody, &vacuum);
+            writerUnlock(db, i, i);
+        }
+    }
+    return result;
+}
+
+DbResult dbReset(DbStatement *stmt)
+{
+    dropCursor(stmt);
+    return failedResult(stmt->db);
+}
+
+void dbFinalize(DbStatement *stmt)
+{
+    if (stmt == NULL)
+    {
+        return;
+    }
+    dropCursor(stmt);
+    pthread_mutex_lock(&stmt->db->lock);
+    stmt->db->numStatements--;
+    pthread_mutex_unlock(&stmt->db->lock);
+    for (uint32_t i = 0; stmt->parts != NULL && i < stmt->db->table->numPartitions; i++)
+    {
+        free(stmt->parts[i].snapshot.pages);
+    }
+    free(stmt->parts);
+    free(stmt->snapshot.pages);
+    free(stmt);
+}
+
+uint32_t dbColumnCount(DbStatement *stmt)
+{
+    if (stmt->statement.type != STATEMENT_SELECT)
+    {
+        return 0;
+    }
+    return stmt->statement.projection.numColumns;
+}
+
+/**
+ * @brief which column the current row has at index, if any
+ */
+static bool rowColumn(DbStatement *stmt, uint32_t index, Column *column)
+{
+    bool ready = isAggregate(&(stmt->statement.projection)) ? stmt->active
+                                                            : stmt->leaf != NULL;
+    if (!ready || index >= dbColumnCount(stmt))
+    {
+        return false;
+    }
+    *column = stmt->statement.projection.columns[index];
+    return true;
+}
+
+bool dbColumnIsNull(DbStatement *stmt, uint32_t index)
+{
+    Column column;
+    if (!rowColumn(stmt, index, &column) || !isAggregate(&(stmt->statement.projection)))
+    {
+        return false;
+    }
+    return aggregateIsNull(&(stmt->aggregates), column);
+}
+
+uint32_t dbColumnInt(DbStatement *stmt, uint32_t index)
+{
+    Column column;
+    if (!rowColumn(stmt, index, &column) ||
+        column == COLUMN_USERNAME || column == COLUMN_EMAIL)
+    {
+        return 0;
+    }
+    if (column != COLUMN_ID)
+    {
+        return aggregateValue(&(stmt->aggregates), column);
+    }
+    return leafNodeRowId(stmt->leaf, stmt->cursor.cellNum);
+}
+
+const char *dbColumnText(DbStatement *stmt, uint32_t index, uint32_t *length)
+{
+    Column column;
+    *length = 0;
+    if (!rowColumn(stmt, index, &column))
+    {
+        return NULL;
+    }
+    switch (column)
+    {
+    case (COLUMN_USERNAME):
+    case (COLUMN_EMAIL):
+        return leafNodeText(stmt->leaf, stmt->cursor.cellNum, column, length);
+    default:
+        return NULL;
+    }
+}
+
+const char *dbErrorMessage(Database *db)
+{
+    return db->errorMessage;
+}
+
+void dbStats(DbStats *stats)
+{
+    uint64_t counts[NUM_STATS];
+    pthread_mutex_lock(&statsLock);
+    memcpy(counts, retiredStats, sizeof(counts));
+    for (StatsSlot *slot = statsSlots; slot != NULL; slot = slot->next)
+    {
+        for (uint32_t i = 0; i < NUM_STATS; i++)
+        {
+            counts[i] += atomic_load_explicit(&slot->counts[i], memory_order_relaxed);
+        }
+    }
+    pthread_mutex_unlock(&statsLock);
+
+    stats->pageHits = counts[STAT_PAGE_HITS];
+    stats->pageMisses = counts[STAT_PAGE_MISSES];
+    stats->evictions = counts[STAT_EVICTIONS];
+    stats->bytesRead = counts[STAT_BYTES_READ];
+    stats->bytesWritten = counts[STAT_BYTES_WRITTEN];
+    stats->walBytesWritten = counts[STAT_WAL_BYTES_WRITTEN];
+    stats->rowsScanned = counts[STAT_ROWS_SCANNED];
+    stats->rowsReturned = counts[STAT_ROWS_RETURNED];
+    memcpy(stats->prepareNanos, &counts[STAT_PREPARE_NANOS], sizeof(stats->prepareNanos));
+    memcpy(stats->executeNanos, &counts[STAT_EXECUTE_NANOS], sizeof(stats->executeNanos));
+}
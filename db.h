@@ -0,0 +1,417 @@
+/*
+ * Storage engine interface. Applications embed the engine through the
+ * handle-based db*() functions at the end of this file; the shell and the
+ * benchmark drive Table directly.
+ *
+ * Build as a library: cc -O2 -pthread -c db.c && ar rcs libdb.a db.o
+ */
+#ifndef DB_H
+#define DB_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define COLUMN_USERNAME_SIZE 32
+#define COLUMN_EMAIL_SIZE 255
+#define DEFAULT_POOL_FRAMES 100
+#define DEFAULT_GROUP_COMMIT 32
+#define PROJECTION_MAX_COLUMNS 8
+#define STATEMENT_MAX_PARAMS 3
+#define STATS_LATENCY_BUCKETS 32
+#define MAX_PARTITIONS 64
+
+/*
+ * The table's columns in order, as X(arg, name, NAME, TYPE, maxLength):
+ * TYPE is INT, a uint32_t, or TEXT of at most maxLength bytes, which is
+ * 255 at most. The first column is the key. Row and Column are generated
+ * from this, and so are the row codecs in db.c; see DEFINE_ROW_CODEC there.
+ */
+#define TABLE_SCHEMA(X, arg)                                 \
+    X(arg, id, ID, INT, 0)                                   \
+    X(arg, username, USERNAME, TEXT, COLUMN_USERNAME_SIZE)   \
+    X(arg, email, EMAIL, TEXT, COLUMN_EMAIL_SIZE)
+
+// A struct field for a schema column: TEXT gets room for its NUL
+#define SCHEMA_FIELD_INT(name, maxLength) uint32_t name;
+#define SCHEMA_FIELD_TEXT(name, maxLength) char name[(maxLength) + 1];
+#define SCHEMA_FIELD(arg, name, NAME, TYPE, maxLength) SCHEMA_FIELD_##TYPE(name, maxLength)
+#define SCHEMA_COLUMN(prefix, name, NAME, TYPE, maxLength) prefix##NAME,
+
+typedef struct Statement Statement;
+typedef struct Predicate Predicate;
+typedef struct Projection Projection;
+typedef struct Row Row;
+typedef struct Table Table;
+typedef struct Pager Pager;
+typedef struct PagerOptions PagerOptions;
+typedef struct Index Index;
+typedef struct CommitLog CommitLog;
+typedef struct Database Database;
+typedef struct DbStatement DbStatement;
+typedef struct DbStats DbStats;
+
+typedef enum
+{
+    EXECUTE_SUCCESS,
+    EXECUTE_DUPLICATE_KEY,
+    EXECUTE_IN_TRANSACTION, // begin while a transaction is open
+    EXECUTE_NO_TRANSACTION  // commit or rollback while none is
+} ExecuteResult;
+
+typedef enum
+{
+    PREPARE_SUCCESS,
+    PREPARE_NEGATIVE_ID,
+    PREPARE_SYNTAX_ERROR,
+    PREPARE_STRING_TOO_LONG,
+    PREPARE_UNRECOGNIZED_STATEMENT,
+} PrepareResult;
+
+typedef enum
+{
+    BIND_SUCCESS,
+    BIND_OUT_OF_RANGE,   // no placeholder with that index
+    BIND_TYPE_MISMATCH,  // placeholder takes the other kind of value
+    BIND_STRING_TOO_LONG
+} BindResult;
+
+// Result of a db*() call. Codes from DB_ERROR_IO to DB_ERROR_INTERNAL
+// fail the database: only dbFinalize() and dbClose() work afterwards.
+typedef enum
+{
+    DB_OK,
+    DB_ROW,  // dbStep() has a row ready for the dbColumn*() functions
+    DB_DONE, // dbStep() ran the statement to completion
+    DB_ERROR_IO,
+    DB_ERROR_CORRUPT,
+    DB_ERROR_FULL,     // every buffer pool frame is pinned, or none could be allocated
+    DB_ERROR_INTERNAL, // an engine invariant did not hold
+    DB_ERROR_SYNTAX,
+    DB_ERROR_TOO_LONG,
+    DB_ERROR_RANGE,    // negative id, or no placeholder with that index
+    DB_ERROR_MISMATCH, // placeholder takes the other kind of value
+    DB_ERROR_DUPLICATE_KEY,
+    DB_ERROR_MISUSE
+} DbResult;
+
+typedef enum
+{
+    STATEMENT_INSERT,
+    STATEMENT_SELECT,
+    STATEMENT_DELETE,
+    STATEMENT_BEGIN,
+    STATEMENT_COMMIT,
+    STATEMENT_ROLLBACK
+} StatementType;
+
+// Numbered in schema order
+typedef enum
+{
+    TABLE_SCHEMA(SCHEMA_COLUMN, COLUMN_)
+    // Aggregates over the rows a select matches, output as one row of ids.
+    // A projection has either these or the columns above.
+    COLUMN_COUNT,  // count(*)
+    COLUMN_MIN_ID, // min(id); NULL when no row matches
+    COLUMN_MAX_ID  // max(id); NULL when no row matches
+} Column;
+
+// What a "?" placeholder sets when bound
+typedef enum
+{
+    PARAM_ID,
+    PARAM_USERNAME,
+    PARAM_EMAIL,
+    PARAM_ID_EQUAL,  // where id = ?
+    PARAM_LOW_ID,    // where id between ? and ...
+    PARAM_HIGH_ID,   // where id between ... and ?
+    PARAM_TEXT_EQUAL // where username = ? or where email = ?
+} ParamTarget;
+
+// How a partitioned table routes a row by its id
+typedef enum
+{
+    PARTITION_HASH, // a multiplicative hash of the id
+    PARTITION_RANGE // partitionWidth ids to a partition, the rest to the last
+} PartitionScheme;
+
+// How select writes rows to Table.output
+typedef enum
+{
+    OUTPUT_TEXT,  // (1, name, email)
+    OUTPUT_CSV,   // 1,name,email; fields quoted as RFC 4180 requires
+    OUTPUT_BINARY // per column: a 4-byte id, or a 2-byte length and the text;
+                  // min(id) and max(id) are a byte, 1 before the id or 0 for NULL
+} OutputFormat;
+
+typedef enum
+{
+    PREDICATE_NONE,
+    PREDICATE_ID_RANGE, // lowId <= id <= highId
+    PREDICATE_TEXT_EQUAL // column equals value; answered from its index
+} PredicateType;
+
+struct Row
+{
+    TABLE_SCHEMA(SCHEMA_FIELD, )
+};
+
+struct Predicate
+{
+    PredicateType type;
+    uint32_t lowId;
+    uint32_t highId;
+    Column column; // for PREDICATE_TEXT_EQUAL
+    char value[COLUMN_EMAIL_SIZE + 1];
+};
+
+// Columns a select outputs, in order
+struct Projection
+{
+    uint32_t numColumns;
+    Column columns[PROJECTION_MAX_COLUMNS];
+};
+
+struct Statement
+{
+    StatementType type;
+    Row rowToInsert;
+    Predicate predicate;
+    Projection projection;
+    uint32_t numParams;
+    ParamTarget params[STATEMENT_MAX_PARAMS]; // in placeholder order
+};
+
+struct PagerOptions
+{
+    uint32_t numFrames;   // buffer pool size in pages
+    uint32_t groupCommit; // commits that share one WAL fsync
+    bool useMmap;         // serve reads straight from a file mapping
+    bool columnar;        // a new file keeps table rows in PAX leaves, one
+                          // minipage per column; ignored for existing files
+    bool compress;        // a new file stores pages LZ4 compressed, each in
+                          // as few 512-byte sectors as it fits; existing
+                          // files keep the format they were created with
+    uint32_t numPartitions; // a new database spreads its rows over this many
+                            // files: <fn>, then <fn>-p1 and so on, each with
+                            // its own WAL, pool and indexes; 0 or 1 for one
+    PartitionScheme partitioning;
+    uint32_t partitionWidth; // for PARTITION_RANGE; 0 splits all ids evenly
+};
+
+/**
+ * Counters summed over every thread and database in the process. Bucket i
+ * of a latency histogram counts calls that took [2^i, 2^(i+1)) ns; the
+ * last bucket also takes anything slower.
+ */
+struct DbStats
+{
+    uint64_t pageHits;        // getPage() found the page in the pool
+    uint64_t pageMisses;      // ... or had to read it
+    uint64_t evictions;       // valid pages dropped from the pool
+    uint64_t bytesRead;       // from database files
+    uint64_t bytesWritten;    // to database files
+    uint64_t walBytesWritten;
+    uint64_t rowsScanned;     // rows selects looked at
+    uint64_t rowsReturned;    // ... and the ones they output
+    uint64_t prepareNanos[STATS_LATENCY_BUCKETS];
+    uint64_t executeNanos[STATS_LATENCY_BUCKETS];
+};
+
+struct Table
+{
+    uint32_t rootPageNum;
+    Pager *pager;
+    uint32_t scanThreads; // workers for range scans; 1 scans inline
+    FILE *output;         // where select writes rows; stdout by default,
+                          // NULL to discard them
+    OutputFormat outputFormat; // OUTPUT_TEXT by default
+    Index *indexes;       // on username and email, kept up to date by inserts
+    uint32_t numIndexes;
+    // A partitioned table routes each row to one of its partitions, whole
+    // tables in their own files; pager, rootPageNum and indexes are those
+    // of the first. NULL with numPartitions 1 otherwise.
+    Table *partitions;
+    uint32_t numPartitions;
+    PartitionScheme partitioning;
+    uint32_t partitionWidth;
+    CommitLog *commitLog; // makes commits across partitions atomic, in
+                          // <fn>-commit; NULL on the partitions themselves
+};
+
+/**
+ * @brief open database, replaying the WAL if the last run did not close it
+ *
+ * A partitioned database opens every partition; numFrames is per
+ * partition.
+ */
+Table *openDatabase(const char *fn, const PagerOptions *options);
+
+/**
+ * @brief checkpoint, close and free the table; an open transaction is
+ * rolled back
+ */
+void closeDatabase(Table *table);
+
+/**
+ * @brief let selects use up to scanThreads workers
+ *
+ * Capped so the workers cannot pin every frame in the buffer pool.
+ */
+void setScanThreads(Table *table, uint32_t scanThreads);
+
+/**
+ * @brief compile sql into statement
+ *
+ * Values written as "?" are placeholders, numbered from 0 in the order they
+ * appear; set them with bindId() and bindText(). A prepared statement can
+ * be bound and executed any number of times without being parsed again.
+ * Placeholders that are never bound read as 0 or the empty string.
+ */
+PrepareResult prepareStatement(const char *sql, Statement *statement);
+BindResult bindId(Statement *statement, uint32_t index, uint32_t value);
+BindResult bindText(Statement *statement, uint32_t index, const char *value,
+                    uint32_t length);
+
+ExecuteResult executeInsertStatement(Statement *statement, Table *table);
+ExecuteResult executeSelectStatement(Statement *statement, Table *table);
+/**
+ * @brief delete the rows a select with the same where clause would return
+ *
+ * Emptied leaves go on the free list at once; underfull ones stay until
+ * vacuumTable().
+ */
+ExecuteResult executeDeleteStatement(Statement *statement, Table *table);
+/**
+ * @brief run any statement
+ *
+ * Between begin and commit, inserts and deletes are not committed one by
+ * one: commit makes them durable together with a single WAL fsync, and
+ * rollback discards them without touching the database file. In a
+ * partitioned table a commit, or a delete, that changes several partitions
+ * takes effect in all of them or, after a crash, in none; readers never
+ * see it in some partitions only.
+ *
+ * On a partitioned table, an insert and a select or delete of one id touch
+ * one partition. Other selects on ids read every partition they may span,
+ * in parallel with scanThreads > 1, and still return rows in id order;
+ * selects on a text column probe each partition's index in turn.
+ *
+ * A select of count(*), min(id) or max(id) reads no rows: min and max
+ * come from one descent of the tree, and count from the row count in the
+ * file header when the where clause takes in every row. Other id ranges
+ * are counted a leaf at a time, and a text column's index holds the ids
+ * it needs.
+ */
+ExecuteResult executeStatement(Statement *statement, Table *table);
+
+void importFile(Table *table, const char *path);
+
+/**
+ * @brief merge underfull leaves and close up the holes deletes left
+ *
+ * Works through the table and then each index a few leaves at a time,
+ * committing after each step. Freed pages go on the free list, where new
+ * nodes are taken from before the file grows.
+ * @return pages freed
+ */
+uint32_t vacuumTable(Table *table);
+void printTree(Pager *pager, uint32_t pageNum, uint32_t indentationLevel);
+void printConstants();
+/**
+ * @brief print dbStats() with hit rates and latency percentiles
+ */
+void printStats(void);
+
+/**
+ * @brief open or create a database
+ *
+ * A Database may be shared between threads, each stepping its own
+ * statements: selects run concurrently with each other and with inserts,
+ * which take turns. A DbStatement belongs to one thread at a time.
+ *
+ * *db is set even when the open fails, so that dbErrorMessage() can be
+ * read; pass it to dbClose() either way.
+ * @param options pager settings, or NULL for the defaults
+ */
+DbResult dbOpen(const char *fn, const PagerOptions *options, Database **db);
+
+/**
+ * @brief checkpoint, close and free the database
+ *
+ * Fails with DB_ERROR_MISUSE while statements are unfinalized. A failed
+ * database is closed without writing; its WAL is replayed at the next open.
+ */
+DbResult dbClose(Database *db);
+
+/**
+ * @brief compile sql; placeholders work as in prepareStatement()
+ */
+DbResult dbPrepare(Database *db, const char *sql, DbStatement **stmt);
+DbResult dbBindId(DbStatement *stmt, uint32_t index, uint32_t value);
+DbResult dbBindText(DbStatement *stmt, uint32_t index, const char *value,
+                    uint32_t length);
+
+/**
+ * @brief run an insert, delete or transaction statement, or move a select
+ * to its next row
+ *
+ * An insert or delete is committed and returns DB_DONE. After begin, the
+ * thread holds the write lock until it steps commit or rollback: its own
+ * inserts and deletes wait for the commit, and other threads' wait for the
+ * lock. Its selects still read committed snapshots. A select returns
+ * DB_ROW for each row and then DB_DONE; the next step starts it again. An
+ * aggregate select returns a single DB_ROW. Rows are never printed. A
+ * select reads a snapshot taken at its first step: it never waits for
+ * inserts, or for another thread's open transaction, and sees none
+ * committed after that step. On a partitioned database it sees each commit
+ * in every partition it changed or in none.
+ */
+DbResult dbStep(DbStatement *stmt);
+
+/**
+ * @brief vacuumTable() on a shared database
+ *
+ * The write lock is taken a step at a time, so inserts and deletes on
+ * other threads wait for one step at most, and selects never wait. May
+ * run on a thread of its own.
+ */
+DbResult dbVacuum(Database *db);
+
+/**
+ * @brief abandon a select part way through so that it can be rebound
+ */
+DbResult dbReset(DbStatement *stmt);
+void dbFinalize(DbStatement *stmt);
+
+/**
+ * @brief read the row from the last DB_ROW
+ *
+ * Columns are numbered in projection order. Text is not NUL-terminated
+ * and stays valid until the next dbStep(), dbReset() or dbFinalize().
+ * A column of the other kind reads as 0 or NULL. dbColumnIsNull() tells
+ * whether a column has no value, as min(id) and max(id) of no rows have;
+ * dbColumnInt() reads such a column as 0.
+ */
+uint32_t dbColumnCount(DbStatement *stmt);
+bool dbColumnIsNull(DbStatement *stmt, uint32_t index);
+uint32_t dbColumnInt(DbStatement *stmt, uint32_t index);
+const char *dbColumnText(DbStatement *stmt, uint32_t index, uint32_t *length);
+
+/**
+ * @brief describe the last failed call on db
+ *
+ * Shared by every thread using db; a failure on another thread can
+ * replace it.
+ */
+const char *dbErrorMessage(Database *db);
+
+/**
+ * @brief read the process-wide counters
+ *
+ * Cheap enough to poll; counts from threads still running may lag by the
+ * operation in progress.
+ */
+void dbStats(DbStats *stats);
+
+#endif
@@ -0,0 +1,866 @@
+/*
+ * Network server for the database. Clients drive prepared statements
+ * through the embedding API over TCP; every worker thread runs its own
+ * epoll loop on a SO_REUSEPORT listener, and all of them share one
+ * Database.
+ *
+ * Protocol. Every message, either way, is a frame: a 4-byte length of
+ * what follows, then a 1-byte code and its payload. Integers are
+ * little-endian u32. Requests:
+ *
+ *   PREPARE   sql                            -> DB_OK handle columns
+ *   BIND_ID   handle index value             -> DB_OK
+ *   BIND_TEXT handle index text              -> DB_OK
+ *   EXECUTE   handle                         -> DB_ROW..., then DB_DONE rows
+ *   FINALIZE  handle                         -> DB_OK
+ *
+ * A reply's code is a DbResult. Each DB_ROW holds the row's columns in
+ * projection order, each a tag byte, 0 for an id followed by the id, 1
+ * for text followed by its length and bytes, or 2 alone for no value, as
+ * min(id) and max(id) of no rows have. DB_DONE holds the number of
+ * rows sent. An error code is followed by the message. Requests may be
+ * pipelined: they are answered in order, and the replies to everything
+ * read at once go out together in one write. Inserts and deletes among
+ * them share one commit, made before any select runs and before their
+ * replies are sent.
+ *
+ * Transactions are refused: they hold the write locks for the thread that
+ * began them, and a worker thread serves many clients.
+ *
+ * Build: cc -O2 -pthread server.c db.c -o server
+ */
+#define _GNU_SOURCE // accept4()
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+
+#include "db.h"
+
+#define DEFAULT_PORT 7744
+#define DEFAULT_ADDRESS "127.0.0.1"
+#define DEFAULT_SERVER_THREADS 4
+#define MAX_SERVER_THREADS 64
+#define MAX_EVENTS 64            // per epoll_wait()
+#define LISTEN_BACKLOG 512
+#define MAX_FRAME_SIZE (1 << 16) // largest request; a bigger one closes the connection
+#define READ_SIZE (1 << 16)      // bytes asked of each read()
+#define INPUT_HIGH_WATER (1 << 20)  // buffered request bytes before a
+                                    // connection stops reading
+#define OUTPUT_HIGH_WATER (1 << 20) // buffered reply bytes before a connection
+                                    // stops taking requests
+#define FRAME_HEADER_SIZE 5
+
+typedef struct Buffer Buffer;
+typedef struct Connection Connection;
+typedef struct Worker Worker;
+
+typedef enum
+{
+    REQUEST_PREPARE = 1,
+    REQUEST_BIND_ID,
+    REQUEST_BIND_TEXT,
+    REQUEST_EXECUTE,
+    REQUEST_FINALIZE
+} RequestCode;
+
+typedef enum
+{
+    COLUMN_TAG_ID,
+    COLUMN_TAG_TEXT,
+    COLUMN_TAG_NULL
+} ColumnTag;
+
+/**
+ * Bytes waiting to be parsed or sent: data[start, used).
+ */
+struct Buffer
+{
+    char *data;
+    size_t start;
+    size_t used;
+    size_t capacity;
+};
+
+struct Connection
+{
+    int fd;
+    Buffer in;
+    Buffer out;
+    DbStatement **statements; // by handle; NULL once finalized
+    uint32_t numStatements;
+    uint32_t capacity;
+    DbStatement *running;     // a select paused until out drains
+    uint32_t rowsSent;        // by running so far
+    uint32_t events;          // what epoll watches for
+    bool closed;              // the peer hung up or broke the protocol
+    Connection *prev;         // in its worker's list
+    Connection *next;
+};
+
+struct Worker
+{
+    pthread_t thread;
+    Database *db;
+    int epollFd;
+    int listenFd;
+    int stopFd; // an eventfd main writes to at shutdown
+    Connection *connections;
+    DbStatement *begin;  // for the batch of writes from one read
+    DbStatement *commit;
+    uint32_t batchWrites; // since the last select or commit
+    bool batchOpen;
+};
+
+static uint32_t getU32(const char *p)
+{
+    const uint8_t *b = (const uint8_t *)p;
+    return (uint32_t)b[0] | (uint32_t)b[1] << 8 | (uint32_t)b[2] << 16 | (uint32_t)b[3] << 24;
+}
+
+static void putU32(char *p, uint32_t value)
+{
+    uint8_t *b = (uint8_t *)p;
+    b[0] = value;
+    b[1] = value >> 8;
+    b[2] = value >> 16;
+    b[3] = value >> 24;
+}
+
+/**
+ * @brief room for len more bytes at the end of buffer
+ */
+static char *bufferReserve(Buffer *buffer, size_t len)
+{
+    if (buffer->used + len > buffer->capacity && buffer->start > 0)
+    {
+        // Move what is left down before growing
+        memmove(buffer->data, buffer->data + buffer->start, buffer->used - buffer->start);
+        buffer->used -= buffer->start;
+        buffer->start = 0;
+    }
+    if (buffer->used + len > buffer->capacity)
+    {
+        size_t capacity = buffer->capacity == 0 ? READ_SIZE : buffer->capacity;
+        while (capacity < buffer->used + len)
+        {
+            capacity *= 2;
+        }
+        buffer->data = realloc(buffer->data, capacity);
+        buffer->capacity = capacity;
+    }
+    return buffer->data + buffer->used;
+}
+
+static void bufferAppend(Buffer *buffer, const void *data, size_t len)
+{
+    memcpy(bufferReserve(buffer, len), data, len);
+    buffer->used += len;
+}
+
+static size_t bufferLength(Buffer *buffer)
+{
+    return buffer->used - buffer->start;
+}
+
+/**
+ * @brief start a reply frame; replyEnd() fills in its length
+ * @return where the frame starts, from out's start, which holds still
+ * while the buffer moves
+ */
+static size_t replyBegin(Connection *connection, DbResult code)
+{
+    Buffer *out = &connection->out;
+    char *frame = bufferReserve(out, FRAME_HEADER_SIZE);
+    frame[4] = (char)code;
+    out->used += FRAME_HEADER_SIZE;
+    return bufferLength(out) - FRAME_HEADER_SIZE;
+}
+
+static void replyEnd(Connection *connection, size_t frame)
+{
+    Buffer *out = &connection->out;
+    putU32(out->data + out->start + frame, bufferLength(out) - frame - 4);
+}
+
+static void replyU32(Connection *connection, uint32_t value)
+{
+    char bytes[4];
+    putU32(bytes, value);
+    bufferAppend(&connection->out, bytes, sizeof(bytes));
+}
+
+static void replyError(Connection *connection, Database *db, DbResult code)
+{
+    const char *message = dbErrorMessage(db);
+    size_t frame = replyBegin(connection, code);
+    bufferAppend(&connection->out, message, strlen(message));
+    replyEnd(connection, frame);
+}
+
+static void replyMessage(Connection *connection, DbResult code, const char *message)
+{
+    size_t frame = replyBegin(connection, code);
+    bufferAppend(&connection->out, message, strlen(message));
+    replyEnd(connection, frame);
+}
+
+static void replyOk(Connection *connection)
+{
+    replyEnd(connection, replyBegin(connection, DB_OK));
+}
+
+static void replyRow(Connection *connection, DbStatement *stmt)
+{
+    size_t frame = replyBegin(connection, DB_ROW);
+    uint32_t numColumns = dbColumnCount(stmt);
+    for (uint32_t i = 0; i < numColumns; i++)
+    {
+        uint32_t length;
+        const char *text = dbColumnText(stmt, i, &length);
+        char *p = bufferReserve(&connection->out, 5);
+        if (dbColumnIsNull(stmt, i))
+        {
+            p[0] = COLUMN_TAG_NULL;
+            connection->out.used += 1;
+            continue;
+        }
+        if (text == NULL)
+        {
+            p[0] = COLUMN_TAG_ID;
+            putU32(p + 1, dbColumnInt(stmt, i));
+            connection->out.used += 5;
+            continue;
+        }
+        p[0] = COLUMN_TAG_TEXT;
+        putU32(p + 1, length);
+        connection->out.used += 5;
+        bufferAppend(&connection->out, text, length);
+    }
+    replyEnd(connection, frame);
+}
+
+/**
+ * @brief the statement a request names, replying with an error if none
+ */
+static DbStatement *requestStatement(Connection *connection, const char *payload,
+                                     uint32_t len)
+{
+    uint32_t handle = len >= 4 ? getU32(payload) : UINT32_MAX;
+    if (handle >= connection->numStatements || connection->statements[handle] == NULL)
+    {
+        replyMessage(connection, DB_ERROR_MISUSE, "No statement with that handle.");
+        return NULL;
+    }
+    return connection->statements[handle];
+}
+
+static void prepareRequest(Connection *connection, Database *db, const char *payload,
+                           uint32_t len)
+{
+    char *sql = malloc(len + 1);
+    memcpy(sql, payload, len);
+    sql[len] = '\0';
+    bool transaction = strncmp(sql, "begin", 5) == 0 || strncmp(sql, "commit", 6) == 0 ||
+                       strncmp(sql, "rollback", 8) == 0;
+    DbStatement *stmt = NULL;
+    DbResult result = transaction ? DB_ERROR_MISUSE : dbPrepare(db, sql, &stmt);
+    free(sql);
+    if (transaction)
+    {
+        replyMessage(connection, result, "Transactions are not available over the server.");
+        return;
+    }
+    if (result != DB_OK)
+    {
+        replyError(connection, db, result);
+        return;
+    }
+
+    // Reuse the first finalized handle
+    uint32_t handle = 0;
+    while (handle < connection->numStatements && connection->statements[handle] != NULL)
+    {
+        handle++;
+    }
+    if (handle == connection->capacity)
+    {
+        connection->capacity = connection->capacity == 0 ? 8 : connection->capacity * 2;
+        connection->statements = realloc(connection->statements,
+                                         sizeof(DbStatement *) * connection->capacity);
+    }
+    if (handle == connection->numStatements)
+    {
+        connection->numStatements++;
+    }
+    connection->statements[handle] = stmt;
+
+    size_t frame = replyBegin(connection, DB_OK);
+    replyU32(connection, handle);
+    replyU32(connection, dbColumnCount(stmt));
+    replyEnd(connection, frame);
+}
+
+/**
+ * @brief step connection->running until it finishes or out fills up
+ * @return false if it paused
+ */
+static bool resumeExecute(Connection *connection, Database *db)
+{
+    DbStatement *stmt = connection->running;
+    DbResult result;
+    while (bufferLength(&connection->out) < OUTPUT_HIGH_WATER)
+    {
+        result = dbStep(stmt);
+        if (result != DB_ROW)
+        {
+            connection->running = NULL;
+            if (result != DB_DONE)
+            {
+                replyError(connection, db, result);
+                return true;
+            }
+            size_t frame = replyBegin(connection, DB_DONE);
+            replyU32(connection, connection->rowsSent);
+            replyEnd(connection, frame);
+            return true;
+        }
+        replyRow(connection, stmt);
+        connection->rowsSent++;
+    }
+    return false;
+}
+
+/**
+ * @brief commit the writes batched so far, if there is a batch open
+ *
+ * Their replies are already in out; if the commit fails the connection
+ * is dropped before they can be sent.
+ */
+static void batchEnd(Worker *worker, Connection *connection)
+{
+    worker->batchWrites = 0;
+    if (worker->batchOpen)
+    {
+        worker->batchOpen = false;
+        if (dbStep(worker->commit) != DB_DONE)
+        {
+            connection->closed = true;
+        }
+    }
+}
+
+static void executeRequest(Worker *worker, Connection *connection, const char *payload,
+                           uint32_t len)
+{
+    DbStatement *stmt = requestStatement(connection, payload, len);
+    if (stmt == NULL)
+    {
+        return;
+    }
+    // Only selects have columns. A lone write commits by itself; from
+    // the second on, they wait for batchEnd().
+    bool write = dbColumnCount(stmt) == 0;
+    if (!write)
+    {
+        batchEnd(worker, connection);
+    }
+    else if (!worker->batchOpen && ++worker->batchWrites == 2)
+    {
+        worker->batchOpen = dbStep(worker->begin) == DB_DONE;
+    }
+    connection->running = stmt;
+    connection->rowsSent = 0;
+    resumeExecute(connection, worker->db);
+}
+
+static void bindRequest(Connection *connection, Database *db, RequestCode code,
+                        const char *payload, uint32_t len)
+{
+    DbStatement *stmt = requestStatement(connection, payload, len);
+    if (stmt == NULL)
+    {
+        return;
+    }
+    if (len < 8 || (code == REQUEST_BIND_ID && len != 12))
+    {
+        replyMessage(connection, DB_ERROR_MISUSE, "Malformed bind.");
+        return;
+    }
+    uint32_t index = getU32(payload + 4);
+    DbResult result = code == REQUEST_BIND_ID
+                          ? dbBindId(stmt, index, getU32(payload + 8))
+                          : dbBindText(stmt, index, payload + 8, len - 8);
+    if (result != DB_OK)
+    {
+        replyError(connection, db, result);
+        return;
+    }
+    replyOk(connection);
+}
+
+static void finalizeRequest(Connection *connection, const char *payload, uint32_t len)
+{
+    DbStatement *stmt = requestStatement(connection, payload, len);
+    if (stmt != NULL)
+    {
+        dbFinalize(stmt);
+        connection->statements[getU32(payload)] = NULL;
+        replyOk(connection);
+    }
+}
+
+/**
+ * @brief answer every whole request read so far, in order
+ *
+ * Stops early while a select is paused because out is full; it resumes
+ * once out drains.
+ */
+static void processRequests(Worker *worker, Connection *connection)
+{
+    Database *db = worker->db;
+    Buffer *in = &connection->in;
+    if (connection->running != NULL && !resumeExecute(connection, db))
+    {
+        return;
+    }
+    while (bufferLength(in) >= FRAME_HEADER_SIZE &&
+           bufferLength(&connection->out) < OUTPUT_HIGH_WATER)
+    {
+        const char *frame = in->data + in->start;
+        uint32_t length = getU32(frame);
+        if (length == 0 || length > MAX_FRAME_SIZE)
+        {
+            connection->closed = true;
+            break;
+        }
+        if (bufferLength(in) < 4 + (size_t)length)
+        {
+            break; // The rest of the frame has not arrived
+        }
+        const char *payload = frame + FRAME_HEADER_SIZE;
+        uint32_t len = length - 1;
+        uint8_t code = frame[4];
+        switch (code)
+        {
+        case (REQUEST_PREPARE):
+            prepareRequest(connection, db, payload, len);
+            break;
+        case (REQUEST_BIND_ID):
+        case (REQUEST_BIND_TEXT):
+            bindRequest(connection, db, code, payload, len);
+            break;
+        case (REQUEST_EXECUTE):
+            executeRequest(worker, connection, payload, len);
+            break;
+        case (REQUEST_FINALIZE):
+            finalizeRequest(connection, payload, len);
+            break;
+        default:
+            replyMessage(connection, DB_ERROR_MISUSE, "Unknown request.");
+            break;
+        }
+        in->start += 4 + (size_t)length;
+        if (connection->running != NULL)
+        {
+            break;
+        }
+    }
+    batchEnd(worker, connection);
+    if (in->start == in->used)
+    {
+        in->start = 0;
+        in->used = 0;
+    }
+}
+
+/**
+ * @brief read everything the socket has
+ */
+static void readRequests(Connection *connection)
+{
+    Buffer *in = &connection->in;
+    while (bufferLength(in) < INPUT_HIGH_WATER)
+    {
+        char *p = bufferReserve(in, READ_SIZE);
+        ssize_t bytesRead = read(connection->fd, p, READ_SIZE);
+        if (bytesRead > 0)
+        {
+            in->used += bytesRead;
+            continue;
+        }
+        if (bytesRead == -1 && errno == EINTR)
+        {
+            continue;
+        }
+        if (bytesRead == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+        {
+            connection->closed = true;
+        }
+        return;
+    }
+}
+
+/**
+ * @brief send as much of out as the socket takes
+ */
+static void writeReplies(Connection *connection)
+{
+    Buffer *out = &connection->out;
+    while (bufferLength(out) > 0)
+    {
+        ssize_t written = send(connection->fd, out->data + out->start, bufferLength(out),
+                               MSG_NOSIGNAL);
+        if (written == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+                connection->closed = true;
+            }
+            return;
+        }
+        out->start += written;
+    }
+    out->start = 0;
+    out->used = 0;
+}
+
+static void closeConnection(Worker *worker, Connection *connection)
+{
+    if (connection->prev != NULL)
+    {
+        connection->prev->next = connection->next;
+    }
+    else
+    {
+        worker->connections = connection->next;
+    }
+    if (connection->next != NULL)
+    {
+        connection->next->prev = connection->prev;
+    }
+    epoll_ctl(worker->epollFd, EPOLL_CTL_DEL, connection->fd, NULL);
+    close(connection->fd);
+    for (uint32_t i = 0; i < connection->numStatements; i++)
+    {
+        dbFinalize(connection->statements[i]);
+    }
+    free(connection->statements);
+    free(connection->in.data);
+    free(connection->out.data);
+    free(connection);
+}
+
+/**
+ * @brief read, answer and write for one connection, then watch for what
+ * it needs next
+ *
+ * A connection with replies it cannot send yet stops reading, so a client
+ * that does not read cannot make the server buffer without limit.
+ */
+static void serveConnection(Worker *worker, Connection *connection, uint32_t events)
+{
+    if (events & (EPOLLERR | EPOLLHUP))
+    {
+        connection->closed = true;
+    }
+    if (!connection->closed && (events & EPOLLIN))
+    {
+        readRequests(connection);
+    }
+    // Answer and send until nothing more can go out
+    while (!connection->closed)
+    {
+        size_t pending = bufferLength(&connection->in);
+        processRequests(worker, connection);
+        writeReplies(connection);
+        bool progressed = bufferLength(&connection->in) != pending;
+        if (bufferLength(&connection->out) > 0 || (!progressed && connection->running == NULL))
+        {
+            break;
+        }
+    }
+    if (connection->closed)
+    {
+        closeConnection(worker, connection);
+        return;
+    }
+
+    bool blocked = bufferLength(&connection->out) > 0;
+    uint32_t wanted = blocked ? EPOLLOUT : EPOLLIN;
+    if (wanted != connection->events)
+    {
+        struct epoll_event event = {.events = wanted, .data.ptr = connection};
+        epoll_ctl(worker->epollFd, EPOLL_CTL_MOD, connection->fd, &event);
+        connection->events = wanted;
+    }
+}
+
+static void acceptConnections(Worker *worker)
+{
+    while (true)
+    {
+        int fd = accept4(worker->listenFd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd == -1)
+        {
+            // EAGAIN once the backlog is empty; anything else is the
+            // client's problem, not the server's
+            return;
+        }
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        Connection *connection = calloc(1, sizeof(Connection));
+        connection->fd = fd;
+        connection->events = EPOLLIN;
+        struct epoll_event event = {.events = EPOLLIN, .data.ptr = connection};
+        if (epoll_ctl(worker->epollFd, EPOLL_CTL_ADD, fd, &event) == -1)
+        {
+            close(fd);
+            free(connection);
+            continue;
+        }
+        connection->next = worker->connections;
+        if (worker->connections != NULL)
+        {
+            worker->connections->prev = connection;
+        }
+        worker->connections = connection;
+    }
+}
+
+static void *workerLoop(void *arg)
+{
+    Worker *worker = arg;
+    struct epoll_event events[MAX_EVENTS];
+    while (true)
+    {
+        int count = epoll_wait(worker->epollFd, events, MAX_EVENTS, -1);
+        if (count == -1 && errno != EINTR)
+        {
+            printf("Error waiting for events: %d\n", errno);
+            exit(EXIT_FAILURE);
+        }
+        for (int i = 0; i < count; i++)
+        {
+            void *source = events[i].data.ptr;
+            if (source == &worker->stopFd)
+            {
+                return NULL;
+            }
+            if (source == worker)
+            {
+                acceptConnections(worker);
+                continue;
+            }
+            serveConnection(worker, source, events[i].events);
+        }
+    }
+}
+
+static bool parseAddress(const char *address, uint16_t port, struct sockaddr_in *addr)
+{
+    memset(addr, 0, sizeof(*addr));
+    addr->sin_family = AF_INET;
+    addr->sin_port = htons(port);
+    return inet_pton(AF_INET, address, &addr->sin_addr) == 1;
+}
+
+/**
+ * @brief a non-blocking listener sharing its port with the other workers'
+ */
+static int openListener(const struct sockaddr_in *addr)
+{
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    int one = 1;
+    if (fd == -1 ||
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) == -1 ||
+        setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) == -1 ||
+        bind(fd, (const struct sockaddr *)addr, sizeof(*addr)) == -1 ||
+        listen(fd, LISTEN_BACKLOG) == -1)
+    {
+        printf("Error listening: %s\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    return fd;
+}
+
+static void startWorker(Worker *worker, Database *db, const struct sockaddr_in *addr)
+{
+    worker->db = db;
+    worker->connections = NULL;
+    worker->batchWrites = 0;
+    worker->batchOpen = false;
+    if (dbPrepare(db, "begin", &worker->begin) != DB_OK ||
+        dbPrepare(db, "commit", &worker->commit) != DB_OK)
+    {
+        printf("Error preparing: %s\n", dbErrorMessage(db));
+        exit(EXIT_FAILURE);
+    }
+    worker->listenFd = openListener(addr);
+    worker->epollFd = epoll_create1(EPOLL_CLOEXEC);
+    worker->stopFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    struct epoll_event listen = {.events = EPOLLIN, .data.ptr = worker};
+    struct epoll_event stop = {.events = EPOLLIN, .data.ptr = &worker->stopFd};
+    if (worker->epollFd == -1 || worker->stopFd == -1 ||
+        epoll_ctl(worker->epollFd, EPOLL_CTL_ADD, worker->listenFd, &listen) == -1 ||
+        epoll_ctl(worker->epollFd, EPOLL_CTL_ADD, worker->stopFd, &stop) == -1 ||
+        pthread_create(&worker->thread, NULL, workerLoop, worker) != 0)
+    {
+        printf("Error starting worker: %s\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * @brief stop a worker and drop the connections it still has, finalizing
+ * their statements
+ */
+static void stopWorker(Worker *worker)
+{
+    uint64_t one = 1;
+    if (write(worker->stopFd, &one, sizeof(one)) != sizeof(one))
+    {
+        printf("Error stopping worker: %s\n", strerror(errno));
+    }
+    pthread_join(worker->thread, NULL);
+    while (worker->connections != NULL)
+    {
+        closeConnection(worker, worker->connections);
+    }
+    dbFinalize(worker->begin);
+    dbFinalize(worker->commit);
+    close(worker->listenFd);
+    close(worker->stopFd);
+    close(worker->epollFd);
+}
+
+int main(int argc, char *argv[])
+{
+    PagerOptions options = {
+        .numFrames = DEFAULT_POOL_FRAMES,
+        .groupCommit = DEFAULT_GROUP_COMMIT,
+        .useMmap = false,
+        .columnar = false,
+        .compress = false,
+        .numPartitions = 1,
+        .partitioning = PARTITION_HASH,
+        .partitionWidth = 0,
+    };
+    const char *address = DEFAULT_ADDRESS;
+    uint16_t port = DEFAULT_PORT;
+    uint32_t numWorkers = DEFAULT_SERVER_THREADS;
+    int opt;
+    while ((opt = getopt(argc, argv, "a:cf:g:mp:P:Rt:w:z")) != -1)
+    {
+        switch (opt)
+        {
+        case 'a':
+            address = optarg;
+            break;
+        case 'c':
+            options.columnar = true;
+            break;
+        case 'f':
+            options.numFrames = strtoul(optarg, NULL, 10);
+            break;
+        case 'g':
+            options.groupCommit = strtoul(optarg, NULL, 10);
+            break;
+        case 'm':
+            options.useMmap = true;
+            break;
+        case 'p':
+            options.numPartitions = strtoul(optarg, NULL, 10);
+            break;
+        case 'P':
+            port = strtoul(optarg, NULL, 10);
+            break;
+        case 'R':
+            options.partitioning = PARTITION_RANGE;
+            break;
+        case 't':
+            numWorkers = strtoul(optarg, NULL, 10);
+            break;
+        case 'w':
+            options.partitionWidth = strtoul(optarg, NULL, 10);
+            break;
+        case 'z':
+            options.compress = true;
+            break;
+        default:
+            printf("Usage: %s [-a address] [-c] [-f frames] [-g group-commit] [-m] "
+                   "[-p partitions] [-P port] [-R] [-t threads] [-w range-width] [-z] "
+                   "<filename>\n",
+                   argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (optind >= argc)
+    {
+        printf("Must supply a database filename.\n");
+        exit(EXIT_FAILURE);
+    }
+    if (numWorkers < 1 || numWorkers > MAX_SERVER_THREADS)
+    {
+        printf("Need 1 to %u threads.\n", MAX_SERVER_THREADS);
+        exit(EXIT_FAILURE);
+    }
+    struct sockaddr_in addr;
+    if (!parseAddress(address, port, &addr))
+    {
+        printf("Bad address '%s'.\n", address);
+        exit(EXIT_FAILURE);
+    }
+
+    Database *db;
+    if (dbOpen(argv[optind], &options, &db) != DB_OK)
+    {
+        printf("Error opening '%s': %s\n", argv[optind], dbErrorMessage(db));
+        dbClose(db);
+        exit(EXIT_FAILURE);
+    }
+
+    // Workers inherit the mask, so only sigwait() below sees these
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+    Worker workers[MAX_SERVER_THREADS];
+    for (uint32_t i = 0; i < numWorkers; i++)
+    {
+        startWorker(&workers[i], db, &addr);
+    }
+    printf("Listening on %s:%u with %u threads.\n", address, port, numWorkers);
+    fflush(stdout);
+
+    int signal;
+    sigwait(&signals, &signal);
+    for (uint32_t i = 0; i < numWorkers; i++)
+    {
+        stopWorker(&workers[i]);
+    }
+    DbResult result = dbClose(db);
+    if (result != DB_OK)
+    {
+        printf("Error closing the database: %d\n", result);
+        exit(EXIT_FAILURE);
+    }
+    return 0;
+}